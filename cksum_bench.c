@@ -0,0 +1,161 @@
+/*-----------------------------------------------------------------------------
+ * File: cksum_bench.c
+ *
+ * Description:
+ *
+ * Checks and times the versions of the Internet checksum in sr_utils.c
+ * (make cksum_bench).  Every version is first compared bit for bit with
+ * the reference loop over random buffers of every length up to a jumbo
+ * frame and at every alignment; then each is timed over a range of sizes
+ * from a bare IP header to a 64k frame, and so is the default choice
+ * (auto), which switches versions at CKSUM_SIMD_MIN bytes.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+
+#define CB_MAX_LEN   9018
+#define CB_BUF_LEN   65536
+#define CB_BYTES     (64 * 1024 * 1024)    /* summed per size and version */
+
+static const int cb_sizes[] =
+{ 20, 28, 40, 48, 64, 96, 128, 256, 576, 1024, 1500, 4096, 9000, 65535 };
+
+static uint64_t cb_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------
+ * Method: cb_verify(..)
+ *
+ * Compare cksum() and cksum_ok() of impl with the reference for every
+ * length and alignment; returns the number of mismatches.
+ *
+ *---------------------------------------------------------------------*/
+
+static int cb_verify(int impl, uint8_t* buf)
+{
+    int len, off, bad = 0;
+    uint16_t want, got;
+    int want_ok, got_ok;
+
+    for (len = 0; len <= CB_MAX_LEN; len++)
+    {
+        for (off = 0; off < 8; off++)
+        {
+            /* every so often make the sum come out all ones */
+            if (len >= 2 && (len + off) % 7 == 0)
+            {
+                buf[off] = buf[off + 1] = 0;
+                cksum_use(CKSUM_REF);
+                want = cksum(buf + off, len);
+                memcpy(buf + off, &want, 2);
+            }
+
+            cksum_use(CKSUM_REF);
+            want = cksum(buf + off, len);
+            want_ok = cksum_ok(buf + off, len);
+            cksum_use(impl);
+            got = cksum(buf + off, len);
+            got_ok = cksum_ok(buf + off, len);
+
+            if (got != want || got_ok != want_ok)
+            {
+                if (bad++ < 5)
+                {
+                    fprintf(stderr, "%s: len %d offset %d: %04x/%d, want %04x/%d\n",
+                            cksum_impl_name(impl), len, off, got, got_ok,
+                            want, want_ok);
+                }
+            }
+        }
+    }
+
+    /* all zeros and all ones */
+    memset(buf, 0, CB_MAX_LEN);
+    cksum_use(CKSUM_REF); want = cksum(buf, CB_MAX_LEN);
+    cksum_use(impl);      bad += cksum(buf, CB_MAX_LEN) != want;
+    memset(buf, 0xff, CB_MAX_LEN);
+    cksum_use(CKSUM_REF); want = cksum(buf, CB_MAX_LEN);
+    cksum_use(impl);      bad += cksum(buf, CB_MAX_LEN) != want;
+
+    return bad;
+} /* -- cb_verify -- */
+
+static double cb_time(int impl, uint8_t* buf, int len)
+{
+    long i, n = CB_BYTES / len;
+    volatile uint16_t sink = 0;
+    uint64_t start;
+
+    cksum_use(impl);
+    start = cb_now_ns();
+    for (i = 0; i < n; i++)
+    { sink += cksum(buf, len); }
+    return (double)(cb_now_ns() - start) / n;
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t* buf = (uint8_t*)malloc(CB_BUF_LEN + 8);
+    double ns[CKSUM_IMPLS];
+    int impl, i, bad = 0;
+
+    srand(1);
+    for (i = 0; i < CB_BUF_LEN + 8; i++)
+    { buf[i] = rand(); }
+
+    for (impl = 0; impl < CKSUM_IMPLS; impl++)
+    {
+        if (!cksum_impl_supported(impl))
+        {
+            printf("%-5s not supported here\n", cksum_impl_name(impl));
+            continue;
+        }
+        i = cb_verify(impl, buf);
+        printf("%-5s %s\n", cksum_impl_name(impl), i ? "MISMATCH" : "matches ref");
+        bad += i;
+    }
+    for (i = 0; i < CB_BUF_LEN + 8; i++)
+    { buf[i] = rand(); }
+
+    printf("\n%6s", "bytes");
+    for (impl = 0; impl < CKSUM_IMPLS; impl++)
+    { printf(" %10s", cksum_impl_name(impl)); }
+    printf(" %10s   ns/call, best speedup\n", "auto");
+
+    for (i = 0; i < (int)(sizeof(cb_sizes) / sizeof(cb_sizes[0])); i++)
+    {
+        double best = 0;
+
+        printf("%6d", cb_sizes[i]);
+        for (impl = 0; impl < CKSUM_IMPLS; impl++)
+        {
+            if (!cksum_impl_supported(impl))
+            { printf(" %10s", "-"); continue; }
+            ns[impl] = cb_time(impl, buf, cb_sizes[i]);
+            printf(" %10.1f", ns[impl]);
+            if (impl > CKSUM_REF && (best == 0 || ns[impl] < best))
+            { best = ns[impl]; }
+        }
+        /* -- what cksum() does by default, for this length -- */
+        printf(" %10.1f", cb_time(-1, buf, cb_sizes[i]));
+        printf("   x%.1f\n", ns[CKSUM_REF] / best);
+    }
+
+    printf("\ncksum() uses %s below %d bytes, %s from there\n",
+           cksum_impl_name(CKSUM_WIDE), CKSUM_SIMD_MIN,
+           cksum_impl_name(cksum_use(-1)));
+    free(buf);
+    return bad != 0;
+}
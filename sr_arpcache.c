@@ -10,6 +10,10 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_conf.h"
+#include "sr_mem.h"
+#include "sr_flight.h"
+#include "sr_stats.h"
 
 /* 
   This function gets called every second. For each request sent out, we keep
@@ -23,7 +27,7 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr) {
 /* You should not need to touch the rest of this code. */
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
+   You must sr_mem_free() the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
     pthread_mutex_lock(&(cache->lock));
     
@@ -39,8 +43,9 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
     /* Must return a copy b/c another thread could jump in and modify
        table after we return. */
     if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+        copy = (struct sr_arpentry *) sr_mem_alloc(SR_MEM_ARP, sizeof(struct sr_arpentry));
+        if (copy)
+            memcpy(copy, entry, sizeof(struct sr_arpentry));
     }
         
     pthread_mutex_unlock(&(cache->lock));
@@ -50,10 +55,11 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. You should free the passed *packet.
+   that corresponds to this ARP request. The passed *packet is copied.
    
    A pointer to the ARP request is returned; it should not be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   Out of memory, NULL is returned or the packet is dropped. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
@@ -71,23 +77,57 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     
     /* If the IP wasn't found, add it */
     if (!req) {
-        req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
+        req = (struct sr_arpreq *) sr_mem_calloc(SR_MEM_ARP, sizeof(struct sr_arpreq));
+        if (!req) {
+            pthread_mutex_unlock(&(cache->lock));
+            return NULL;
+        }
         req->ip = ip;
         req->next = cache->requests;
         cache->requests = req;
+        __atomic_store_n(&cache->pending_reqs, cache->pending_reqs + 1,
+                         __ATOMIC_RELAXED);
     }
     
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
+    /* Add the packet to the list of packets for this request, unless the
+       next hop has been silent for long enough to fill its queue */
+    if (packet && packet_len && iface && cache->queue_max &&
+        req->npackets >= cache->queue_max) {
+        cache->overflows++;
+        sr_stats_drop(SR_DROP_ARP_QUEUE);
+        sr_flight_trigger("arp");
+    }
+    else if (packet && packet_len && iface) {
+        struct sr_packet *new_pkt = (struct sr_packet *)sr_mem_alloc(SR_MEM_ARP, sizeof(struct sr_packet));
+        uint8_t *buf = (uint8_t *)sr_mem_alloc(SR_MEM_ARP, packet_len);
+        char *name = (char *)sr_mem_alloc(SR_MEM_ARP, sr_IFACE_NAMELEN);
+
+        if (!new_pkt || !buf || !name) {
+            sr_mem_free(new_pkt);
+            sr_mem_free(buf);
+            sr_mem_free(name);
+            sr_stats_drop(SR_DROP_ARP_QUEUE);
+            pthread_mutex_unlock(&(cache->lock));
+            return req;
+        }
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
+        new_pkt->buf = buf;
         memcpy(new_pkt->buf, packet, packet_len);
         new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
+		new_pkt->iface = name;
         strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+        new_pkt->rx_ns = sr_stats_rx_ns;
+        new_pkt->queued_ns = sr_stats_latency ? sr_hist_now() : 0;
+        /* Append, so the packets leave in the order they arrived */
+        new_pkt->next = NULL;
+        if (req->packets)
+            req->last->next = new_pkt;
+        else
+            req->packets = new_pkt;
+        req->last = new_pkt;
+        req->npackets++;
+        __atomic_store_n(&cache->pending_pkts, cache->pending_pkts + 1,
+                         __ATOMIC_RELAXED);
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -95,6 +135,17 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     return req;
 }
 
+/* Counts req, which was just taken off the queue, out of the pending
+   gauges. Called with the lock held. */
+static void sr_arpcache_unqueued(struct sr_arpcache *cache,
+                                 struct sr_arpreq *req)
+{
+    __atomic_store_n(&cache->pending_reqs, cache->pending_reqs - 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->pending_pkts, cache->pending_pkts - req->npackets,
+                     __ATOMIC_RELAXED);
+}
+
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
@@ -116,6 +167,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                 next = req->next;
                 cache->requests = next;
             }
+            sr_arpcache_unqueued(cache, req);
             
             break;
         }
@@ -133,6 +185,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         cache->entries[i].ip = ip;
         cache->entries[i].added = time(NULL);
         cache->entries[i].valid = 1;
+        __atomic_store_n(&cache->gen, cache->gen + 1, __ATOMIC_RELEASE);
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -157,6 +210,7 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
                     next = req->next;
                     cache->requests = next;
                 }
+                sr_arpcache_unqueued(cache, req);
                 
                 break;
             }
@@ -167,14 +221,12 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
         
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+            sr_mem_free(pkt->buf);
+            sr_mem_free(pkt->iface);
+            sr_mem_free(pkt);
         }
         
-        free(entry);
+        sr_mem_free(entry);
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -203,6 +255,11 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     /* Invalidate all entries */
     memset(cache->entries, 0, sizeof(cache->entries));
     cache->requests = NULL;
+    cache->gen = 0;
+    cache->queue_max = sr_conf_int("arp_queue", SR_ARPREQ_QUEUE);
+    cache->overflows = 0;
+    cache->pending_reqs = 0;
+    cache->pending_pkts = 0;
     
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
@@ -212,6 +269,14 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     return success;
 }
 
+/* Drops every queued request and its packets, for shutdown. */
+void sr_arpcache_flush(struct sr_arpcache *cache) {
+    pthread_mutex_lock(&(cache->lock));
+    while (cache->requests)
+        sr_arpreq_destroy(cache, cache->requests);
+    pthread_mutex_unlock(&(cache->lock));
+}
+
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
@@ -221,27 +286,37 @@ int sr_arpcache_destroy(struct sr_arpcache *cache) {
    more than SR_ARPCACHE_TO seconds ago. */
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
-    struct sr_arpcache *cache = &(sr->cache);
     
+    sr_conf_pin("cpu_arp", -1);
+
     while (1) {
         sleep(1.0);
-        
-        pthread_mutex_lock(&(cache->lock));
+        sr_arpcache_tick(sr);
+    }
     
-        time_t curtime = time(NULL);
-        
-        int i;    
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
-        }
-        
-        sr_arpcache_sweepreqs(sr);
+    return NULL;
+}
 
-        pthread_mutex_unlock(&(cache->lock));
+/* One pass of the timeout thread: invalidate stale entries and sweep the
+   request queue. Called every second, either by sr_arpcache_timeout or by
+   a timer thread serving several instances. */
+void sr_arpcache_tick(struct sr_instance *sr) {
+    struct sr_arpcache *cache = &(sr->cache);
+    
+    pthread_mutex_lock(&(cache->lock));
+    
+    time_t curtime = time(NULL);
+    
+    int i;    
+    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+        if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
+            cache->entries[i].valid = 0;
+            __atomic_store_n(&cache->gen, cache->gen + 1, __ATOMIC_RELEASE);
+        }
     }
     
-    return NULL;
+    sr_arpcache_sweepreqs(sr);
+
+    pthread_mutex_unlock(&(cache->lock));
 }
 
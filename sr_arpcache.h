@@ -73,11 +73,14 @@
 
 #define SR_ARPCACHE_SZ    100  
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPREQ_QUEUE 0       /* default -o arp_queue, 0 = no limit */
 
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
     char *iface;                /* The outgoing interface */
+    uint64_t rx_ns;             /* when it was read, 0 if unknown */
+    uint64_t queued_ns;         /* when it was queued (sr_hist_now) */
     struct sr_packet *next;
 };
 
@@ -96,6 +99,8 @@ struct sr_arpreq {
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    struct sr_packet *last;     /* Tail of packets, for appending */
+    unsigned int npackets;      /* Length of packets */
     struct sr_arpreq *next;
 };
 
@@ -104,19 +109,25 @@ struct sr_arpcache {
     struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
+    unsigned int gen;           /* bumped whenever an entry changes */
+    unsigned int queue_max;     /* packets queued per request, -o arp_queue */
+    unsigned long overflows;    /* packets refused because a queue was full */
+    unsigned int pending_reqs;  /* requests queued, for the metrics */
+    unsigned long pending_pkts; /* packets queued on them */
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
-   You must free the returned structure if it is not NULL. */
+   You must sr_mem_free() the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
+   that corresponds to this ARP request. The packet is copied; the caller
+   keeps its own buffer.
 
-   A pointer to the ARP request is returned; it should be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   A pointer to the ARP request is returned; it belongs to the queue and
+   should not be freed. The caller can remove the ARP request from the
+   queue, with its packets, by calling sr_arpreq_destroy. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
@@ -135,6 +146,9 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
+/* Drops every queued request and its packets, for shutdown. */
+void sr_arpcache_flush(struct sr_arpcache *cache);
+
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
@@ -147,4 +161,9 @@ int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 
+/* One pass of the cleanup thread, for a timer thread shared by several
+   instances (see sr_multi.c). */
+struct sr_instance;
+void  sr_arpcache_tick(struct sr_instance *sr);
+
 #endif
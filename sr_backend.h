@@ -0,0 +1,71 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_backend.h
+ *
+ * Description:
+ *
+ * Data path backends.  By default every frame is tunnelled over the VNS
+ * session socket.  A backend replaces that with another way of moving
+ * frames in and out of the router's interfaces: once sr->backend is set,
+ * sr_send_packet() transmits through it and sr_read_from_server() polls
+ * it instead of reading the socket.  Received frames are handed back to
+ * the router through sr_receive_packet().
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BACKEND_H
+#define SR_BACKEND_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct pollfd;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_backend
+ *
+ * Operations and private state of the active data path backend
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_backend
+{
+    const char* name;
+
+    /* transmit one frame (ethernet header included) out of iface,
+       returns 0 on success */
+    int  (*send)(struct sr_instance*, uint8_t* buf, unsigned int len,
+                 const char* iface);
+
+    /* wait for received frames and pass them to sr_receive_packet(),
+       returns 1 to keep going, 0 when done and -1 on error, just like
+       sr_read_from_server() */
+    int  (*poll)(struct sr_instance*);
+
+    /* fill in up to max descriptors that become readable when poll has
+       work, so that one thread can wait on many instances (see
+       sr_multi.c); 0 when the backend cannot share a thread */
+    int  (*pollfds)(struct sr_instance*, struct pollfd* pfds, int max);
+
+    /* release the backend, including this structure */
+    void (*close)(struct sr_instance*);
+
+    void* priv;
+};
+
+/* -- sr_raw.c -- */
+int sr_raw_open(struct sr_instance* sr, int use_tap);
+
+/* -- sr_replay.c -- */
+int sr_replay_open(struct sr_instance* sr, const char* pcap, const char* map,
+                   const char* out, double speed);
+
+/* -- sr_shm.c -- */
+int sr_shm_open(struct sr_instance* sr, const char* path, int busy_poll);
+
+#endif /* -- SR_BACKEND_H -- */
@@ -0,0 +1,968 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Asynchronous pcap and pcapng capture, see sr_capture.h.
+ *
+ * The ring is a bounded multi-producer queue of fixed size slots, each
+ * big enough for a pcap record header and snaplen bytes.  A slot's seq
+ * says whose turn it is: pos when it is free for the producer claiming
+ * position pos, pos + 1 once that producer has filled it, and pos + size
+ * after the writer emptied it for the next lap.  Producers only claim
+ * with a CAS on head; the writer is the only one to move the tail.
+ *
+ * The writer sleeps up to SR_CAPTURE_FLUSH_MS at a time; producers only
+ * wake it early when the ring is half full, so a steady stream of frames
+ * costs them no system calls at all.
+ *
+ * Each filter alternative is a rule of (value, mask) pairs over the
+ * ethertype, IP protocol and addresses plus an interface name and a
+ * direction set; a frame is taken by the first rule all of whose fields
+ * match.  Sampling counts and draws per thread, without shared writes.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_capture.h"
+#include "sr_dumper.h"
+#include "sr_ring.h"
+#include "sr_conf.h"
+#include "sr_protocol.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_log.h"
+#include "sr_hist.h"
+
+#define SR_CAPTURE_IOBUF    (256 * 1024)   /* bytes per write(2) */
+#define SR_CAPTURE_SEGMENT  (4 << 20)      /* most bytes mapped at a time */
+#define SR_CAPTURE_FLUSH_MS 100
+#define SR_CAPTURE_NAMELEN  1024
+#define SR_CAPTURE_IFS      64             /* pcapng interfaces per file */
+
+enum sr_capture_format
+{
+    SR_CAPTURE_PCAP,
+    SR_CAPTURE_PCAPNG
+};
+
+struct sr_capture_slot
+{
+    unsigned int seq;
+    uint32_t caplen;
+    uint32_t len;
+    int dir;                       /* enum sr_capture_dir */
+    uint64_t ts;                   /* ns since the epoch */
+    char iface[sr_IFACE_NAMELEN];
+};
+
+#define SR_CAPTURE_DATA(s) ((uint8_t*)((s) + 1))
+
+struct sr_capture_rule
+{
+    uint16_t ether_type;           /* network order, 0 = any */
+    uint8_t proto, proto_mask;
+    uint32_t src, src_mask;        /* network order, mask 0 = any */
+    uint32_t dst, dst_mask;
+    uint32_t host, host_mask;      /* either address */
+    int dirs;                      /* SR_CAPTURE_IN | SR_CAPTURE_OUT */
+    char iface[sr_IFACE_NAMELEN];  /* "" = any */
+};
+
+struct sr_capture
+{
+    /* -- producers -- */
+    unsigned int head __attribute__ ((aligned(SR_RING_CACHELINE)));
+    unsigned long captured;
+    unsigned long drops;           /* frames left out, the ring was full */
+
+    /* -- writer -- */
+    unsigned int tail __attribute__ ((aligned(SR_RING_CACHELINE)));
+    unsigned long written;         /* bytes, in all files */
+    unsigned long files;           /* files started */
+    int fd;                        /* current file, -1 after an error */
+    int mapped;                    /* written through map, else iobuf */
+    uint8_t* map;                  /* seg bytes of the file at map_off */
+    off_t map_off;
+    off_t used;                    /* bytes in the current file */
+    off_t hdr_len;                 /* of which the file header */
+    time_t opened;
+    int nifs;                      /* pcapng interfaces described so far */
+    char ifs[SR_CAPTURE_IFS][sr_IFACE_NAMELEN];
+    unsigned int fill;             /* bytes in iobuf */
+    uint8_t* iobuf;
+
+    /* -- fixed -- */
+    unsigned int size __attribute__ ((aligned(SR_RING_CACHELINE)));
+    unsigned int slot_size;
+    unsigned int snaplen;
+    int nrules;                    /* 0 = capture everything */
+    struct sr_capture_rule rules[SR_CAPTURE_RULES];
+    unsigned int every;            /* 1 in every frames, 0 = all */
+    uint32_t prob;                 /* P * 2^32, 0 = all */
+    uint8_t* slots;
+    char* fname;
+    off_t max_size;                /* bytes per file, 0 = no limit */
+    long max_secs;                 /* seconds per file, 0 = no limit */
+    unsigned long keep;            /* files kept, 0 = all */
+    long page;
+    size_t seg;                    /* bytes mapped at a time */
+    enum sr_capture_format format;
+    uint64_t mono_off;             /* epoch ns - CLOCK_MONOTONIC ns */
+    struct sr_ring_bell bell;
+    pthread_t thread;
+    int stop;
+};
+
+/* -- per thread sampling state -- */
+static __thread unsigned int sr_capture_tick = 0;
+static __thread uint32_t sr_capture_rand = 0;
+
+/* -- the real stdout once sr_capture_stdout() took it, until -l - opens -- */
+static int sr_capture_stdout_fd = -1;
+
+static __inline__ struct sr_capture_slot* sr_capture_slot(
+    struct sr_capture* cap, unsigned int pos)
+{
+    return (struct sr_capture_slot*)
+        (cap->slots + (size_t)(pos & (cap->size - 1)) * cap->slot_size);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_match(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_match(struct sr_capture* cap, const uint8_t* buf,
+                            unsigned int len, const char* iface, int dir)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)buf;
+    const sr_ip_hdr_t* ip = 0;
+    int i;
+
+    if (len < sizeof(sr_ethernet_hdr_t))
+    { return 0; }
+    if (eth->ether_type == htons(ethertype_ip) &&
+        len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    { ip = (const sr_ip_hdr_t*)(eth + 1); }
+
+    for (i = 0; i < cap->nrules; i++)
+    {
+        const struct sr_capture_rule* r = &cap->rules[i];
+
+        if (!(r->dirs & dir))
+        { continue; }
+        if (r->ether_type && r->ether_type != eth->ether_type)
+        { continue; }
+        if (r->proto_mask | r->src_mask | r->dst_mask | r->host_mask)
+        {
+            /* -- IP fields asked for: has to be (long enough) IP -- */
+            if (!ip ||
+                ((ip->ip_p ^ r->proto) & r->proto_mask) ||
+                ((ip->ip_src ^ r->src) & r->src_mask) ||
+                ((ip->ip_dst ^ r->dst) & r->dst_mask) ||
+                (((ip->ip_src ^ r->host) & r->host_mask) &&
+                 ((ip->ip_dst ^ r->host) & r->host_mask)))
+            { continue; }
+        }
+        if (r->iface[0] && strncmp(r->iface, iface, sr_IFACE_NAMELEN) != 0)
+        { continue; }
+        return 1;
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_sample(..)
+ * Scope: Local
+ *
+ * 1 if this thread is to keep the frame: every every-th one and/or with
+ * probability prob, drawn from a per thread xorshift generator.
+ *
+ *---------------------------------------------------------------------*/
+
+static __inline__ int sr_capture_sample(struct sr_capture* cap)
+{
+    if (cap->every && ++sr_capture_tick % cap->every != 0)
+    { return 0; }
+
+    if (cap->prob)
+    {
+        uint32_t x = sr_capture_rand;
+
+        if (!x)
+        { x = (uint32_t)(unsigned long)&sr_capture_rand ^ (uint32_t)time(0) ^ 1; }
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sr_capture_rand = x;
+        if (x >= cap->prob)
+        { return 0; }
+    }
+    return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, const char* iface,
+                       enum sr_capture_dir dir)
+{
+    struct sr_capture_slot* s;
+    unsigned int pos;
+    int diff;
+
+    if (cap->nrules && !sr_capture_match(cap, buf, len, iface, dir))
+    { return; }
+    if ((cap->every || cap->prob) && !sr_capture_sample(cap))
+    { return; }
+
+    pos = __atomic_load_n(&cap->head, __ATOMIC_RELAXED);
+
+    while (1)
+    {
+        s = sr_capture_slot(cap, pos);
+        diff = (int)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0)
+        {
+            /* -- a failed CAS reloads pos -- */
+            if (__atomic_compare_exchange_n(&cap->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if (diff < 0)
+        {
+            /* -- the writer has not emptied this slot yet: full -- */
+            __atomic_add_fetch(&cap->drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        { pos = __atomic_load_n(&cap->head, __ATOMIC_RELAXED); }
+    }
+
+    /* -- monotonic is the cheap one; the offset makes it wall time -- */
+    s->ts = sr_hist_now() + cap->mono_off;
+    s->caplen = len < cap->snaplen ? len : cap->snaplen;
+    s->len = len;
+    s->dir = dir;
+    strncpy(s->iface, iface ? iface : "", sr_IFACE_NAMELEN);
+    memcpy(SR_CAPTURE_DATA(s), buf, s->caplen);
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&cap->captured, 1, __ATOMIC_RELAXED);
+
+    if (pos + 1 - __atomic_load_n(&cap->tail, __ATOMIC_RELAXED) >=
+        cap->size / 2)
+    { sr_ring_bell_notify(&cap->bell); }
+} /* -- sr_capture_packet -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_flush(..) / sr_capture_map(..) / sr_capture_put(..)
+ * Scope: Local
+ *
+ * Append to the current file.  A regular file is written through a
+ * mapped window of seg bytes that is moved (and the file grown) when it
+ * fills up; anything else, stdout for one, batches into iobuf
+ * and gets it in one write(2) when it fills up or traffic pauses.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_capture_flush(struct sr_capture* cap)
+{
+    unsigned int off = 0;
+    ssize_t ret;
+
+    while (off < cap->fill)
+    {
+        ret = write(cap->fd, cap->iobuf + off, cap->fill - off);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            sr_log_err(SR_LOG_CAP, "writing the capture: %s", strerror(errno));
+            break;
+        }
+        off += ret;
+    }
+    cap->fill = 0;
+}
+
+static void sr_capture_map(struct sr_capture* cap)
+{
+    off_t off = cap->used & ~(off_t)(cap->page - 1);
+
+    if (cap->map)
+    { munmap(cap->map, cap->seg); }
+
+    cap->map = 0;
+    if (ftruncate(cap->fd, off + cap->seg) == 0)
+    {
+        cap->map = (uint8_t*)mmap(0, cap->seg, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, cap->fd, off);
+        if (cap->map == MAP_FAILED)
+        { cap->map = 0; }
+    }
+
+    if (!cap->map)
+    {
+        /* -- carry on with write(2) from where we are -- */
+        perror("mmap(..):sr_capture.c::sr_capture_map");
+        if (ftruncate(cap->fd, cap->used) != 0 ||
+            lseek(cap->fd, cap->used, SEEK_SET) < 0)
+        { perror("ftruncate(..):sr_capture.c::sr_capture_map"); }
+        cap->mapped = 0;
+        return;
+    }
+    cap->map_off = off;
+}
+
+static void sr_capture_put(struct sr_capture* cap, const void* p,
+                           unsigned int n)
+{
+    if (cap->fd < 0)
+    { return; }
+
+    if (cap->mapped)
+    {
+        if (!cap->map || cap->used + n > cap->map_off + cap->seg)
+        { sr_capture_map(cap); }
+        if (cap->map)
+        {
+            memcpy(cap->map + (cap->used - cap->map_off), p, n);
+            cap->used += n;
+            cap->written += n;
+            return;
+        }
+    }
+
+    if (cap->fill + n > SR_CAPTURE_IOBUF)
+    { sr_capture_flush(cap); }
+    memcpy(cap->iobuf + cap->fill, p, n);
+    cap->fill += n;
+    cap->used += n;
+    cap->written += n;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_file_open(..) / sr_capture_file_close(..)
+ * Scope: Local
+ *
+ * Start the next file with its pcap header, removing the oldest one if
+ * -o log_files is exceeded; finish the current one by cutting it down
+ * to what was written, so it ends with the last complete record.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_capture_file_name(struct sr_capture* cap, unsigned long n,
+                                 char* buf, size_t len)
+{
+    if (cap->max_size || cap->max_secs)
+    { snprintf(buf, len, "%s.%lu", cap->fname, n); }
+    else
+    { snprintf(buf, len, "%s", cap->fname); }
+}
+
+static int sr_capture_file_open(struct sr_capture* cap)
+{
+    struct pcap_file_header hdr;
+    struct pcapng_shb shb;
+    uint32_t shb_len = sizeof(shb) + sizeof(uint32_t);
+    struct stat st;
+    char name[SR_CAPTURE_NAMELEN];
+
+    sr_capture_file_name(cap, cap->files, name, sizeof(name));
+
+    cap->used = 0;
+    cap->opened = time(0);
+    cap->mapped = 0;
+    if (strcmp(cap->fname, "-") == 0)
+    {
+        /* -- one capture owns it; it is closed with the capture -- */
+        if ((cap->fd = sr_capture_stdout_fd) < 0)
+        {
+            fprintf(stderr, "sr_capture: stdout is not free for -l -\n");
+            return -1;
+        }
+        sr_capture_stdout_fd = -1;
+    }
+    else if ((cap->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        fprintf(stderr, "sr_capture: can't open %s: %s\n", name,
+                strerror(errno));
+        return -1;
+    }
+    else if (fstat(cap->fd, &st) == 0 && S_ISREG(st.st_mode))
+    { cap->mapped = 1; }
+
+    if (cap->keep && cap->files >= cap->keep)
+    {
+        char old[SR_CAPTURE_NAMELEN];
+
+        sr_capture_file_name(cap, cap->files - cap->keep, old, sizeof(old));
+        unlink(old);
+    }
+    cap->files++;
+
+    if (cap->format == SR_CAPTURE_PCAPNG)
+    {
+        /* -- interfaces are described again as they show up -- */
+        cap->nifs = 0;
+        shb.type = PCAPNG_SHB_TYPE;
+        shb.len = shb_len;
+        shb.byte_order = PCAPNG_BYTE_ORDER;
+        shb.version_major = 1;
+        shb.version_minor = 0;
+        shb.section_len[0] = shb.section_len[1] = 0xffffffff;
+        sr_capture_put(cap, &shb, sizeof(shb));
+        sr_capture_put(cap, &shb_len, sizeof(shb_len));
+    }
+    else
+    {
+        hdr.magic = TCPDUMP_MAGIC;
+        hdr.version_major = PCAP_VERSION_MAJOR;
+        hdr.version_minor = PCAP_VERSION_MINOR;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.snaplen = cap->snaplen;
+        hdr.linktype = LINKTYPE_ETHERNET;
+        sr_capture_put(cap, &hdr, sizeof(hdr));
+    }
+    cap->hdr_len = cap->used;
+    return 0;
+}
+
+static void sr_capture_file_close(struct sr_capture* cap)
+{
+    if (cap->fd < 0)
+    { return; }
+
+    if (cap->map)
+    {
+        munmap(cap->map, cap->seg);
+        cap->map = 0;
+    }
+    if (cap->mapped && ftruncate(cap->fd, cap->used) != 0)
+    { perror("ftruncate(..):sr_capture.c::sr_capture_file_close"); }
+    sr_capture_flush(cap);
+
+    close(cap->fd);
+    cap->fd = -1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_if_id(..)
+ * Scope: Local
+ *
+ * pcapng interface id of the interface called name, describing it in
+ * an IDB first if this file has not seen it yet.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_capture_if_id(struct sr_capture* cap, const char* name)
+{
+    static const uint8_t zero[4] = { 0, 0, 0, 0 };
+    struct pcapng_idb idb;
+    struct pcapng_opt opt;
+    uint8_t tsresol[4] = { 9, 0, 0, 0 };
+    uint32_t name_len = strnlen(name, sr_IFACE_NAMELEN);
+    int i;
+
+    for (i = 0; i < cap->nifs; i++)
+    {
+        if (strncmp(cap->ifs[i], name, sr_IFACE_NAMELEN) == 0)
+        { return i; }
+    }
+    if (cap->nifs == SR_CAPTURE_IFS)
+    { return 0; }   /* -- more than we keep track of: lumped with the first -- */
+
+    strncpy(cap->ifs[cap->nifs], name, sr_IFACE_NAMELEN);
+
+    idb.type = PCAPNG_IDB_TYPE;
+    idb.len = sizeof(idb) + sizeof(opt) + PCAPNG_PAD(name_len) +
+              sizeof(opt) + sizeof(tsresol) + sizeof(opt) + sizeof(uint32_t);
+    idb.linktype = LINKTYPE_ETHERNET;
+    idb.reserved = 0;
+    idb.snaplen = cap->snaplen;
+    sr_capture_put(cap, &idb, sizeof(idb));
+
+    opt.code = PCAPNG_IF_NAME;
+    opt.len = name_len;
+    sr_capture_put(cap, &opt, sizeof(opt));
+    sr_capture_put(cap, name, name_len);
+    sr_capture_put(cap, zero, PCAPNG_PAD(name_len) - name_len);
+
+    opt.code = PCAPNG_IF_TSRESOL;
+    opt.len = 1;
+    sr_capture_put(cap, &opt, sizeof(opt));
+    sr_capture_put(cap, tsresol, sizeof(tsresol));
+
+    opt.code = PCAPNG_OPT_END;
+    opt.len = 0;
+    sr_capture_put(cap, &opt, sizeof(opt));
+    sr_capture_put(cap, &idb.len, sizeof(idb.len));
+
+    return cap->nifs++;
+}
+
+static void sr_capture_write_pcapng(struct sr_capture* cap,
+                                    struct sr_capture_slot* s)
+{
+    static const uint8_t zero[4] = { 0, 0, 0, 0 };
+    struct pcapng_epb epb;
+    struct
+    {
+        struct pcapng_opt flags;
+        uint32_t dir;
+        struct pcapng_opt end;
+        uint32_t len;
+    } tail;
+
+    epb.type = PCAPNG_EPB_TYPE;
+    epb.len = sizeof(epb) + PCAPNG_PAD(s->caplen) + sizeof(tail);
+    epb.if_id = sr_capture_if_id(cap, s->iface);
+    epb.ts_high = (uint32_t)(s->ts >> 32);
+    epb.ts_low = (uint32_t)s->ts;
+    epb.caplen = s->caplen;
+    epb.len_orig = s->len;
+
+    /* -- epb_flags direction: 1 inbound, 2 outbound, as sr_capture_dir -- */
+    tail.flags.code = PCAPNG_EPB_FLAGS;
+    tail.flags.len = sizeof(tail.dir);
+    tail.dir = s->dir & 3;
+    tail.end.code = PCAPNG_OPT_END;
+    tail.end.len = 0;
+    tail.len = epb.len;
+
+    sr_capture_put(cap, &epb, sizeof(epb));
+    sr_capture_put(cap, SR_CAPTURE_DATA(s), s->caplen);
+    sr_capture_put(cap, zero, PCAPNG_PAD(s->caplen) - s->caplen);
+    sr_capture_put(cap, &tail, sizeof(tail));
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_write(..)
+ * Scope: Local
+ *
+ * Append the record in slot s, moving on to a new file first if this
+ * one is full (-o log_size) or old enough (-o log_secs).
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_capture_rotate(struct sr_capture* cap)
+{
+    sr_capture_file_close(cap);
+    if (sr_capture_file_open(cap) != 0)
+    { cap->fd = -1; } /* -- and capture no more -- */
+}
+
+static void sr_capture_write(struct sr_capture* cap, struct sr_capture_slot* s)
+{
+    struct pcap_sf_pkthdr sf;
+    unsigned int n = cap->format == SR_CAPTURE_PCAPNG
+                     ? sizeof(struct pcapng_epb) + PCAPNG_PAD(s->caplen) +
+                       16 /* flags, end, length */
+                     : sizeof(sf) + s->caplen;
+
+    if ((cap->max_size && cap->used + n > cap->max_size &&
+         cap->used > cap->hdr_len) ||
+        (cap->max_secs &&
+         (time_t)(s->ts / 1000000000ULL) - cap->opened >= cap->max_secs))
+    { sr_capture_rotate(cap); }
+
+    if (cap->format == SR_CAPTURE_PCAPNG)
+    {
+        sr_capture_write_pcapng(cap, s);
+        return;
+    }
+
+    sf.ts.tv_sec = (int)(s->ts / 1000000000ULL);
+    sf.ts.tv_usec = (int)(s->ts % 1000000000ULL / 1000);
+    sf.caplen = s->caplen;
+    sf.len = s->len;
+    sr_capture_put(cap, &sf, sizeof(sf));
+    sr_capture_put(cap, SR_CAPTURE_DATA(s), s->caplen);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_half_full(..)
+ * Scope: Local
+ *
+ * The writer sleeps (sr_ring_bell_wait_for) until this holds, a
+ * producer finding the ring half full rings it, or the flush interval
+ * passes.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_half_full(void* arg)
+{
+    struct sr_capture* cap = arg;
+
+    return __atomic_load_n(&cap->head, __ATOMIC_RELAXED) - cap->tail >=
+           cap->size / 2;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_thread(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void* sr_capture_thread(void* arg)
+{
+    struct sr_capture* cap = arg;
+    struct sr_capture_slot* s;
+    unsigned int tail = cap->tail;
+
+    sr_conf_pin("cpu_log", -1);
+
+    while (1)
+    {
+        s = sr_capture_slot(cap, tail);
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == tail + 1)
+        {
+            sr_capture_write(cap, s);
+            __atomic_store_n(&s->seq, tail + cap->size, __ATOMIC_RELEASE);
+            __atomic_store_n(&cap->tail, ++tail, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /* -- caught up: get what we have to disk, then sleep -- */
+        if (cap->fill)
+        { sr_capture_flush(cap); }
+        if (cap->max_secs && cap->fd >= 0 &&
+            time(0) - cap->opened >= cap->max_secs &&
+            cap->used > cap->hdr_len)
+        { sr_capture_rotate(cap); }
+        if (__atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE))
+        { break; }
+        sr_ring_bell_wait_for(&cap->bell, sr_capture_half_full, cap,
+                              SR_CAPTURE_FLUSH_MS);
+    }
+
+    return 0;
+} /* -- sr_capture_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_prefix(..)
+ * Scope: Local
+ *
+ * Parse "a.b.c.d" or "a.b.c.d/len" into an address and mask, both in
+ * network byte order.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_prefix(const char* v, uint32_t* addr, uint32_t* mask)
+{
+    char buf[32];
+    char* slash;
+    struct in_addr a;
+    long len = 32;
+
+    strncpy(buf, v, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    if ((slash = strchr(buf, '/')))
+    {
+        char* end;
+
+        *slash = 0;
+        len = strtol(slash + 1, &end, 10);
+        if (*end || end == slash + 1 || len < 0 || len > 32)
+        { return -1; }
+    }
+    if (inet_aton(buf, &a) == 0)
+    { return -1; }
+
+    *mask = len ? htonl(0xffffffffUL << (32 - len)) : 0;
+    *addr = a.s_addr & *mask;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_term(..)
+ * Scope: Local
+ *
+ * Add one filter term, "name" or "name=value", to rule r.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_term(struct sr_capture_rule* r, char* term)
+{
+    char* v = strchr(term, '=');
+
+    if (v)
+    { *v++ = 0; }
+
+    if (!v && strcmp(term, "ip") == 0)
+    { r->ether_type = htons(ethertype_ip); }
+    else if (!v && strcmp(term, "arp") == 0)
+    { r->ether_type = htons(ethertype_arp); }
+    else if (v && strcmp(term, "ether") == 0)
+    { r->ether_type = htons((uint16_t)strtol(v, 0, 0)); }
+    else if (!v && (strcmp(term, "icmp") == 0 || strcmp(term, "tcp") == 0 ||
+                    strcmp(term, "udp") == 0))
+    {
+        r->ether_type = htons(ethertype_ip);
+        r->proto = term[0] == 'i' ? ip_protocol_icmp :
+                   term[0] == 't' ? ip_protocol_tcp : ip_protocol_udp;
+        r->proto_mask = 0xff;
+    }
+    else if (v && strcmp(term, "proto") == 0)
+    {
+        r->ether_type = htons(ethertype_ip);
+        r->proto = (uint8_t)strtol(v, 0, 0);
+        r->proto_mask = 0xff;
+    }
+    else if (v && (strcmp(term, "host") == 0 || strcmp(term, "net") == 0))
+    { return sr_capture_prefix(v, &r->host, &r->host_mask); }
+    else if (v && strcmp(term, "src") == 0)
+    { return sr_capture_prefix(v, &r->src, &r->src_mask); }
+    else if (v && strcmp(term, "dst") == 0)
+    { return sr_capture_prefix(v, &r->dst, &r->dst_mask); }
+    else if (v && strcmp(term, "if") == 0)
+    { strncpy(r->iface, v, sr_IFACE_NAMELEN - 1); }
+    else if (!v && strcmp(term, "in") == 0)
+    { r->dirs &= SR_CAPTURE_IN; }
+    else if (!v && strcmp(term, "out") == 0)
+    { r->dirs &= SR_CAPTURE_OUT; }
+    else
+    { return -1; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_compile(..)
+ * Scope: Local
+ *
+ * Compile -o log_filter into cap's rules.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_compile(struct sr_capture* cap, const char* expr)
+{
+    char buf[512];
+    char *alt, *term, *save_alt, *save_term;
+
+    strncpy(buf, expr, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    for (alt = strtok_r(buf, "|", &save_alt); alt;
+         alt = strtok_r(0, "|", &save_alt))
+    {
+        struct sr_capture_rule* r;
+
+        if (cap->nrules == SR_CAPTURE_RULES)
+        {
+            fprintf(stderr, "-o log_filter: more than %d alternatives\n",
+                    SR_CAPTURE_RULES);
+            return -1;
+        }
+        r = &cap->rules[cap->nrules++];
+        r->dirs = SR_CAPTURE_IN | SR_CAPTURE_OUT;
+
+        for (term = strtok_r(alt, ",", &save_term); term;
+             term = strtok_r(0, ",", &save_term))
+        {
+            if (sr_capture_term(r, term) != 0)
+            {
+                fprintf(stderr, "-o log_filter: bad term %s in %s\n", term,
+                        expr);
+                return -1;
+            }
+        }
+    }
+    return 0;
+} /* -- sr_capture_compile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_stdout(..)
+ * Scope: Global
+ *
+ * Keep stdout for the capture (-l -) and point file descriptor 1 at
+ * stderr, so that nothing sr prints (banners, dumps, statistics) ends
+ * up in the middle of the pcap stream.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_stdout(void)
+{
+    fflush(stdout);
+    if ((sr_capture_stdout_fd = dup(STDOUT_FILENO)) < 0 ||
+        dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+        perror("dup(..):sr_capture.c::sr_capture_stdout");
+        return -1;
+    }
+    setvbuf(stdout, 0, _IOLBF, 0);
+    return 0;
+} /* -- sr_capture_stdout -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope: Global
+ *
+ * Compile the filter, write the pcap file header and start the writer
+ * with a ring of -o log_ring frames (rounded up to a power of two) of up
+ * to -o log_snap bytes each.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_capture* sr_capture_open(const char* fname)
+{
+    struct sr_capture* cap;
+    long slots = sr_conf_int("log_ring", SR_CAPTURE_SLOTS);
+    long snaplen = sr_conf_int("log_snap", PACKET_DUMP_SIZE);
+    double prob = atof(sr_conf_str("log_prob", "1"));
+    const char* format = sr_conf_str("log_format", "pcap");
+    unsigned int n = 2, i;
+
+    while (n < slots)
+    { n <<= 1; }
+    if (snaplen < (long)sizeof(sr_ethernet_hdr_t) || snaplen > 65535)
+    {
+        fprintf(stderr, "-o log_snap: expected %d to 65535 bytes\n",
+                (int)sizeof(sr_ethernet_hdr_t));
+        return 0;
+    }
+
+    if (strcmp(format, "pcap") != 0 && strcmp(format, "pcapng") != 0)
+    {
+        fprintf(stderr, "-o log_format=%s: expected pcap or pcapng\n", format);
+        return 0;
+    }
+
+    /* -- stdout is one stream: no new files, nothing to remove -- */
+    if (strcmp(fname, "-") == 0 &&
+        (sr_conf_str("log_size", 0) || sr_conf_str("log_secs", 0) ||
+         sr_conf_str("log_files", 0)))
+    {
+        fprintf(stderr, "-l -: log_size, log_secs and log_files need a "
+                "file name\n");
+        return 0;
+    }
+
+    if (posix_memalign((void**)&cap, SR_RING_CACHELINE, sizeof(*cap)) != 0)
+    { return 0; }
+    memset(cap, 0, sizeof(*cap));
+    cap->format = strcmp(format, "pcapng") == 0 ? SR_CAPTURE_PCAPNG
+                                                : SR_CAPTURE_PCAP;
+    cap->mono_off = sr_hist_clock(CLOCK_REALTIME) - sr_hist_now();
+
+    if (sr_conf_str("log_filter", 0) &&
+        sr_capture_compile(cap, sr_conf_str("log_filter", 0)) != 0)
+    {
+        free(cap);
+        return 0;
+    }
+    if (sr_conf_int("log_every", 0) > 1)
+    { cap->every = sr_conf_int("log_every", 0); }
+    if (prob < 1.0)
+    { cap->prob = prob > 0.0 ? (uint32_t)(prob * 4294967296.0) : 1; }
+
+    cap->size = n;
+    cap->snaplen = snaplen;
+    cap->fname = strdup(fname);
+    cap->max_size = (off_t)sr_conf_int("log_size", 0) << 20;
+    cap->max_secs = sr_conf_int("log_secs", 0);
+    if (cap->max_size || cap->max_secs)
+    { cap->keep = sr_conf_int("log_files", 0); }
+    cap->page = sysconf(_SC_PAGESIZE);
+    cap->seg = SR_CAPTURE_SEGMENT;
+    if (cap->max_size && cap->max_size < cap->seg)
+    { cap->seg = (cap->max_size + cap->page - 1) & ~(cap->page - 1); }
+    cap->iobuf = (uint8_t*)malloc(SR_CAPTURE_IOBUF);
+    assert(cap->fname && cap->iobuf);
+
+    if (sr_capture_file_open(cap) != 0)
+    {
+        free(cap->iobuf);
+        free(cap->fname);
+        free(cap);
+        return 0;
+    }
+
+    cap->slot_size = (sizeof(struct sr_capture_slot) + snaplen +
+                      SR_RING_CACHELINE - 1) & ~(SR_RING_CACHELINE - 1);
+    if (posix_memalign((void**)&cap->slots, SR_RING_CACHELINE,
+                       (size_t)n * cap->slot_size) != 0)
+    {
+        sr_capture_file_close(cap);
+        free(cap->iobuf);
+        free(cap->fname);
+        free(cap);
+        return 0;
+    }
+    for (i = 0; i < n; i++)
+    { sr_capture_slot(cap, i)->seq = i; }
+
+    sr_ring_bell_init(&cap->bell);
+
+    if (pthread_create(&cap->thread, 0, sr_capture_thread, cap) != 0)
+    {
+        perror("pthread_create(..):sr_capture.c::sr_capture_open");
+        sr_ring_bell_destroy(&cap->bell);
+        sr_capture_file_close(cap);
+        free(cap->iobuf);
+        free(cap->slots);
+        free(cap->fname);
+        free(cap);
+        return 0;
+    }
+
+    printf("capture to %s (%s): ring %u, snap %u, %d filter alternatives, "
+           "1 in %u, p %g\n", fname, format, cap->size, cap->snaplen, cap->nrules,
+           cap->every ? cap->every : 1, cap->prob ? prob : 1.0);
+    if (cap->max_size || cap->max_secs)
+    {
+        printf("capture files %s.N: new one every %ld MB / %ld s, "
+               "keeping %lu (0 = all)\n", fname, (long)(cap->max_size >> 20),
+               cap->max_secs, cap->keep);
+    }
+    return cap;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope: Global
+ *
+ * Nothing may capture any more: stop the pipeline and the control
+ * thread first.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_capture* cap, FILE* fp)
+{
+    if (!cap)
+    { return; }
+
+    __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+    sr_ring_bell_ring(&cap->bell);
+    pthread_join(cap->thread, 0);
+
+    sr_capture_file_close(cap);
+    fprintf(fp, "capture: %lu frames, %lu dropped (ring of %u full), "
+            "%lu bytes in %lu files\n", cap->captured, cap->drops,
+            cap->size, cap->written, cap->files);
+
+    sr_ring_bell_destroy(&cap->bell);
+    free(cap->iobuf);
+    free(cap->slots);
+    free(cap->fname);
+    free(cap);
+} /* -- sr_capture_close -- */
@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Packet capture (-l) off the forwarding path.  Every frame the router
+ * receives or sends is copied, cut to the snap length, into a slot of a
+ * bounded lock-free ring; a writer thread drains the ring into the pcap
+ * file, which it writes through a memory mapping (see sr_capture.c).
+ *
+ * Any thread may capture (RX, pipeline workers and TX, the control and
+ * ARP threads), so slots are claimed with a compare-and-swap on the head
+ * and published through a per-slot sequence number.  When the ring is
+ * full the frame is left out of the capture and counted as a drop; the
+ * forwarding threads never wait for the disk.
+ *
+ * What is captured is set with -o log_*:
+ *
+ *   log_filter   alternatives separated by '|', each a ','-separated list
+ *                of terms that all have to match:
+ *                  ip, arp, ether=T          ethertype
+ *                  icmp, tcp, udp, proto=P   IP protocol (implies ip)
+ *                  host=A, net=A/L           source or destination
+ *                  src=A[/L], dst=A[/L]
+ *                  if=NAME                   interface
+ *                  in, out                   direction
+ *                e.g. "arp|icmp,net=10.0.1.0/24,in"
+ *   log_every    capture only every N-th frame that matches (per thread)
+ *   log_prob     capture a frame that matches with probability P
+ *   log_snap     bytes kept of each frame
+ *   log_size     start a new file after this many MB
+ *   log_secs     start a new file after this many seconds
+ *   log_files    keep only the newest N files
+ *   log_format   pcap (default) or pcapng
+ *
+ * pcapng files describe each router interface in an IDB, written just
+ * before its first frame, and record every frame's interface and rx/tx
+ * direction (epb_flags) with a nanosecond timestamp.  The stamps of
+ * both formats come from CLOCK_MONOTONIC, offset to wall time once when
+ * the capture is opened.
+ *
+ * With log_size or log_secs the files are named <file>.0, <file>.1 and
+ * so on.  Each one is cut down to its last complete record when the next
+ * is started, so a finished file is always a valid capture; the file
+ * being written may end in zeros up to the end of its mapping.  A
+ * capture to stdout (-l -) is a single stream and can't be rotated.
+ *
+ * The filter is compiled to a few masked compares per alternative, and
+ * frames it rejects are not copied.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define SR_CAPTURE_SLOTS 4096     /* default -o log_ring */
+#define SR_CAPTURE_RULES 8        /* alternatives in -o log_filter */
+
+enum sr_capture_dir
+{
+    SR_CAPTURE_IN = 1,
+    SR_CAPTURE_OUT = 2
+};
+
+struct sr_capture;
+
+/* before anything is printed when the capture is to go to stdout: keep
+   it for the capture and send sr's own output to stderr; -1 on error */
+int sr_capture_stdout(void);
+/* open fname ("-" for stdout, see sr_capture_stdout()) as set up by the
+   -o log_* keys and start its writer thread; 0 on error */
+struct sr_capture* sr_capture_open(const char* fname);
+/* drain what is queued, close the file and print the statistics to fp */
+void sr_capture_close(struct sr_capture* cap, FILE* fp);
+
+/* queue a copy of the frame if the filter and sampling take it, or
+   count a drop when the ring is full */
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, const char* iface,
+                       enum sr_capture_dir dir);
+
+#endif /* -- SR_CAPTURE_H -- */
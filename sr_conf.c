@@ -0,0 +1,222 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_conf.c
+ *
+ * Description:
+ *
+ * -o key=value settings, see sr_conf.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "sr_conf.h"
+
+#define SR_CONF_MAX_CPUS 256
+
+struct sr_conf_key
+{
+    const char* key;
+    const char* help;
+    const char* value;      /* 0 until set */
+};
+
+static struct sr_conf_key sr_conf_keys[] =
+{
+    { "pipeline", "worker threads of the forwarding pipeline, 0 = off", 0 },
+    { "rx_ring",  "slots in each RX -> worker ring (1024)", 0 },
+    { "tx_ring",  "slots in each worker -> TX ring (1024)", 0 },
+    { "punt",     "slots in the control plane punt ring, 0 = no punting", 0 },
+    { "punt_cpu", "percent of a CPU the control thread may use (20)", 0 },
+    { "busy_poll", "spin this many usecs for input before blocking (-b: 1000)", 0 },
+    { "cpu_rx",   "CPUs for the receive (main) thread, e.g. 2 or 2-3", 0 },
+    { "cpu_workers", "CPUs for worker threads, one each, in turn", 0 },
+    { "cpu_tx",   "CPUs for the pipeline TX thread", 0 },
+    { "cpu_control", "CPUs for the punt path control thread", 0 },
+    { "cpu_arp",  "CPUs for the ARP timer thread", 0 },
+    { "log_ring", "frames the -l capture ring holds for its writer (4096)", 0 },
+    { "log_snap", "bytes of each frame the -l capture keeps (1024)", 0 },
+    { "log_filter", "frames to capture, e.g. arp|icmp,net=10.0.1.0/24,in (see sr_capture.h)", 0 },
+    { "log_size", "start a new -l file (<file>.N) after this many MB, 0 = never", 0 },
+    { "log_secs", "start a new -l file (<file>.N) after this many seconds, 0 = never", 0 },
+    { "log_files", "keep only the newest N of those files, 0 = all", 0 },
+    { "log_format", "-l file format: pcap or pcapng (per interface, ns, direction)", 0 },
+    { "log_every", "capture every N-th frame the filter takes (1)", 0 },
+    { "log_prob", "capture a frame the filter takes with probability P (1)", 0 },
+    { "cpu_log",  "CPUs for the packet log writer thread", 0 },
+    { "icmp_rate", "ICMP errors per second in all, 0 = no limit (1000)", 0 },
+    { "icmp_burst", "ICMP errors sent back to back in all (100)", 0 },
+    { "icmp_src_rate", "ICMP errors per second to each source prefix, 0 = no limit (100)", 0 },
+    { "icmp_src_burst", "ICMP errors back to back to each source prefix (10)", 0 },
+    { "icmp_src_len", "length of the source prefixes limited together (24)", 0 },
+    { "icmp_src_slots", "source prefixes tracked at once (1024)", 0 },
+    { "reply_path", "ICMP replies: lookup, or check/sender to send back to the sender", 0 },
+    { "arp_queue", "frames queued per unresolved next hop (0 = no limit)", 0 },
+    { "flight", "frames each thread's flight recorder keeps, 0 = off", 0 },
+    { "flight_snap", "bytes of each frame the flight recorder keeps (128)", 0 },
+    { "flight_file", "flight recorder dumps go to <this>.<pid>.<n>.<why>.pcap (sr-flight)", 0 },
+    { "flight_spike", "dropped frames per second that trigger a dump, 0 = never (1000)", 0 },
+    { "msg_level", "messages shown: err, warn, info or debug, per category as e.g. fwd=debug (info)", 0 },
+    { "msg_rate", "messages per second from one place in the code, 0 = no limit (10)", 0 },
+    { "latency", "histograms: 1 forwarding and ARP wait, 2 also per stage, 0 off (1)", 0 },
+    { "metrics", "serve Prometheus metrics on [host:]port (127.0.0.1) or a socket path", 0 },
+    { "mem_check", "report accounted memory at exit, status 2 on leaks (0)", 0 },
+    { 0, 0, 0 }
+};
+
+static struct sr_conf_key* sr_conf_find(const char* key, size_t len)
+{
+    struct sr_conf_key* k;
+
+    for (k = sr_conf_keys; k->key; k++)
+    {
+        if (strlen(k->key) == len && strncmp(k->key, key, len) == 0)
+        { return k; }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_conf_set(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+int sr_conf_set(const char* kv)
+{
+    const char* eq = strchr(kv, '=');
+    struct sr_conf_key* k;
+
+    if (!eq)
+    {
+        fprintf(stderr, "-o %s: expected key=value\n", kv);
+        return -1;
+    }
+
+    if (!(k = sr_conf_find(kv, eq - kv)))
+    {
+        fprintf(stderr, "-o %s: unknown key, known keys are:\n", kv);
+        sr_conf_usage(stderr);
+        return -1;
+    }
+
+    k->value = eq + 1;
+    return 0;
+} /* -- sr_conf_set -- */
+
+const char* sr_conf_str(const char* key, const char* def)
+{
+    struct sr_conf_key* k = sr_conf_find(key, strlen(key));
+    return (k && k->value) ? k->value : def;
+}
+
+long sr_conf_int(const char* key, long def)
+{
+    const char* v = sr_conf_str(key, 0);
+    return v ? strtol(v, 0, 0) : def;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_conf_cpus(..)
+ * Scope: Global
+ *
+ * Parse key's CPU list ("3", "0,2", "4-7,9") into cpus.  Returns the
+ * number of CPUs, 0 if the key is not set, -1 if it does not parse.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_conf_cpus(const char* key, int* cpus, int max)
+{
+    const char* v = sr_conf_str(key, 0);
+    int n = 0;
+
+    if (!v)
+    { return 0; }
+
+    while (*v)
+    {
+        char* end;
+        long lo = strtol(v, &end, 10), hi = lo;
+
+        if (end == v || lo < 0)
+        { break; }
+        if (*end == '-')
+        {
+            v = end + 1;
+            hi = strtol(v, &end, 10);
+            if (end == v || hi < lo)
+            { break; }
+        }
+        for (; lo <= hi && n < max; lo++)
+        { cpus[n++] = (int)lo; }
+
+        v = end;
+        if (*v == ',')
+        { v++; }
+        else if (*v)
+        { break; }
+    }
+
+    if (*v || n == 0)
+    {
+        fprintf(stderr, "-o %s=%s: expected a CPU list like 2,4-6\n", key,
+                sr_conf_str(key, ""));
+        return -1;
+    }
+    return n;
+} /* -- sr_conf_cpus -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_conf_pin(..)
+ * Scope: Global
+ *
+ * Pin the calling thread to the CPUs of key, if set: to all of them when
+ * index is negative, else to the index-th (modulo the list length), so
+ * a pool of threads spreads over the list one per CPU.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_conf_pin(const char* key, int index)
+{
+    int cpus[SR_CONF_MAX_CPUS];
+    cpu_set_t set;
+    int n, i, err;
+
+    if ((n = sr_conf_cpus(key, cpus, SR_CONF_MAX_CPUS)) <= 0)
+    { return n; }
+
+    CPU_ZERO(&set);
+    if (index < 0)
+    {
+        for (i = 0; i < n; i++)
+        { CPU_SET(cpus[i], &set); }
+    }
+    else
+    { CPU_SET(cpus[index % n], &set); }
+
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+    {
+        fprintf(stderr, "%s: cannot pin thread to %s: %s\n", key,
+                sr_conf_str(key, ""), strerror(err));
+        return -1;
+    }
+
+    if (index < 0)
+    { printf("%s: thread pinned to cpu %s\n", key, sr_conf_str(key, "")); }
+    else
+    { printf("%s: thread %d pinned to cpu %d\n", key, index, cpus[index % n]); }
+    return 0;
+} /* -- sr_conf_pin -- */
+
+void sr_conf_usage(FILE* fp)
+{
+    struct sr_conf_key* k;
+
+    for (k = sr_conf_keys; k->key; k++)
+    {
+        fprintf(fp, "   %-14s %s%s%s\n", k->key, k->help,
+                k->value ? ", set to " : "", k->value ? k->value : "");
+    }
+}
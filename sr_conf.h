@@ -0,0 +1,36 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_conf.h
+ *
+ * Description:
+ *
+ * Process-wide tuning knobs, set on the command line as -o key=value.
+ * Every key has to be listed in the table in sr_conf.c, which is also
+ * where its meaning and default are documented.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CONF_H
+#define SR_CONF_H
+
+#include <stdio.h>
+
+/* parse "key=value"; returns -1 (after complaining) for unknown keys or
+   a missing '=' */
+int  sr_conf_set(const char* kv);
+
+/* value of key, or def if it was not set */
+const char* sr_conf_str(const char* key, const char* def);
+long sr_conf_int(const char* key, long def);
+
+/* parse key's CPU list ("2,4-6") into cpus; returns how many, 0 when
+   unset, -1 on a parse error */
+int  sr_conf_cpus(const char* key, int* cpus, int max);
+
+/* pin the calling thread to key's CPUs: all of them for index < 0, else
+   the index-th, wrapping around; 0 (also when unset) or -1 on error */
+int  sr_conf_pin(const char* key, int index);
+
+/* list the keys, their current values and help text */
+void sr_conf_usage(FILE* fp);
+
+#endif /* -- SR_CONF_H -- */
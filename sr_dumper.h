@@ -3,6 +3,9 @@
  * format as well as a set of operations for logging.
  */
 
+#ifndef SR_DUMPER_H
+#define SR_DUMPER_H
+
 
 #ifdef _LINUX_
 #include <stdint.h>
@@ -63,6 +66,56 @@ struct pcap_sf_pkthdr {
     uint32_t len;            /* length this packet (off wire) */
 };
 
+/*
+ * pcapng (draft-ietf-opsawg-pcapng), as written by sr_capture.c: one
+ * section header, an interface description per interface and an
+ * enhanced packet block per frame.  All blocks are padded to 4 bytes
+ * and end with a copy of their total length.
+ */
+#define PCAPNG_SHB_TYPE       0x0A0D0D0A
+#define PCAPNG_IDB_TYPE       0x00000001
+#define PCAPNG_EPB_TYPE       0x00000006
+#define PCAPNG_BYTE_ORDER     0x1A2B3C4D
+
+#define PCAPNG_OPT_END        0
+#define PCAPNG_IF_NAME        2   /* IDB: interface name */
+#define PCAPNG_IF_TSRESOL     9   /* IDB: timestamp units, 9 = ns */
+#define PCAPNG_EPB_FLAGS      2   /* EPB: bits 0-1 direction */
+
+#define PCAPNG_PAD(n) (((n) + 3) & ~3)
+
+struct pcapng_shb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t byte_order;
+    uint16_t version_major;   /* 1 */
+    uint16_t version_minor;   /* 0 */
+    uint32_t section_len[2];  /* all ones: not given */
+};
+
+struct pcapng_idb {
+    uint32_t type;
+    uint32_t len;
+    uint16_t linktype;
+    uint16_t reserved;
+    uint32_t snaplen;
+};
+
+struct pcapng_epb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t if_id;
+    uint32_t ts_high;         /* in the interface's if_tsresol units */
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t len_orig;
+};
+
+struct pcapng_opt {
+    uint16_t code;
+    uint16_t len;             /* without the padding */
+};
+
 /**
  * Open a dump file and initialize the file.
  */
@@ -77,3 +130,5 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+#endif /* -- SR_DUMPER_H -- */
@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fcache.c
+ *
+ * Description:
+ *
+ * Per-worker route and ARP caches, see sr_fcache.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "sr_fcache.h"
+#include "sr_router.h"
+#include "sr_arpcache.h"
+
+static __inline__ unsigned int sr_fcache_slot(uint32_t key, unsigned int size)
+{
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+    return key & (size - 1);
+}
+
+void sr_fcache_init(struct sr_fcache* fc)
+{
+    memset(fc, 0, sizeof(*fc));
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fcache_get_route(..)
+ * Scope: Global
+ *
+ * Look dst up in the worker's route cache, first dropping the cache if
+ * the routing table has been reloaded since it was filled.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fcache_get_route(struct sr_fcache* fc, struct sr_instance* sr,
+                        uint32_t dst, struct sr_rt** rt)
+{
+    unsigned int gen = __atomic_load_n(&sr->rt_gen, __ATOMIC_ACQUIRE);
+    struct sr_fcache_route* e;
+
+    if (gen != fc->rt_gen)
+    {
+        memset(fc->routes, 0, sizeof(fc->routes));
+        fc->rt_gen = gen;
+        fc->flushes++;
+    }
+
+    e = &fc->routes[sr_fcache_slot(dst, SR_FCACHE_ROUTES)];
+    if (e->valid && e->dst == dst)
+    {
+        fc->rt_hits++;
+        *rt = e->rt;
+        return 1;
+    }
+
+    fc->rt_misses++;
+    return 0;
+} /* -- sr_fcache_get_route -- */
+
+void sr_fcache_put_route(struct sr_fcache* fc, uint32_t dst, struct sr_rt* rt)
+{
+    struct sr_fcache_route* e = &fc->routes[sr_fcache_slot(dst, SR_FCACHE_ROUTES)];
+
+    e->dst = dst;
+    e->rt = rt;
+    e->valid = 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fcache_get_arp(..)
+ * Scope: Global
+ *
+ * Same for the ARP cache.  Entries keep the time the shared entry was
+ * added, so they expire together with it even between generations.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fcache_get_arp(struct sr_fcache* fc, struct sr_instance* sr,
+                      uint32_t ip, unsigned char* mac)
+{
+    unsigned int gen = __atomic_load_n(&sr->cache.gen, __ATOMIC_ACQUIRE);
+    struct sr_fcache_arp* e;
+
+    if (gen != fc->arp_gen)
+    {
+        memset(fc->arps, 0, sizeof(fc->arps));
+        fc->arp_gen = gen;
+        fc->flushes++;
+    }
+
+    e = &fc->arps[sr_fcache_slot(ip, SR_FCACHE_ARPS)];
+    if (e->valid && e->ip == ip &&
+        difftime(time(NULL), e->added) <= SR_ARPCACHE_TO)
+    {
+        fc->arp_hits++;
+        memcpy(mac, e->mac, 6);
+        return 1;
+    }
+
+    fc->arp_misses++;
+    return 0;
+} /* -- sr_fcache_get_arp -- */
+
+void sr_fcache_put_arp(struct sr_fcache* fc, struct sr_arpentry* entry)
+{
+    struct sr_fcache_arp* e = &fc->arps[sr_fcache_slot(entry->ip, SR_FCACHE_ARPS)];
+
+    e->ip = entry->ip;
+    memcpy(e->mac, entry->mac, 6);
+    e->added = entry->added;
+    e->valid = 1;
+}
@@ -0,0 +1,70 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fcache.h
+ *
+ * Description:
+ *
+ * Per-worker forwarding caches for the pipeline (see sr_pipeline.c).  Each
+ * worker keeps small direct-mapped copies of recent route lookups and ARP
+ * resolutions, so the fast path neither walks the routing table nor takes
+ * the ARP cache lock, and workers never write to a cache line another
+ * worker reads.
+ *
+ * The shared tables carry generation counters (sr_instance.rt_gen,
+ * sr_arpcache.gen) that are bumped on every change; a worker that sees a
+ * new generation drops its whole cache.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FCACHE_H
+#define SR_FCACHE_H
+
+#include <inttypes.h>
+#include <time.h>
+
+#define SR_FCACHE_ROUTES 256    /* power of two */
+#define SR_FCACHE_ARPS   64     /* power of two */
+
+struct sr_instance;
+struct sr_rt;
+struct sr_arpentry;
+
+struct sr_fcache_route
+{
+    uint32_t dst;               /* network byte order */
+    struct sr_rt* rt;           /* 0 caches "no route" */
+    int valid;
+};
+
+struct sr_fcache_arp
+{
+    uint32_t ip;                /* as keyed in sr_arpcache */
+    unsigned char mac[6];
+    time_t added;               /* of the shared entry, for its timeout */
+    int valid;
+};
+
+struct sr_fcache
+{
+    unsigned int rt_gen;
+    unsigned int arp_gen;
+    struct sr_fcache_route routes[SR_FCACHE_ROUTES];
+    struct sr_fcache_arp arps[SR_FCACHE_ARPS];
+
+    unsigned long rt_hits, rt_misses;
+    unsigned long arp_hits, arp_misses;
+    unsigned long flushes;
+};
+
+void sr_fcache_init(struct sr_fcache* fc);
+
+/* 1 and *rt on a hit (*rt may be 0 for a cached miss), 0 otherwise */
+int  sr_fcache_get_route(struct sr_fcache* fc, struct sr_instance* sr,
+                         uint32_t dst, struct sr_rt** rt);
+void sr_fcache_put_route(struct sr_fcache* fc, uint32_t dst, struct sr_rt* rt);
+
+/* 1 and the MAC in mac on a hit of an unexpired entry, 0 otherwise */
+int  sr_fcache_get_arp(struct sr_fcache* fc, struct sr_instance* sr,
+                       uint32_t ip, unsigned char* mac);
+void sr_fcache_put_arp(struct sr_fcache* fc, struct sr_arpentry* entry);
+
+#endif /* -- SR_FCACHE_H -- */
@@ -0,0 +1,449 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flight.c
+ *
+ * Description:
+ *
+ * Flight recorder, see sr_flight.h.
+ *
+ * A thread gets its ring the first time it records.  Only that thread
+ * writes it; a slot's seq is cleared while it is being overwritten and
+ * set to the record's position + 1 afterwards, so a dump running on
+ * another thread (or in a signal handler) skips records that change
+ * under it instead of locking anyone out.
+ *
+ * Dumps use nothing but open(2)/write(2) and the stack, so the SIGABRT
+ * handler can write one on the way down.  Triggers only post a
+ * semaphore, which is safe from a signal handler, for the recorder
+ * thread to act on.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "sr_flight.h"
+#include "sr_dumper.h"
+#include "sr_conf.h"
+#include "sr_log.h"
+#include "sr_hist.h"
+
+#define SR_FLIGHT_THREADS  64
+#define SR_FLIGHT_MAX_SNAP 2048
+#define SR_FLIGHT_OUTBUF   8192
+
+struct sr_flight_slot
+{
+    unsigned long seq;             /* position + 1, 0 while written */
+    uint64_t ts;                   /* ns since the epoch */
+    uint32_t caplen;
+    uint32_t len;
+};
+
+#define SR_FLIGHT_DATA(s) ((uint8_t*)((s) + 1))
+
+struct sr_flight_ring
+{
+    unsigned long head;            /* records written */
+    uint8_t* slots;
+};
+
+unsigned int sr_flight_frames = 0;
+
+static unsigned int sr_flight_snap;
+static size_t sr_flight_slot_size;
+static uint64_t sr_flight_mono_off;
+static const char* sr_flight_file;
+static long sr_flight_spike;
+
+static struct sr_flight_ring* sr_flight_rings[SR_FLIGHT_THREADS];
+static int sr_flight_nrings = 0;
+static __thread struct sr_flight_ring* sr_flight_self = 0;
+static __thread int sr_flight_none = 0;  /* no ring left for this thread */
+
+static sem_t sr_flight_sem;
+static const char* sr_flight_why = 0;
+static unsigned long sr_flight_dropped = 0;
+static unsigned int sr_flight_dumps = 0;
+static int sr_flight_stopping = 0;
+static pthread_t sr_flight_thread;
+
+static __inline__ struct sr_flight_slot* sr_flight_slot(
+    struct sr_flight_ring* r, unsigned long pos)
+{
+    return (struct sr_flight_slot*)
+        (r->slots + (pos & (sr_flight_frames - 1)) * sr_flight_slot_size);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_record_frame(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+static struct sr_flight_ring* sr_flight_ring_new(void)
+{
+    struct sr_flight_ring* r;
+    int i = __atomic_fetch_add(&sr_flight_nrings, 1, __ATOMIC_RELAXED);
+
+    if (i >= SR_FLIGHT_THREADS)
+    {
+        sr_flight_none = 1;
+        return 0;
+    }
+
+    r = (struct sr_flight_ring*)calloc(1, sizeof(*r));
+    assert(r);
+    r->slots = (uint8_t*)calloc(sr_flight_frames, sr_flight_slot_size);
+    assert(r->slots);
+    __atomic_store_n(&sr_flight_rings[i], r, __ATOMIC_RELEASE);
+    return r;
+}
+
+void sr_flight_record_frame(const uint8_t* buf, unsigned int len)
+{
+    struct sr_flight_ring* r = sr_flight_self;
+    struct sr_flight_slot* s;
+    unsigned long pos;
+
+    if (!r)
+    {
+        if (sr_flight_none || !(r = sr_flight_ring_new()))
+        { return; }
+        sr_flight_self = r;
+    }
+
+    pos = r->head;
+    s = sr_flight_slot(r, pos);
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->ts = sr_hist_now() + sr_flight_mono_off;
+    s->caplen = len < sr_flight_snap ? len : sr_flight_snap;
+    s->len = len;
+    memcpy(SR_FLIGHT_DATA(s), buf, s->caplen);
+
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->head, pos + 1, __ATOMIC_RELEASE);
+} /* -- sr_flight_record_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_read(..)
+ * Scope: Local
+ *
+ * Copy the record at pos of ring r, 0 if it has been (or is being)
+ * overwritten.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_flight_read(struct sr_flight_ring* r, unsigned long pos,
+                          struct sr_flight_slot* hdr, uint8_t* data)
+{
+    struct sr_flight_slot* s = sr_flight_slot(r, pos);
+
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    { return 0; }
+    *hdr = *s;
+    if (data)
+    { memcpy(data, SR_FLIGHT_DATA(s), hdr->caplen); }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == pos + 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_dump(..)
+ * Scope: Local
+ *
+ * Merge every thread's ring, oldest frame first, into a new pcap file.
+ * Only async-signal-safe calls from here on.
+ *
+ *---------------------------------------------------------------------*/
+
+static char* sr_flight_cat(char* p, char* end, const char* s)
+{
+    while (*s && p < end)
+    { *p++ = *s++; }
+    return p;
+}
+
+static char* sr_flight_num(char* p, char* end, unsigned long n)
+{
+    char digits[24];
+    int i = 0;
+
+    do
+    {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    while (i && p < end)
+    { *p++ = digits[--i]; }
+    return p;
+}
+
+static void sr_flight_out(int fd, uint8_t* out, unsigned int* fill,
+                          const void* p, unsigned int n)
+{
+    if (*fill + n > SR_FLIGHT_OUTBUF || !p)
+    {
+        if (write(fd, out, *fill) < 0)
+        { }  /* -- nothing to be done about it here -- */
+        *fill = 0;
+    }
+    if (p)
+    {
+        memcpy(out + *fill, p, n);
+        *fill += n;
+    }
+}
+
+static void sr_flight_dump(const char* why)
+{
+    char name[256];
+    char* p = name;
+    char* end = name + sizeof(name) - 1;
+    uint8_t out[SR_FLIGHT_OUTBUF];
+    uint8_t data[SR_FLIGHT_MAX_SNAP];
+    unsigned long pos[SR_FLIGHT_THREADS], stop[SR_FLIGHT_THREADS];
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    struct sr_flight_slot hdr;
+    unsigned int fill = 0;
+    int n = __atomic_load_n(&sr_flight_nrings, __ATOMIC_ACQUIRE);
+    int fd, i;
+
+    if (n > SR_FLIGHT_THREADS)
+    { n = SR_FLIGHT_THREADS; }
+
+    p = sr_flight_cat(p, end, sr_flight_file);
+    p = sr_flight_cat(p, end, ".");
+    p = sr_flight_num(p, end, getpid());
+    p = sr_flight_cat(p, end, ".");
+    p = sr_flight_num(p, end, __atomic_fetch_add(&sr_flight_dumps, 1,
+                                                 __ATOMIC_RELAXED));
+    p = sr_flight_cat(p, end, ".");
+    p = sr_flight_cat(p, end, why);
+    p = sr_flight_cat(p, end, ".pcap");
+    *p = 0;
+
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    { return; }
+
+    fh.magic = TCPDUMP_MAGIC;
+    fh.version_major = PCAP_VERSION_MAJOR;
+    fh.version_minor = PCAP_VERSION_MINOR;
+    fh.thiszone = 0;
+    fh.sigfigs = 0;
+    fh.snaplen = sr_flight_snap;
+    fh.linktype = LINKTYPE_ETHERNET;
+    sr_flight_out(fd, out, &fill, &fh, sizeof(fh));
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_flight_ring* r = __atomic_load_n(&sr_flight_rings[i],
+                                                   __ATOMIC_ACQUIRE);
+
+        stop[i] = r ? __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) : 0;
+        pos[i] = stop[i] > sr_flight_frames ? stop[i] - sr_flight_frames : 0;
+    }
+
+    while (1)
+    {
+        int best = -1;
+        uint64_t best_ts = 0;
+
+        /* -- the oldest record at the front of any ring -- */
+        for (i = 0; i < n; i++)
+        {
+            while (pos[i] < stop[i] &&
+                   !sr_flight_read(sr_flight_rings[i], pos[i], &hdr, 0))
+            { pos[i]++; }
+            if (pos[i] < stop[i] && (best < 0 || hdr.ts < best_ts))
+            {
+                best = i;
+                best_ts = hdr.ts;
+            }
+        }
+        if (best < 0)
+        { break; }
+
+        if (sr_flight_read(sr_flight_rings[best], pos[best], &hdr, data))
+        {
+            ph.ts.tv_sec = (int)(hdr.ts / 1000000000ULL);
+            ph.ts.tv_usec = (int)(hdr.ts % 1000000000ULL / 1000);
+            ph.caplen = hdr.caplen;
+            ph.len = hdr.len;
+            sr_flight_out(fd, out, &fill, &ph, sizeof(ph));
+            sr_flight_out(fd, out, &fill, data, hdr.caplen);
+        }
+        pos[best]++;
+    }
+
+    sr_flight_out(fd, out, &fill, 0, 0);
+    close(fd);
+} /* -- sr_flight_dump -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_trigger(..) / sr_flight_drop(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+void sr_flight_trigger(const char* why)
+{
+    if (!sr_flight_frames)
+    { return; }
+    __atomic_store_n(&sr_flight_why, why, __ATOMIC_RELEASE);
+    sem_post(&sr_flight_sem);
+}
+
+void sr_flight_drop(unsigned int n)
+{
+    if (sr_flight_frames)
+    { __atomic_add_fetch(&sr_flight_dropped, n, __ATOMIC_RELAXED); }
+}
+
+static void sr_flight_signal(int sig)
+{
+    if (sig == SIGUSR2)
+    { sr_flight_trigger("usr2"); }
+    else
+    { sr_flight_dump("abort"); }  /* -- abort() raises again on return -- */
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_main(..)
+ * Scope: Local
+ *
+ * Wait for triggers, and once a second look at the drop rate.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_flight_main(void* arg)
+{
+    unsigned long last_drops = 0, drops;
+    time_t last_auto = 0, now;
+    struct timespec ts;
+    const char* why;
+
+    sr_conf_pin("cpu_log", -1);
+
+    while (!__atomic_load_n(&sr_flight_stopping, __ATOMIC_ACQUIRE))
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec++;
+        if (sem_timedwait(&sr_flight_sem, &ts) != 0 && errno != ETIMEDOUT)
+        { continue; }
+
+        now = time(0);
+        drops = __atomic_load_n(&sr_flight_dropped, __ATOMIC_RELAXED);
+        why = __atomic_exchange_n(&sr_flight_why, 0, __ATOMIC_ACQ_REL);
+
+        if (!why && sr_flight_spike && drops - last_drops > sr_flight_spike)
+        { why = "drops"; }
+        last_drops = drops;
+
+        if (!why)
+        { continue; }
+        if (strcmp(why, "usr2") != 0)
+        {
+            /* -- automatic: don't let a storm fill the disk -- */
+            if (now - last_auto < SR_FLIGHT_GAP_S)
+            { continue; }
+            last_auto = now;
+        }
+
+        sr_flight_dump(why);
+        sr_log_info(SR_LOG_CAP, "flight recorder: dumped (%s)", why);
+    }
+
+    return 0;
+} /* -- sr_flight_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flight_start(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+int sr_flight_start(void)
+{
+    long frames = sr_conf_int("flight", 0);
+    long snap = sr_conf_int("flight_snap", 128);
+    struct sigaction sa;
+    unsigned int n = 2;
+
+    if (frames <= 0)
+    { return 0; }
+    if (snap < 14 || snap > SR_FLIGHT_MAX_SNAP)
+    {
+        fprintf(stderr, "-o flight_snap: expected 14 to %d bytes\n",
+                SR_FLIGHT_MAX_SNAP);
+        return -1;
+    }
+    while (n < frames)
+    { n <<= 1; }
+
+    sr_flight_snap = snap;
+    sr_flight_slot_size = (sizeof(struct sr_flight_slot) + snap + 7) & ~7;
+    sr_flight_mono_off = sr_hist_clock(CLOCK_REALTIME) - sr_hist_now();
+    sr_flight_file = sr_conf_str("flight_file", "sr-flight");
+    sr_flight_spike = sr_conf_int("flight_spike", 1000);
+    sem_init(&sr_flight_sem, 0, 0);
+
+    if (pthread_create(&sr_flight_thread, 0, sr_flight_main, 0) != 0)
+    {
+        perror("pthread_create(..):sr_flight.c::sr_flight_start");
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sr_flight_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, 0);
+    sa.sa_flags = SA_RESETHAND;
+    sigaction(SIGABRT, &sa, 0);
+
+    /* -- last: from now on threads start recording -- */
+    __atomic_store_n(&sr_flight_frames, n, __ATOMIC_RELEASE);
+    printf("flight recorder: last %u frames of %ld bytes per thread, "
+           "dumps to %s.*\n", n, snap, sr_flight_file);
+    return 0;
+} /* -- sr_flight_start -- */
+
+void sr_flight_stop(void)
+{
+    struct sigaction sa;
+    int i;
+
+    if (!sr_flight_frames)
+    { return; }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGUSR2, &sa, 0);
+    sigaction(SIGABRT, &sa, 0);
+
+    __atomic_store_n(&sr_flight_stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&sr_flight_sem);
+    pthread_join(sr_flight_thread, 0);
+    sem_destroy(&sr_flight_sem);
+
+    /* -- everyone else is done recording by now -- */
+    sr_flight_frames = 0;
+    for (i = 0; i < SR_FLIGHT_THREADS; i++)
+    {
+        if (sr_flight_rings[i])
+        {
+            free(sr_flight_rings[i]->slots);
+            free(sr_flight_rings[i]);
+            sr_flight_rings[i] = 0;
+        }
+    }
+} /* -- sr_flight_stop -- */
@@ -0,0 +1,50 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flight.h
+ *
+ * Description:
+ *
+ * Flight recorder (-o flight=N).  Every thread that receives or sends
+ * frames keeps the last N of them, cut to -o flight_snap bytes (the
+ * headers, by default), in a circular buffer of its own; recording is a
+ * copy into that buffer and nothing else.  When something goes wrong
+ * the buffers are merged by time and written out as a pcap file,
+ * <flight_file>.<pid>.<n>.<why>.pcap:
+ *
+ *   usr2    on SIGUSR2
+ *   drops   when more than -o flight_spike frames a second are dropped
+ *           for want of ring space (pipeline, punt)
+ *   arp     when a next hop's ARP queue (-o arp_queue) overflows
+ *   abort   on SIGABRT, i.e. a failed assertion, before the process dies
+ *
+ * Automatic dumps (drops, arp) are at least SR_FLIGHT_GAP_S apart.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLIGHT_H
+#define SR_FLIGHT_H
+
+#include <inttypes.h>
+
+#define SR_FLIGHT_GAP_S 10
+
+/* set up from the -o flight* keys; 0 also when the recorder is off */
+int  sr_flight_start(void);
+void sr_flight_stop(void);
+
+extern unsigned int sr_flight_frames;  /* per thread, 0 = off */
+
+void sr_flight_record_frame(const uint8_t* buf, unsigned int len);
+
+static __inline__ void sr_flight_record(const uint8_t* buf, unsigned int len)
+{
+    if (sr_flight_frames)
+    { sr_flight_record_frame(buf, len); }
+}
+
+/* ask for a dump; why is a short literal, safe to call from a signal
+   handler */
+void sr_flight_trigger(const char* why);
+/* count n dropped frames towards the drops trigger */
+void sr_flight_drop(unsigned int n);
+
+#endif /* -- SR_FLIGHT_H -- */
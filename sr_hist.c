@@ -0,0 +1,66 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_hist.c
+ *
+ * Description:
+ *
+ * Log-bucketed latency histograms, see sr_hist.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <math.h>
+
+#include "sr_hist.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_hist_value(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_hist_value(unsigned int b)
+{
+    unsigned int shift;
+
+    if (b < SR_HIST_SUB)
+    { return b; }
+
+    /* -- bucket b covers [(SUB + sub) << shift, +(1 << shift)) -- */
+    shift = b / SR_HIST_SUB - 1;
+    return (((uint64_t)(SR_HIST_SUB + b % SR_HIST_SUB) + 1) << shift) - 1;
+} /* -- sr_hist_value -- */
+
+unsigned long sr_hist_count(const unsigned long* buckets)
+{
+    unsigned long n = 0;
+    unsigned int b;
+
+    for (b = 0; b < SR_HIST_BUCKETS; b++)
+    { n += buckets[b]; }
+    return n;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_hist_percentile(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_hist_percentile(const unsigned long* buckets, double p)
+{
+    unsigned long n = sr_hist_count(buckets);
+    unsigned long rank, seen = 0;
+    unsigned int b;
+
+    if (n == 0)
+    { return 0; }
+
+    rank = (unsigned long)ceil(p * n);
+    if (rank < 1)
+    { rank = 1; }
+
+    for (b = 0; b < SR_HIST_BUCKETS; b++)
+    {
+        seen += buckets[b];
+        if (seen >= rank)
+        { return sr_hist_value(b); }
+    }
+    return sr_hist_value(SR_HIST_BUCKETS - 1);
+} /* -- sr_hist_percentile -- */
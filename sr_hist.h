@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_hist.h
+ *
+ * Description:
+ *
+ * Log-bucketed latency histograms, HDR style.  Values (ns) below
+ * 2^SR_HIST_SUB_BITS get a bucket each; above that every power of two is
+ * split into 2^SR_HIST_SUB_BITS equal buckets, so a bucket is never
+ * wider than 1/32 of the values in it and a percentile read back is
+ * within about 3% of the real one.  Values of 2^SR_HIST_MAX_BITS ns
+ * (about a minute) and up all land in the last bucket.
+ *
+ * Finding a bucket is a count-leading-zeros and two shifts; a histogram
+ * is just the array of bucket counts, so adding two is adding arrays.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_HIST_H
+#define SR_HIST_H
+
+#include <inttypes.h>
+#include <time.h>
+
+#define SR_HIST_SUB_BITS 5
+#define SR_HIST_SUB      (1 << SR_HIST_SUB_BITS)
+#define SR_HIST_MAX_BITS 36
+#define SR_HIST_BUCKETS  ((SR_HIST_MAX_BITS - SR_HIST_SUB_BITS + 1) * \
+                          SR_HIST_SUB)
+
+/* ns on clock id */
+static __inline__ uint64_t sr_hist_clock(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ns on CLOCK_MONOTONIC, read through the vDSO (the TSC on x86) */
+static __inline__ uint64_t sr_hist_now(void)
+{
+    return sr_hist_clock(CLOCK_MONOTONIC);
+}
+
+static __inline__ unsigned int sr_hist_bucket(uint64_t ns)
+{
+    int e;
+
+    if (ns < SR_HIST_SUB)
+    { return ns; }
+    if (ns >> SR_HIST_MAX_BITS)
+    { return SR_HIST_BUCKETS - 1; }
+
+    e = 63 - __builtin_clzll(ns);
+    return (e - SR_HIST_SUB_BITS + 1) * SR_HIST_SUB +
+           (ns >> (e - SR_HIST_SUB_BITS)) - SR_HIST_SUB;
+}
+
+/* the highest value that falls in bucket b */
+uint64_t sr_hist_value(unsigned int b);
+
+/* values counted in buckets */
+unsigned long sr_hist_count(const unsigned long* buckets);
+
+/* the value p (0..1) of the counted values are at or below, 0 when there
+   are none */
+uint64_t sr_hist_percentile(const unsigned long* buckets, double p);
+
+#endif /* -- SR_HIST_H -- */
@@ -0,0 +1,377 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp.c
+ *
+ * Description:
+ *
+ * Pre-built ICMP error messages, see sr_icmp.h.
+ *
+ * The template checksums are taken with the destination address and the
+ * quote zero, so filling those in is exactly the change cksum_update32()
+ * and cksum_add() account for.  The Ethernet addresses are left to
+ * Setup_eth_and_sent(), which knows the next hop.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_icmp.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_utils.h"
+#include "sr_conf.h"
+#include "sr_hist.h"
+
+static const struct
+{
+    uint8_t type;
+    uint8_t code;
+} sr_icmp_codes[SR_ICMP_ERRS] =
+{
+    { 3, 0 },
+    { 3, 3 },
+    { 11, 0 }
+};
+
+#define SR_ICMP_PROBES 8   /* slots looked at for a source prefix */
+
+struct sr_icmp_bucket
+{
+    uint64_t last;           /* monotonic ns of the last refill, 0 = free */
+    float tokens;
+    uint32_t prefix;         /* network byte order */
+};
+
+struct sr_icmp_rate
+{
+    double rate;             /* tokens per second, 0 = unlimited */
+    double burst;
+};
+
+struct sr_icmp_limit
+{
+    pthread_mutex_t lock;
+    struct sr_icmp_rate all_rate;
+    struct sr_icmp_rate src_rate;
+    uint32_t src_mask;       /* network byte order */
+    unsigned int nslots;     /* power of 2 */
+    struct sr_icmp_bucket all;
+    struct sr_icmp_bucket* slots;
+
+    /* -- under lock -- */
+    unsigned long sent;
+    unsigned long held_all;
+    unsigned long held_src;
+    unsigned long recycled;
+};
+
+static int sr_icmp_allow(struct sr_icmp_limit* limit, uint32_t src);
+
+#define SR_ICMP_IP(f)   ((sr_ip_hdr_t*)((f) + sizeof(sr_ethernet_hdr_t)))
+#define SR_ICMP_HDR(f)  ((sr_icmp_t3_hdr_t*)((f) + sizeof(sr_ethernet_hdr_t) + \
+                                             sizeof(sr_ip_hdr_t)))
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_build_templates(..)
+ * Scope: Global
+ *
+ * Build one error frame per type with iface's address as the source.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_icmp_build_templates(struct sr_if* iface)
+{
+    int err;
+
+    /* -- REQUIRES -- */
+    assert(iface);
+
+    for (err = 0; err < SR_ICMP_ERRS; err++)
+    {
+        uint8_t* f = iface->icmp_err[err].frame;
+        sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)f;
+        sr_ip_hdr_t* ip = SR_ICMP_IP(f);
+        sr_icmp_t3_hdr_t* icmp = SR_ICMP_HDR(f);
+
+        memset(f, 0, SR_ICMP_ERR_LEN);
+        eth->ether_type = htons(ethertype_ip);
+
+        ip->ip_v = 4;
+        ip->ip_hl = sizeof(sr_ip_hdr_t) / 4;
+        ip->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
+        ip->ip_ttl = INIT_TTL;
+        ip->ip_p = ip_protocol_icmp;
+        ip->ip_src = iface->ip;
+        ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+        /* unused and next_mtu (type 3) or unused (type 11) stay zero */
+        icmp->icmp_type = sr_icmp_codes[err].type;
+        icmp->icmp_code = sr_icmp_codes[err].code;
+        icmp->icmp_sum = cksum(icmp, sizeof(sr_icmp_t3_hdr_t));
+    }
+} /* -- sr_icmp_build_templates -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_send_error(..)
+ * Scope: Global
+ *
+ * Copy src_if's template for err, address it to the sender of packet,
+ * quote as much of packet's IP header and payload as fits (RFC 792) and
+ * patch the checksums for both.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_icmp_send_error(struct sr_instance* sr, enum sr_icmp_err err,
+                        struct sr_if* src_if, uint8_t* packet,
+                        unsigned int len, const char* iface)
+{
+    uint8_t f[SR_ICMP_ERR_LEN];
+    sr_ip_hdr_t* orig = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    sr_ip_hdr_t* ip = SR_ICMP_IP(f);
+    sr_icmp_t3_hdr_t* icmp = SR_ICMP_HDR(f);
+    unsigned int quote = len - sizeof(sr_ethernet_hdr_t);
+
+    /* -- REQUIRES -- */
+    assert(src_if && err < SR_ICMP_ERRS);
+    assert(len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+
+    if (sr->icmp_limit && !sr_icmp_allow(sr->icmp_limit, orig->ip_src))
+    { return; }
+
+    memcpy(f, src_if->icmp_err[err].frame, SR_ICMP_ERR_LEN);
+
+    ip->ip_dst = orig->ip_src;
+    ip->ip_sum = cksum_update32(ip->ip_sum, 0, ip->ip_dst);
+
+    if (quote > ICMP_DATA_SIZE)
+    { quote = ICMP_DATA_SIZE; }
+    memcpy(icmp->data, orig, quote);
+    icmp->icmp_sum = cksum_add(icmp->icmp_sum, icmp->data, quote);
+
+    sr_icmp_reply(sr, f, SR_ICMP_ERR_LEN, packet, iface);
+} /* -- sr_icmp_send_error -- */
+
+enum sr_reply_path sr_icmp_reply_path(void)
+{
+    const char* path = sr_conf_str("reply_path", "lookup");
+
+    if (strcmp(path, "check") == 0)
+    { return SR_REPLY_CHECK; }
+    if (strcmp(path, "sender") == 0)
+    { return SR_REPLY_SENDER; }
+    if (strcmp(path, "lookup") != 0)
+    { fprintf(stderr, "-o reply_path=%s: using lookup\n", path); }
+    return SR_REPLY_LOOKUP;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_reply(..)
+ * Scope: Global
+ *
+ * Route reply back to the sender of packet.  Unless sr->reply_path says
+ * otherwise this is the usual route and ARP lookup; on the reverse path
+ * the frame's source MAC is the next hop and iface the way out.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_icmp_reply(struct sr_instance* sr, uint8_t* reply,
+                   unsigned int reply_len, uint8_t* packet,
+                   const char* iface)
+{
+    sr_ethernet_hdr_t* in_eth = (sr_ethernet_hdr_t*)packet;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)reply;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(reply + sizeof(sr_ethernet_hdr_t));
+    struct sr_if* in_if;
+    struct sr_rt* rt = 0;
+
+    if (sr->reply_path != SR_REPLY_SENDER)
+    {
+        if (!(rt = find_routing_table(sr, ip->ip_dst)))
+        { return; }
+        if (sr->reply_path == SR_REPLY_LOOKUP ||
+            strncmp(rt->interface, iface, sr_IFACE_NAMELEN) != 0)
+        {
+            Setup_eth_and_sent(sr, eth, reply_len, rt);
+            return;
+        }
+    }
+
+    if (!(in_if = sr_get_interface(sr, iface)))
+    { return; }
+    memcpy(eth->ether_dhost, in_eth->ether_shost, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, in_if->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    sr_send_packet(sr, reply, reply_len, in_if->name);
+} /* -- sr_icmp_reply -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_limit_create(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+static void sr_icmp_rate_conf(struct sr_icmp_rate* r, const char* rate_key,
+                              long rate, const char* burst_key, long burst)
+{
+    r->rate = sr_conf_int(rate_key, rate);
+    r->burst = sr_conf_int(burst_key, burst);
+    if (r->rate < 0)
+    { r->rate = 0; }
+    if (r->burst < 1)
+    { r->burst = 1; }
+}
+
+struct sr_icmp_limit* sr_icmp_limit_create(void)
+{
+    struct sr_icmp_limit* limit;
+    long len = sr_conf_int("icmp_src_len", 24);
+    long slots = sr_conf_int("icmp_src_slots", 1024);
+
+    limit = (struct sr_icmp_limit*)calloc(1, sizeof(struct sr_icmp_limit));
+    assert(limit);
+    sr_icmp_rate_conf(&limit->all_rate, "icmp_rate", 1000, "icmp_burst", 100);
+    sr_icmp_rate_conf(&limit->src_rate, "icmp_src_rate", 100,
+                      "icmp_src_burst", 10);
+
+    if (limit->all_rate.rate == 0 && limit->src_rate.rate == 0)
+    {
+        free(limit);
+        return 0;
+    }
+
+    if (len < 0 || len > 32)
+    { len = 24; }
+    limit->src_mask = len ? htonl(0xffffffffUL << (32 - len)) : 0;
+
+    for (limit->nslots = 1; limit->nslots < slots && limit->nslots < (1 << 20);
+         limit->nslots <<= 1)
+    { }
+    if (limit->nslots < SR_ICMP_PROBES)
+    { limit->nslots = SR_ICMP_PROBES; }
+    if (limit->src_rate.rate > 0)
+    {
+        limit->slots = (struct sr_icmp_bucket*)
+            calloc(limit->nslots, sizeof(struct sr_icmp_bucket));
+        assert(limit->slots);
+    }
+
+    pthread_mutex_init(&limit->lock, 0);
+    return limit;
+} /* -- sr_icmp_limit_create -- */
+
+void sr_icmp_limit_destroy(struct sr_icmp_limit* limit)
+{
+    if (!limit)
+    { return; }
+    pthread_mutex_destroy(&limit->lock);
+    free(limit->slots);
+    free(limit);
+}
+
+/* a new bucket (last == 0) starts full */
+static void sr_icmp_refill(struct sr_icmp_bucket* b,
+                           const struct sr_icmp_rate* r, uint64_t now)
+{
+    double tokens = b->last ? b->tokens + (now - b->last) * 1e-9 * r->rate
+                            : r->burst;
+
+    b->tokens = tokens > r->burst ? r->burst : tokens;
+    b->last = now;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_src_bucket(..)
+ * Scope: Local
+ *
+ * The bucket of src's prefix: the one already in its probe run, else a
+ * free slot in the run, else the run's stalest bucket, recycled.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_icmp_bucket* sr_icmp_src_bucket(struct sr_icmp_limit* limit,
+                                                 uint32_t src)
+{
+    uint32_t prefix = src & limit->src_mask;
+    uint32_t h = ntohl(prefix);
+    struct sr_icmp_bucket* b;
+    struct sr_icmp_bucket* victim = 0;
+    int i;
+
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+
+    for (i = 0; i < SR_ICMP_PROBES; i++)
+    {
+        b = &limit->slots[(h + i) & (limit->nslots - 1)];
+        if (b->last && b->prefix == prefix)
+        { return b; }
+        if (!victim || (victim->last && b->last < victim->last))
+        { victim = b; }
+    }
+
+    if (victim->last)
+    { limit->recycled++; }
+    victim->last = 0;
+    victim->prefix = prefix;
+    return victim;
+} /* -- sr_icmp_src_bucket -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_allow(..)
+ * Scope: Local
+ *
+ * Take a token from src's bucket and from the global one, or from
+ * neither if either is empty.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_icmp_allow(struct sr_icmp_limit* limit, uint32_t src)
+{
+    struct sr_icmp_bucket* b = 0;
+    uint64_t now = sr_hist_now();
+    int ok = 0;
+
+    pthread_mutex_lock(&limit->lock);
+
+    if (limit->src_rate.rate > 0)
+    {
+        b = sr_icmp_src_bucket(limit, src);
+        sr_icmp_refill(b, &limit->src_rate, now);
+    }
+    if (limit->all_rate.rate > 0)
+    { sr_icmp_refill(&limit->all, &limit->all_rate, now); }
+
+    if (b && b->tokens < 1)
+    { limit->held_src++; }
+    else if (limit->all_rate.rate > 0 && limit->all.tokens < 1)
+    { limit->held_all++; }
+    else
+    {
+        if (b)
+        { b->tokens -= 1; }
+        if (limit->all_rate.rate > 0)
+        { limit->all.tokens -= 1; }
+        limit->sent++;
+        ok = 1;
+    }
+
+    pthread_mutex_unlock(&limit->lock);
+    return ok;
+} /* -- sr_icmp_allow -- */
+
+void sr_icmp_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    struct sr_icmp_limit* limit = sr->icmp_limit;
+
+    if (!limit)
+    { return; }
+
+    fprintf(fp, "icmp errors sent %lu, held back %lu per source and %lu "
+            "in all, %lu source buckets recycled\n", limit->sent,
+            limit->held_src, limit->held_all, limit->recycled);
+}
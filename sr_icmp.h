@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp.h
+ *
+ * Description:
+ *
+ * Pre-built ICMP error messages.  Every interface keeps one complete
+ * Ethernet/IP/ICMP frame per error type, sourced from its address, with
+ * the destination and the quoted header left zero and both checksums
+ * computed over that.  An error is then a copy of the template, the
+ * quote, and two incremental checksum updates.
+ *
+ * Errors are rate limited as RFC 1812 4.3.2.8 asks, by a token bucket
+ * for all errors of the instance and one per source prefix (-o icmp_*).
+ * The source buckets live in a small open addressing table; when a
+ * probe run is full the stalest bucket in it is recycled, which only
+ * lets a new prefix start with a full bucket a little early.
+ *
+ * Replies (errors and echo replies) normally take the full route and ARP
+ * lookup back to the sender.  -o reply_path=check instead sends them
+ * straight back to the MAC they came from, out of the ingress interface,
+ * when the route to the sender leaves by that interface too; with
+ * reply_path=sender they always go back that way, without a lookup,
+ * which assumes the routing is symmetric.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ICMP_H
+#define SR_ICMP_H
+
+#include <stdio.h>
+
+#include "sr_protocol.h"
+
+struct sr_instance;
+struct sr_if;
+
+enum sr_icmp_err
+{
+    SR_ICMP_NET_UNREACH,     /* 3/0 */
+    SR_ICMP_PORT_UNREACH,    /* 3/3 */
+    SR_ICMP_TIME_EXCEEDED,   /* 11/0 */
+    SR_ICMP_ERRS
+};
+
+/* type 3 and type 11 messages have the same layout */
+#define SR_ICMP_ERR_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + \
+                         sizeof(sr_icmp_t3_hdr_t))
+
+enum sr_reply_path
+{
+    SR_REPLY_LOOKUP,         /* route and ARP lookup for every reply */
+    SR_REPLY_CHECK,          /* back to the sender if the route agrees */
+    SR_REPLY_SENDER          /* always back to the sender */
+};
+
+struct sr_icmp_tmpl
+{
+    uint8_t frame[SR_ICMP_ERR_LEN];
+};
+
+struct sr_icmp_limit;
+
+/* from the -o icmp_* settings; 0 when nothing is limited */
+struct sr_icmp_limit* sr_icmp_limit_create(void);
+void sr_icmp_limit_destroy(struct sr_icmp_limit* limit);
+void sr_icmp_print_stats(struct sr_instance* sr, FILE* fp);
+
+/* the -o reply_path setting */
+enum sr_reply_path sr_icmp_reply_path(void);
+
+/* (re)build iface's templates after its address changed */
+void sr_icmp_build_templates(struct sr_if* iface);
+
+/* send the error of type err about the frame packet, received on
+   iface, sourced from src_if's address, unless the rate limit holds it
+   back */
+void sr_icmp_send_error(struct sr_instance* sr, enum sr_icmp_err err,
+                        struct sr_if* src_if, uint8_t* packet,
+                        unsigned int len, const char* iface);
+
+/* send reply, a frame of reply_len bytes whose Ethernet addresses are
+   still to be filled in, to the sender of packet, received on iface */
+void sr_icmp_reply(struct sr_instance* sr, uint8_t* reply,
+                   unsigned int reply_len, uint8_t* packet,
+                   const char* iface);
+
+#endif /* -- SR_ICMP_H -- */
@@ -24,6 +24,7 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_stats.h"
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
@@ -77,6 +78,8 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr->if_list->dev[0] = '\0';
+        sr->if_list->index = sr_stats_add_if(sr->host, name);
         return;
     }
 
@@ -89,6 +92,8 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->dev[0] = '\0';
+    if_walker->index = sr_stats_add_if(sr->host, name);
     if_walker->next = 0;
 } /* -- sr_add_interface -- */ 
 
@@ -137,6 +142,7 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_icmp_build_templates(if_walker);
 
 } /* -- sr_set_ether_ip -- */
 
@@ -187,8 +193,87 @@ void sr_print_if(struct sr_if* iface)
 
     ip_addr.s_addr = iface->ip;
 
-    Debug("%s\tHWaddr",iface->name);
-    DebugMAC(iface->addr);
-    Debug("\n");
-    Debug("\tinet addr %s\n",inet_ntoa(ip_addr));
+    /* -- printed in every build, like the routing table -- */
+    printf("%s\tHWaddr%02x:%02x:%02x:%02x:%02x:%02x\n", iface->name,
+           iface->addr[0], iface->addr[1], iface->addr[2], iface->addr[3],
+           iface->addr[4], iface->addr[5]);
+    printf("\tinet addr %s\n",inet_ntoa(ip_addr));
 } /* -- sr_print_if -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_load_if_config(..)
+ * Scope: Global
+ *
+ * Build the interface list from a file rather than from the VNS hardware
+ * info, for use with the data path backends.  One interface per line,
+ * '#' starts a comment:
+ *
+ *     <name> <ip> <mac> [host device]
+ *
+ * The host device defaults to the interface name.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_if_config(struct sr_instance* sr, const char* filename)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  name[sr_IFACE_NAMELEN];
+    char  ip[32];
+    char  mac[32];
+    char  dev[sr_IFACE_NAMELEN];
+    unsigned int b[ETHER_ADDR_LEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    struct in_addr ip_addr;
+    struct sr_if* if_walker = 0;
+    int i, n;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    if((fp = fopen(filename,"r")) == 0)
+    {
+        perror("fopen(..):sr_if.c::sr_load_if_config");
+        return -1;
+    }
+
+    while( fgets(line,BUFSIZ,fp) != 0)
+    {
+        char* hash = strchr(line,'#');
+        if(hash)
+        { *hash = '\0'; }
+
+        n = sscanf(line,"%31s %31s %31s %31s",name,ip,mac,dev);
+        if(n <= 0)
+        { continue; }
+
+        if(n < 3 || inet_aton(ip,&ip_addr) == 0 ||
+           sscanf(mac,"%x:%x:%x:%x:%x:%x",&b[0],&b[1],&b[2],&b[3],&b[4],&b[5])
+             != ETHER_ADDR_LEN)
+        {
+            fprintf(stderr,"Error loading interfaces, bad line: %s",line);
+            fclose(fp);
+            return -1;
+        }
+
+        for(i = 0; i < ETHER_ADDR_LEN; i++)
+        { addr[i] = (unsigned char)b[i]; }
+
+        sr_add_interface(sr,name);
+        sr_set_ether_addr(sr,addr);
+        sr_set_ether_ip(sr,ip_addr.s_addr);
+
+        for(if_walker = sr->if_list; if_walker->next; if_walker = if_walker->next);
+        strncpy(if_walker->dev,(n == 4) ? dev : name,sr_IFACE_NAMELEN);
+        if_walker->speed = 0;
+    } /* -- while -- */
+
+    fclose(fp);
+    return 0;
+} /* -- sr_load_if_config -- */
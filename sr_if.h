@@ -25,6 +25,7 @@
 #endif
 
 #include "sr_protocol.h"
+#include "sr_icmp.h"
 
 struct sr_instance;
 
@@ -41,6 +42,9 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  char dev[sr_IFACE_NAMELEN]; /* host device, for the raw backends */
+  int index;                  /* of its sr_stats counters */
+  struct sr_icmp_tmpl icmp_err[SR_ICMP_ERRS]; /* built with the ip */
   struct sr_if* next;
 };
 
@@ -50,5 +54,6 @@ void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
+int sr_load_if_config(struct sr_instance*, const char*);
 
 #endif /* --  sr_INTERFACE_H -- */
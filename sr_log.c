@@ -0,0 +1,165 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Diagnostic messages, see sr_log.h.
+ *
+ * The rate limit state of a call site is updated with atomics but not
+ * under a lock: when two threads start a new second at once a site may
+ * let a message or two more through, which is fine for a log.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "sr_log.h"
+#include "sr_conf.h"
+
+#define SR_LOG_LINE 1024
+
+unsigned char sr_log_levels[SR_LOG_CATS] =
+{ SR_LOG_INFO, SR_LOG_INFO, SR_LOG_INFO, SR_LOG_INFO, SR_LOG_INFO,
+  SR_LOG_INFO };
+
+static unsigned int sr_log_rate = 10;
+
+static const char* sr_log_level_names[] = { "err", "warn", "info", "debug" };
+static const char* sr_log_cat_names[SR_LOG_CATS] =
+{ "core", "fwd", "arp", "icmp", "io", "cap" };
+
+static int sr_log_find(const char** names, int n, const char* s, size_t len)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (strlen(names[i]) == len && strncmp(names[i], s, len) == 0)
+        { return i; }
+    }
+    return -1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_start(..)
+ * Scope: Global
+ *
+ * msg_level is a ','-separated list of either a level, for every
+ * category, or category=level; later items win.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_log_start(void)
+{
+    const char* spec = sr_conf_str("msg_level", 0);
+    const char* item = spec;
+    long rate = sr_conf_int("msg_rate", 10);
+
+    if (rate < 0)
+    {
+        fprintf(stderr, "-o msg_rate: expected 0 (no limit) or more\n");
+        return -1;
+    }
+    sr_log_rate = rate;
+
+    while (item && *item)
+    {
+        const char* end = strchr(item, ',');
+        const char* eq;
+        size_t len = end ? (size_t)(end - item) : strlen(item);
+        int cat = -1, level;
+
+        eq = memchr(item, '=', len);
+        if (eq)
+        {
+            cat = sr_log_find(sr_log_cat_names, SR_LOG_CATS, item, eq - item);
+            level = sr_log_find(sr_log_level_names, SR_LOG_DEBUG + 1, eq + 1,
+                                len - (eq + 1 - item));
+        }
+        else
+        { level = sr_log_find(sr_log_level_names, SR_LOG_DEBUG + 1, item, len); }
+
+        if (level < 0 || (eq && cat < 0))
+        {
+            fprintf(stderr, "-o msg_level=%s: bad item %.*s, expected "
+                    "[core|fwd|arp|icmp|io|cap=]err|warn|info|debug\n",
+                    spec, (int)len, item);
+            return -1;
+        }
+        if (cat >= 0)
+        { sr_log_levels[cat] = level; }
+        else
+        { memset(sr_log_levels, level, sizeof(sr_log_levels)); }
+
+        item = end ? end + 1 : 0;
+    }
+
+#ifndef _DEBUG_
+    if (memchr(sr_log_levels, SR_LOG_DEBUG, sizeof(sr_log_levels)))
+    {
+        fprintf(stderr, "-o msg_level: debug messages are not compiled "
+                "into this build\n");
+    }
+#endif
+    return 0;
+} /* -- sr_log_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_emit(..)
+ * Scope: Global
+ *
+ * Called by the sr_log macros once the level check has passed.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_emit(struct sr_log_site* site, enum sr_log_cat cat,
+                 enum sr_log_level level, const char* fmt, ...)
+{
+    char line[SR_LOG_LINE];
+    struct timeval tv;
+    struct tm tm;
+    unsigned long sec;
+    unsigned int missed;
+    va_list ap;
+    int n;
+
+    gettimeofday(&tv, 0);
+
+    /* -- rate limit per call site -- */
+    sec = __atomic_load_n(&site->second, __ATOMIC_RELAXED);
+    if (sec != (unsigned long)tv.tv_sec &&
+        __atomic_compare_exchange_n(&site->second, &sec, tv.tv_sec, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    { __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED); }
+    if (sr_log_rate &&
+        __atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > sr_log_rate)
+    {
+        __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    missed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+
+    localtime_r(&tv.tv_sec, &tm);
+    n = snprintf(line, sizeof(line), "%02d:%02d:%02d.%06ld %s %s: ",
+                 tm.tm_hour, tm.tm_min, tm.tm_sec, (long)tv.tv_usec,
+                 sr_log_level_names[level], sr_log_cat_names[cat]);
+
+    va_start(ap, fmt);
+    n += vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+    va_end(ap);
+    if (n > SR_LOG_LINE - 40)
+    { n = SR_LOG_LINE - 40; }
+
+    if (missed)
+    { n += sprintf(line + n, " (%u more suppressed)", missed); }
+    line[n++] = '\n';
+
+    if (write(2, line, n) < 0)
+    { /* nowhere left to complain */ }
+} /* -- sr_log_emit -- */
@@ -29,9 +29,18 @@
 #include <getopt.h>
 #endif /* _LINUX_ */
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_conf.h"
+#include "sr_punt.h"
+#include "sr_icmp.h"
+#include "sr_backend.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_mem.h"
+#include "sr_flight.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_metrics.h"
 
 extern char* optarg;
 
@@ -46,10 +55,10 @@ extern char* optarg;
 #define DEFAULT_TOPO 0
 
 static void usage(char* );
-static void sr_init_instance(struct sr_instance* );
-static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
-static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static int  sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static int  sr_open_backend(struct sr_instance* sr, struct sr_options* opts);
+static int  sr_mem_check(int ret);
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -57,19 +66,14 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
 int main(int argc, char **argv)
 {
     int c;
-    char *host   = DEFAULT_HOST;
-    char *user = 0;
-    char *server = DEFAULT_SERVER;
-    char *rtable = DEFAULT_RTABLE;
-    char *template = NULL;
-    unsigned int port = DEFAULT_PORT;
-    unsigned int topo = DEFAULT_TOPO;
-    char *logfile = 0;
+    char *config = 0;
+    int workers = 0;
+    struct sr_options opts;
     struct sr_instance sr;
 
-    printf("Using %s\n", VERSION_INFO);
+    sr_default_options(&opts);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:B:I:R:m:w:x:S:bC:W:o:")) != EOF)
     {
         switch (c)
         {
@@ -77,95 +81,310 @@ int main(int argc, char **argv)
                 usage(argv[0]);
                 exit(0);
                 break;
-            case 'p':
-                port = atoi((char *) optarg);
-                break;
-            case 't':
-                topo = atoi((char *) optarg);
-                break;
-            case 'v':
-                host = optarg;
-                break;
-            case 'u':
-                user = optarg;
-                break;
-            case 's':
-                server = optarg;
+            case 'C':
+                config = optarg;
                 break;
-            case 'l':
-                logfile = optarg;
+            case 'W':
+                workers = atoi((char *) optarg);
                 break;
-            case 'r':
-                rtable = optarg;
+            case 'o':
+                if(sr_conf_set(optarg) != 0)
+                {
+                    exit(1);
+                }
                 break;
-            case 'T':
-                template = optarg;
+            default:
+                if(sr_parse_option(&opts, c, optarg) != 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
                 break;
         } /* switch */
     } /* -- while -- */
 
+    /* -- with -l - the capture has stdout to itself -- */
+    if(opts.logfile && strcmp(opts.logfile, "-") == 0 &&
+       sr_capture_stdout() != 0)
+    {
+        return 1;
+    }
+
+    printf("Using %s\n", VERSION_INFO);
+
+    opts.busy_poll = sr_conf_int("busy_poll", opts.busy_poll);
+
+    if(sr_log_start() != 0 || sr_stats_start() != 0 ||
+       sr_flight_start() != 0 || sr_metrics_start() != 0)
+    {
+        return 1;
+    }
+
+    /* -- many virtual routers in this process, see sr_multi.c -- */
+    if(config)
+    {
+        int ret = sr_multi_run(config, &opts, workers);
+
+        sr_metrics_stop();
+        sr_flight_stop();
+        sr_stats_stop();
+        return sr_mem_check(ret);
+    }
+
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
 
+    if(sr_setup_instance(&sr, &opts) != 0)
+    {
+        return 1;
+    }
+
+    /* call router init (for arp subsystem etc.) */
+    sr_init(&sr);
+    sr_metrics_add(&sr);
+
+    if(sr_conf_int("punt", 0) > 0 &&
+       sr_punt_start(&sr, sr_conf_int("punt", 0),
+                     sr_conf_int("punt_cpu", 20)) != 0)
+    {
+        return 1;
+    }
+
+    if(sr_conf_int("pipeline", 0) > 0 &&
+       sr_pipeline_start(&sr, sr_conf_int("pipeline", 0),
+                         sr_conf_int("rx_ring", 1024),
+                         sr_conf_int("tx_ring", 1024)) != 0)
+    {
+        return 1;
+    }
+
+    /* -- last, so the threads started above don't inherit the mask -- */
+    sr_conf_pin("cpu_rx", -1);
+
+    /* -- whizbang main loop ;-) */
+    while( sr_read_from_server(&sr) == 1);
+
+    sr_pipeline_stop(&sr);
+    sr_punt_stop(&sr);
+    sr_destroy_instance(&sr);
+    sr_metrics_stop();
+    sr_flight_stop();
+    sr_stats_stop();
+
+    return sr_mem_check(0);
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mem_check(..)
+ * Scope: Local
+ *
+ * With -o mem_check=1, report the accounted memory at shutdown and turn
+ * an otherwise clean exit status into 2 if any object was leaked.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_mem_check(int ret)
+{
+    if(!sr_conf_int("mem_check", 0))
+    { return ret; }
+
+    sr_mem_report(stdout);
+    if(ret == 0 && sr_mem_live(-1) > 0)
+    {
+        fprintf(stderr, "Error: %ld objects leaked\n", sr_mem_live(-1));
+        return 2;
+    }
+    return ret;
+} /* -- sr_mem_check -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_default_options(..) / sr_parse_option(..)
+ * Scope: Global
+ *
+ * Settings of one virtual router.  sr_parse_option() takes a command
+ * line option letter (see usage()) and its argument and returns -1 for
+ * unknown letters; the multi-instance config reuses it.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_default_options(struct sr_options* opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->host = DEFAULT_HOST;
+    opts->server = DEFAULT_SERVER;
+    opts->rtable = DEFAULT_RTABLE;
+    opts->port = DEFAULT_PORT;
+    opts->topo = DEFAULT_TOPO;
+} /* -- sr_default_options -- */
+
+int sr_parse_option(struct sr_options* opts, int c, char* arg)
+{
+    switch (c)
+    {
+        case 'p':
+            opts->port = atoi(arg);
+            break;
+        case 't':
+            opts->topo = atoi(arg);
+            break;
+        case 'v':
+            opts->host = arg;
+            break;
+        case 'u':
+            opts->user = arg;
+            break;
+        case 's':
+            opts->server = arg;
+            break;
+        case 'l':
+            opts->logfile = arg;
+            break;
+        case 'r':
+            opts->rtable = arg;
+            break;
+        case 'T':
+            opts->template = arg;
+            break;
+        case 'B':
+            opts->backend = arg;
+            break;
+        case 'I':
+            opts->ifconfig = arg;
+            break;
+        case 'R':
+            opts->replay = arg;
+            break;
+        case 'm':
+            opts->replay_map = arg;
+            break;
+        case 'w':
+            opts->replay_out = arg;
+            break;
+        case 'x':
+            opts->replay_speed = atof(arg);
+            break;
+        case 'S':
+            opts->shm_path = arg;
+            break;
+        case 'b':
+            opts->busy_poll = SR_BUSY_POLL_US;
+            break;
+        default:
+            return -1;
+    } /* switch */
+
+    return 0;
+} /* -- sr_parse_option -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_setup_instance(..)
+ * Scope: Global
+ *
+ * Bring up the virtual router sr (already zeroed by sr_init_instance())
+ * as described by opts: routing table, packet log, VNS session and/or
+ * data path backend.  The caller still has to sr_init() it.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_setup_instance(struct sr_instance* sr, struct sr_options* opts)
+{
     /* -- set up routing table from file -- */
-    if(template == NULL) {
-        sr.template[0] = '\0';
-        sr_load_rt_wrap(&sr, rtable);
+    if(opts->template == NULL) {
+        sr->template[0] = '\0';
+        if(sr_load_rt_wrap(sr, opts->rtable) != 0)
+            return -1;
     }
     else
-        strncpy(sr.template, template, 30);
+        strncpy(sr->template, opts->template, 30);
 
-    sr.topo_id = topo;
-    strncpy(sr.host,host,32);
+    sr->topo_id = opts->topo;
+    sr->busy_poll = opts->busy_poll;
+    strncpy(sr->host,opts->host,32);
 
-    if(! user )
-    { sr_set_user(&sr); }
+    if(! opts->user )
+    { sr_set_user(sr); }
     else
-    { strncpy(sr.user, user, 32); }
+    { strncpy(sr->user, opts->user, 32); }
 
     /* -- set up file pointer for logging of raw packets -- */
-    if(logfile != 0)
+    if(opts->logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr->capture = sr_capture_open(opts->logfile);
+        if(!sr->capture)
         {
-            fprintf(stderr,"Error opening up dump file %s\n",
-                    logfile);
-            exit(1);
+            fprintf(stderr,"Error setting up the packet capture to %s\n",
+                    opts->logfile);
+            return -1;
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
+    if(opts->backend && strcmp(opts->backend, "vns") != 0 &&
+       strcmp(opts->backend, "shm") != 0)
+    {
+        /* -- interfaces come from the config file, not from VNS -- */
+        if(sr_open_backend(sr, opts) != 0)
+        {
+            return -1;
+        }
+    }
     else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
     {
-        return 1;
+        sr_log_info(SR_LOG_CORE, "client %s connecting to server %s:%d",
+                    sr->user, opts->server, opts->port);
+        if(opts->template)
+            sr_log_info(SR_LOG_CORE, "requesting topology template %s",
+                        opts->template);
+        else
+            sr_log_info(SR_LOG_CORE, "requesting topology %d", opts->topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(sr,opts->port,opts->server) == -1)
+        {
+            return -1;
+        }
+
+        /* -- frames move through the peer's rings, control stays on VNS -- */
+        if(opts->backend && strcmp(opts->backend, "shm") == 0)
+        {
+            if(!opts->shm_path)
+            {
+                fprintf(stderr, "The shm backend needs -S socket path\n");
+                return -1;
+            }
+            if(sr_shm_open(sr, opts->shm_path, opts->busy_poll) != 0)
+            {
+                return -1;
+            }
+        }
     }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
+    if(opts->template != NULL && strcmp(opts->rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+        sr_log_info(SR_LOG_CORE, "connected to new instantiation of "
+                    "topology template %s", opts->template);
+        if(sr_load_rt_wrap(sr, "rtable.vrhost") != 0)
+            return -1;
     }
     else {
       /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+      if(sr_load_rt_wrap(sr, opts->rtable) != 0)
+          return -1;
     }
 
-    /* call router init (for arp subsystem etc.) */
-    sr_init(&sr);
-
-    /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
-
-    sr_destroy_instance(&sr);
+    /* with VNS (shm included) this is checked when the hardware info arrives */
+    if(sr->backend && strcmp(sr->backend->name, "shm") != 0 &&
+       sr_verify_routing_table(sr) != 0)
+    {
+        fprintf(stderr,"Routing table not consistent with interfaces\n");
+        return -1;
+    }
 
     return 0;
-}/* -- main -- */
+} /* -- sr_setup_instance -- */
 
 /*-----------------------------------------------------------------------------
  * Method: usage(..)
@@ -178,7 +397,25 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-B backend] [-I interface config]\n");
+    printf("           [-R replay pcap] [-m replay map] [-w tx pcap]\n");
+    printf("           [-x replay speed] [-S shm socket] [-b]\n");
+    printf("           [-C instance config] [-W workers] [-o key=value]\n");
+    printf("   backend is one of vns (default), tap, packet, replay or shm; tap\n");
+    printf("   and packet bind each interface listed in the -I file to a host\n");
+    printf("   device, replay feeds the -R capture through the router (-x 0\n");
+    printf("   for full speed, 1 for recorded timing), shm exchanges frames\n");
+    printf("   with a local VNS peer through the shared memory rings it offers\n");
+    printf("   on the -S socket\n");
+    printf("   -b busy polls the input (VNS socket, devices or rings) for up\n");
+    printf("   to %d usecs after the last frame before blocking\n",
+           SR_BUSY_POLL_US);
+    printf("   a server containing '/' is a Unix socket path (see vns_local)\n");
+    printf("   -C runs one virtual router per line of the config on a pool of\n");
+    printf("   -W worker threads (default: one per CPU); the other options\n");
+    printf("   are the defaults for every line\n");
+    printf("   -o keys (pipeline and punt are for single-instance runs):\n");
+    sr_conf_usage(stdout);
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -210,19 +447,51 @@ void sr_set_user(struct sr_instance* sr)
 
 /*-----------------------------------------------------------------------------
  * Method: sr_destroy_instance(..)
- * Scope: Local
+ * Scope: Global
  *
  *
  *----------------------------------------------------------------------------*/
 
-static void sr_destroy_instance(struct sr_instance* sr)
+void sr_destroy_instance(struct sr_instance* sr)
 {
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    sr_metrics_remove(sr);
+
+    if(sr->backend)
+    {
+        sr->backend->close(sr);
+    }
+
+    if(sr->sockfd >= 0)
     {
-        sr_dump_close(sr->logfile);
+        close(sr->sockfd);
+    }
+
+    if(sr->icmp_limit)
+    {
+        sr_icmp_print_stats(sr, stdout);
+        sr_icmp_limit_destroy(sr->icmp_limit);
+        sr->icmp_limit = 0;
+    }
+
+    if(sr->cache.overflows)
+    {
+        printf("arp: %lu frames dropped, their next hop's queue was full\n",
+               sr->cache.overflows);
+    }
+
+    /* -- queued frames and the routing table, see sr_mem.h -- */
+    sr_arpcache_flush(&sr->cache);
+    sr_rt_unshare(sr->routing_table);
+    sr->routing_table = 0;
+
+    /* -- last: with nothing queued for ARP, nobody is sending any more -- */
+    if(sr->capture)
+    {
+        sr_capture_close(sr->capture, stdout);
+        sr->capture = 0;
     }
 
     /*
@@ -232,12 +501,12 @@ static void sr_destroy_instance(struct sr_instance* sr)
 
 /*-----------------------------------------------------------------------------
  * Method: sr_init_instance(..)
- * Scope: Local
+ * Scope: Global
  *
  *
  *----------------------------------------------------------------------------*/
 
-static void sr_init_instance(struct sr_instance* sr)
+void sr_init_instance(struct sr_instance* sr)
 {
     /* REQUIRES */
     assert(sr);
@@ -248,7 +517,15 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
+    sr->rt_gen = 0;
+    sr->capture = 0;
+    sr->backend = 0;
+    sr->pipeline = 0;
+    sr->punt = 0;
+    sr->icmp_limit = 0;
+    sr->reply_path = 0;
+    sr->busy_poll = 0;
+    pthread_mutex_init(&sr->send_lock, 0);
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -302,11 +579,11 @@ int sr_verify_routing_table(struct sr_instance* sr)
     return ret;
 } /* -- sr_verify_routing_table -- */
 
-static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
+static int sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
                 rtable);
-        exit(1);
+        return -1;
     }
 
 
@@ -314,4 +591,50 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     printf("---------------------------------------------\n");
     sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
+    return 0;
 }
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_open_backend(..)
+ * Scope: Local
+ *
+ * Set up the interfaces from the config file and open the named data path
+ * backend in place of the VNS session.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int sr_open_backend(struct sr_instance* sr,
+                           struct sr_options* opts)
+{
+    if(strcmp(opts->backend, "tap") != 0 && strcmp(opts->backend, "packet") != 0 &&
+       strcmp(opts->backend, "replay") != 0)
+    {
+        fprintf(stderr, "Unknown backend %s\n", opts->backend);
+        return -1;
+    }
+
+    if(!opts->ifconfig)
+    {
+        fprintf(stderr, "The %s backend needs an interface config (-I)\n",
+                opts->backend);
+        return -1;
+    }
+
+    if(sr_load_if_config(sr, opts->ifconfig) != 0)
+    {
+        fprintf(stderr, "Error setting up interfaces from file %s\n",
+                opts->ifconfig);
+        return -1;
+    }
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    if(strcmp(opts->backend, "replay") == 0)
+    {
+        return sr_replay_open(sr, opts->replay, opts->replay_map,
+                              opts->replay_out, opts->replay_speed);
+    }
+
+    return sr_raw_open(sr, strcmp(opts->backend, "tap") == 0);
+} /* -- sr_open_backend -- */
@@ -0,0 +1,158 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mem.c
+ *
+ * Description:
+ *
+ * Accounted allocation, see sr_mem.h.  Every block carries a small
+ * header with its kind and size so that sr_mem_free() can charge the
+ * right subsystem; the counters are process wide and updated with
+ * atomics, so any thread may allocate or free.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_mem.h"
+
+#define SR_MEM_MAGIC 0x5372 /* 'Sr' */
+
+/* -- 16 bytes, so the block after it stays aligned for anything -- */
+struct sr_mem_hdr
+{
+    unsigned short magic;
+    unsigned short kind;
+    unsigned int pad;
+    size_t size;
+};
+
+struct sr_mem_stats
+{
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long bytes;        /* live */
+    unsigned long peak_bytes;
+};
+
+static struct sr_mem_stats sr_mem_stats[SR_MEM_KINDS];
+
+static const char* sr_mem_names[SR_MEM_KINDS] =
+{ "rx", "tx", "arp", "punt", "routes" };
+
+static void* sr_mem_account(struct sr_mem_hdr* h, enum sr_mem_kind kind,
+                            size_t size)
+{
+    struct sr_mem_stats* st = &sr_mem_stats[kind];
+    unsigned long bytes, peak;
+
+    if (!h)
+    { return 0; }
+    h->magic = SR_MEM_MAGIC;
+    h->kind = kind;
+    h->size = size;
+
+    __atomic_add_fetch(&st->allocs, 1, __ATOMIC_RELAXED);
+    bytes = __atomic_add_fetch(&st->bytes, size, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&st->peak_bytes, __ATOMIC_RELAXED);
+    while (bytes > peak &&
+           !__atomic_compare_exchange_n(&st->peak_bytes, &peak, bytes, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    { }
+
+    return h + 1;
+}
+
+void* sr_mem_alloc(enum sr_mem_kind kind, size_t size)
+{
+    assert(kind < SR_MEM_KINDS);
+    return sr_mem_account(
+        (struct sr_mem_hdr*)malloc(sizeof(struct sr_mem_hdr) + size),
+        kind, size);
+}
+
+void* sr_mem_calloc(enum sr_mem_kind kind, size_t size)
+{
+    assert(kind < SR_MEM_KINDS);
+    return sr_mem_account(
+        (struct sr_mem_hdr*)calloc(1, sizeof(struct sr_mem_hdr) + size),
+        kind, size);
+}
+
+void sr_mem_free(void* p)
+{
+    struct sr_mem_hdr* h;
+    struct sr_mem_stats* st;
+
+    if (!p)
+    { return; }
+
+    h = (struct sr_mem_hdr*)p - 1;
+    assert(h->magic == SR_MEM_MAGIC && h->kind < SR_MEM_KINDS);
+    st = &sr_mem_stats[h->kind];
+
+    __atomic_add_fetch(&st->frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&st->bytes, h->size, __ATOMIC_RELAXED);
+    h->magic = 0;
+    free(h);
+}
+
+long sr_mem_live(int kind)
+{
+    long live = 0;
+    int k;
+
+    for (k = 0; k < SR_MEM_KINDS; k++)
+    {
+        if (kind < 0 || kind == k)
+        {
+            live += __atomic_load_n(&sr_mem_stats[k].allocs, __ATOMIC_RELAXED) -
+                    __atomic_load_n(&sr_mem_stats[k].frees, __ATOMIC_RELAXED);
+        }
+    }
+    return live;
+}
+
+const char* sr_mem_name(int kind)
+{
+    return sr_mem_names[kind];
+}
+
+unsigned long sr_mem_bytes(int kind)
+{
+    return __atomic_load_n(&sr_mem_stats[kind].bytes, __ATOMIC_RELAXED);
+}
+
+unsigned long sr_mem_peak(int kind)
+{
+    return __atomic_load_n(&sr_mem_stats[kind].peak_bytes, __ATOMIC_RELAXED);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_mem_report(..)
+ * Scope: Global
+ *
+ * One line per subsystem: objects allocated and freed, live objects and
+ * bytes, and the most bytes ever live at once.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_mem_report(FILE* fp)
+{
+    int k;
+
+    fprintf(fp, "%-7s %12s %12s %8s %12s %12s\n", "memory", "allocs",
+            "frees", "live", "live bytes", "peak bytes");
+    for (k = 0; k < SR_MEM_KINDS; k++)
+    {
+        struct sr_mem_stats* st = &sr_mem_stats[k];
+
+        fprintf(fp, "%-7s %12lu %12lu %8ld %12lu %12lu\n", sr_mem_names[k],
+                __atomic_load_n(&st->allocs, __ATOMIC_RELAXED),
+                __atomic_load_n(&st->frees, __ATOMIC_RELAXED),
+                sr_mem_live(k),
+                __atomic_load_n(&st->bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&st->peak_bytes, __ATOMIC_RELAXED));
+    }
+} /* -- sr_mem_report -- */
@@ -0,0 +1,57 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mem.h
+ *
+ * Description:
+ *
+ * Accounted allocation for the objects the router makes per packet or
+ * per table, so that each subsystem's live objects and bytes can be
+ * watched and leaks found (-o mem_check=1 reports what is still live at
+ * shutdown and makes sr exit with status 2 if anything is).
+ *
+ * Ownership of packet buffers:
+ *
+ *   - A received frame belongs to whoever read it (the VNS session, a
+ *     backend or the pipeline) and is freed by it once sr_handlepacket()
+ *     returns.  Handlers borrow it: they may rewrite it in place and send
+ *     it, but never free it or keep a pointer to it.
+ *   - sr_send_packet() borrows the buffer it is given; a transport that
+ *     has to hold on to the frame (pipeline TX, shm rings) copies it.
+ *   - sr_arpcache_queuereq() and sr_punt() copy what they queue; the
+ *     copies belong to the queue and are freed by whoever drains it.
+ *   - sr_arpcache_lookup() returns a copy the caller frees with
+ *     sr_mem_free().
+ *   - A routing table belongs to its instance, or to the sharing list
+ *     once passed to sr_rt_share(); sr_rt_unshare() releases either.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_MEM_H
+#define SR_MEM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+enum sr_mem_kind
+{
+    SR_MEM_RX,          /* frames read from the session or a ring */
+    SR_MEM_TX,          /* frames queued for the pipeline TX thread */
+    SR_MEM_ARP,         /* ARP request queue and cache lookups */
+    SR_MEM_PUNT,        /* control plane punt jobs */
+    SR_MEM_ROUTES,      /* routing table entries */
+    SR_MEM_KINDS
+};
+
+/* 0, and nothing accounted, when out of memory */
+void* sr_mem_alloc(enum sr_mem_kind kind, size_t size);
+void* sr_mem_calloc(enum sr_mem_kind kind, size_t size);
+void  sr_mem_free(void* p);
+
+/* objects of kind now allocated, or of all kinds for kind < 0 */
+long  sr_mem_live(int kind);
+/* name of kind, its live bytes and the most ever live at once */
+const char* sr_mem_name(int kind);
+unsigned long sr_mem_bytes(int kind);
+unsigned long sr_mem_peak(int kind);
+void  sr_mem_report(FILE* fp);
+
+#endif /* -- SR_MEM_H -- */
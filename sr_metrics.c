@@ -0,0 +1,599 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_metrics.c
+ *
+ * Description:
+ *
+ * Metrics endpoint, see sr_metrics.h.
+ *
+ * One thread polls the listening socket and up to SR_METRICS_CLIENTS
+ * connections, all non-blocking: a slow or stuck client only holds its
+ * own slot, until SR_METRICS_TIMEOUT.  A scrape renders the whole page
+ * into memory first and then writes it out as the client takes it.
+ *
+ * Instances are exported from sr_metrics_add() until sr_metrics_remove();
+ * sr_metrics_lock keeps an instance from being torn down mid-scrape.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_metrics.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_stats.h"
+#include "sr_mem.h"
+#include "sr_conf.h"
+#include "sr_log.h"
+
+#define SR_METRICS_INSTS 1024
+#define SR_METRICS_REQ   2048  /* bytes of request headers read */
+#define SR_METRICS_POLL  200   /* ms between looks at the stop flag */
+
+struct sr_metrics_client
+{
+    int fd;                    /* -1 when the slot is free */
+    time_t since;
+    char req[SR_METRICS_REQ];
+    size_t req_len;
+    char* out;                 /* response, once the request is in */
+    size_t out_len;
+    size_t out_sent;
+};
+
+static struct sr_instance* sr_metrics_insts[SR_METRICS_INSTS];
+static int sr_metrics_ninsts = 0;
+static pthread_mutex_t sr_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct sr_metrics_client sr_metrics_clients[SR_METRICS_CLIENTS];
+static int sr_metrics_fd = -1;
+static char sr_metrics_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static int sr_metrics_running = 0;
+static int sr_metrics_stopping = 0;
+static pthread_t sr_metrics_thread;
+
+#define SR_METRICS_QUANTILES 4
+static const double sr_metrics_quantiles[SR_METRICS_QUANTILES] =
+{ 0.5, 0.9, 0.99, 0.999 };
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_add(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+void sr_metrics_add(struct sr_instance* sr)
+{
+    pthread_mutex_lock(&sr_metrics_lock);
+    if (sr_metrics_ninsts < SR_METRICS_INSTS)
+    { sr_metrics_insts[sr_metrics_ninsts++] = sr; }
+    pthread_mutex_unlock(&sr_metrics_lock);
+} /* -- sr_metrics_add -- */
+
+void sr_metrics_remove(struct sr_instance* sr)
+{
+    int i;
+
+    pthread_mutex_lock(&sr_metrics_lock);
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        if (sr_metrics_insts[i] == sr)
+        {
+            sr_metrics_insts[i] = sr_metrics_insts[--sr_metrics_ninsts];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sr_metrics_lock);
+} /* -- sr_metrics_remove -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_render(..)
+ * Scope: Local
+ *
+ * The page, in the Prometheus text exposition format 0.0.4.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_metrics_head(FILE* fp, const char* name, const char* type,
+                            const char* help)
+{
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void sr_metrics_ifs(FILE* fp, struct sr_stats* sum, int nifs,
+                           const char* name, const char* help, size_t off)
+{
+    int i;
+
+    sr_metrics_head(fp, name, "counter", help);
+    for (i = 0; i <= SR_STATS_IFS; i++)
+    {
+        const char* inst;
+        const char* ifname;
+
+        if (i >= nifs && i < SR_STATS_IFS)
+        { continue; }
+        if (i == SR_STATS_IFS && !sum->ifs[i].rx_packets &&
+            !sum->ifs[i].tx_packets)
+        { continue; }
+
+        ifname = sr_stats_if_name(i, &inst);
+        fprintf(fp, "%s{router=\"%s\",interface=\"%s\"} %lu\n", name, inst,
+                ifname, *(unsigned long*)((char*)&sum->ifs[i] + off));
+    }
+}
+
+static void sr_metrics_render(FILE* fp)
+{
+    static struct sr_stats sum;   /* too big for a thread's stack */
+    int nifs, i, j;
+
+    nifs = sr_stats_read(&sum);
+
+    sr_metrics_ifs(fp, &sum, nifs, "sr_interface_rx_packets_total",
+                   "Frames received.",
+                   offsetof(struct sr_stats_if, rx_packets));
+    sr_metrics_ifs(fp, &sum, nifs, "sr_interface_rx_bytes_total",
+                   "Bytes received.", offsetof(struct sr_stats_if, rx_bytes));
+    sr_metrics_ifs(fp, &sum, nifs, "sr_interface_tx_packets_total",
+                   "Frames sent.", offsetof(struct sr_stats_if, tx_packets));
+    sr_metrics_ifs(fp, &sum, nifs, "sr_interface_tx_bytes_total",
+                   "Bytes sent.", offsetof(struct sr_stats_if, tx_bytes));
+
+    sr_metrics_head(fp, "sr_drops_total", "counter", "Frames dropped.");
+    for (i = 0; i < SR_DROPS; i++)
+    {
+        fprintf(fp, "sr_drops_total{reason=\"%s\"} %lu\n", sr_drop_names[i],
+                sum.drops[i]);
+    }
+
+    sr_metrics_head(fp, "sr_latency_seconds", "summary",
+                    "Forwarding latency, see -o latency.");
+    for (i = 0; i < SR_LATS; i++)
+    {
+        const unsigned long* h = sum.lat[i];
+        unsigned long n = sr_hist_count(h);
+
+        if (!n)
+        { continue; }
+        for (j = 0; j < SR_METRICS_QUANTILES; j++)
+        {
+            fprintf(fp, "sr_latency_seconds{what=\"%s\",quantile=\"%g\"} "
+                    "%.9f\n", sr_lat_names[i], sr_metrics_quantiles[j],
+                    sr_hist_percentile(h, sr_metrics_quantiles[j]) / 1e9);
+        }
+        fprintf(fp, "sr_latency_seconds_sum{what=\"%s\"} %.9f\n",
+                sr_lat_names[i], sum.lat_ns[i] / 1e9);
+        fprintf(fp, "sr_latency_seconds_count{what=\"%s\"} %lu\n",
+                sr_lat_names[i], n);
+    }
+
+    /* -- per instance -- */
+    pthread_mutex_lock(&sr_metrics_lock);
+
+    sr_metrics_head(fp, "sr_arp_cache_entries", "gauge",
+                    "Valid ARP cache entries.");
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        struct sr_arpcache* cache = &sr_metrics_insts[i]->cache;
+        int valid = 0;
+
+        for (j = 0; j < SR_ARPCACHE_SZ; j++)
+        {
+            if (__atomic_load_n(&cache->entries[j].valid, __ATOMIC_RELAXED))
+            { valid++; }
+        }
+        fprintf(fp, "sr_arp_cache_entries{router=\"%s\"} %d\n",
+                sr_metrics_insts[i]->host, valid);
+    }
+
+    sr_metrics_head(fp, "sr_arp_cache_capacity", "gauge",
+                    "ARP cache entries there is room for.");
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        fprintf(fp, "sr_arp_cache_capacity{router=\"%s\"} %d\n",
+                sr_metrics_insts[i]->host, SR_ARPCACHE_SZ);
+    }
+
+    sr_metrics_head(fp, "sr_arp_pending_requests", "gauge",
+                    "Next hops waiting for an ARP reply.");
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        struct sr_arpcache* cache = &sr_metrics_insts[i]->cache;
+
+        fprintf(fp, "sr_arp_pending_requests{router=\"%s\"} %u\n",
+                sr_metrics_insts[i]->host,
+                __atomic_load_n(&cache->pending_reqs, __ATOMIC_RELAXED));
+    }
+
+    sr_metrics_head(fp, "sr_arp_pending_packets", "gauge",
+                    "Frames queued on unresolved next hops.");
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        struct sr_arpcache* cache = &sr_metrics_insts[i]->cache;
+
+        fprintf(fp, "sr_arp_pending_packets{router=\"%s\"} %lu\n",
+                sr_metrics_insts[i]->host,
+                __atomic_load_n(&cache->pending_pkts, __ATOMIC_RELAXED));
+    }
+
+    sr_metrics_head(fp, "sr_arp_queue_overflows_total", "counter",
+                    "Frames refused because a next hop's queue was full.");
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        struct sr_arpcache* cache = &sr_metrics_insts[i]->cache;
+
+        fprintf(fp, "sr_arp_queue_overflows_total{router=\"%s\"} %lu\n",
+                sr_metrics_insts[i]->host,
+                __atomic_load_n(&cache->overflows, __ATOMIC_RELAXED));
+    }
+
+    /* -- routing tables are only loaded before forwarding starts -- */
+    sr_metrics_head(fp, "sr_routes", "gauge", "Routing table entries.");
+    for (i = 0; i < sr_metrics_ninsts; i++)
+    {
+        struct sr_rt* rt;
+        int n = 0;
+
+        for (rt = sr_metrics_insts[i]->routing_table; rt; rt = rt->next)
+        { n++; }
+        fprintf(fp, "sr_routes{router=\"%s\"} %d\n",
+                sr_metrics_insts[i]->host, n);
+    }
+
+    pthread_mutex_unlock(&sr_metrics_lock);
+
+    sr_metrics_head(fp, "sr_memory_objects", "gauge",
+                    "Buffers allocated, by pool.");
+    for (i = 0; i < SR_MEM_KINDS; i++)
+    {
+        fprintf(fp, "sr_memory_objects{pool=\"%s\"} %ld\n", sr_mem_name(i),
+                sr_mem_live(i));
+    }
+    sr_metrics_head(fp, "sr_memory_bytes", "gauge",
+                    "Bytes allocated, by pool.");
+    for (i = 0; i < SR_MEM_KINDS; i++)
+    {
+        fprintf(fp, "sr_memory_bytes{pool=\"%s\"} %lu\n", sr_mem_name(i),
+                sr_mem_bytes(i));
+    }
+    sr_metrics_head(fp, "sr_memory_peak_bytes", "gauge",
+                    "Most bytes ever allocated at once, by pool.");
+    for (i = 0; i < SR_MEM_KINDS; i++)
+    {
+        fprintf(fp, "sr_memory_peak_bytes{pool=\"%s\"} %lu\n", sr_mem_name(i),
+                sr_mem_peak(i));
+    }
+} /* -- sr_metrics_render -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_respond(..)
+ * Scope: Local
+ *
+ * Called once c's request headers are in; sets c->out.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_metrics_respond(struct sr_metrics_client* c)
+{
+    char* body = 0;
+    size_t body_len = 0;
+    const char* status = "200 OK";
+    FILE* fp;
+
+    if (strncmp(c->req, "GET ", 4) != 0)
+    { status = "405 Method Not Allowed"; }
+    else if (strncmp(c->req + 4, "/metrics ", 9) != 0 &&
+             strncmp(c->req + 4, "/ ", 2) != 0)
+    { status = "404 Not Found"; }
+
+    fp = open_memstream(&body, &body_len);
+    if (!fp)
+    {
+        c->out_len = 0;
+        return;
+    }
+    if (status[0] == '2')
+    { sr_metrics_render(fp); }
+    else
+    { fprintf(fp, "%s\n", status); }
+    fclose(fp);
+
+    c->out_len = asprintf(&c->out, "HTTP/1.0 %s\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %lu\r\n"
+                          "Connection: close\r\n\r\n%s",
+                          status, (unsigned long)body_len, body);
+    if ((int)c->out_len < 0)
+    {
+        c->out = 0;
+        c->out_len = 0;
+    }
+    free(body);
+} /* -- sr_metrics_respond -- */
+
+static void sr_metrics_close(struct sr_metrics_client* c)
+{
+    close(c->fd);
+    free(c->out);
+    c->fd = -1;
+    c->out = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_serve(..)
+ * Scope: Local
+ *
+ * Read what c sent, or write it what is left of its response; closes
+ * c when it is done or gone.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_metrics_serve(struct sr_metrics_client* c)
+{
+    ssize_t n;
+
+    if (!c->out)
+    {
+        n = read(c->fd, c->req + c->req_len,
+                 sizeof(c->req) - 1 - c->req_len);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        { return; }
+        if (n <= 0)
+        {
+            sr_metrics_close(c);
+            return;
+        }
+        c->req_len += n;
+        c->req[c->req_len] = 0;
+
+        if (!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n") &&
+            c->req_len < sizeof(c->req) - 1)
+        { return; }
+
+        sr_metrics_respond(c);
+        if (!c->out)
+        {
+            sr_metrics_close(c);
+            return;
+        }
+    }
+
+    n = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    { return; }
+    if (n < 0 || (c->out_sent += n) == c->out_len)
+    { sr_metrics_close(c); }
+} /* -- sr_metrics_serve -- */
+
+static void sr_metrics_accept(void)
+{
+    int fd, i;
+
+    while ((fd = accept(sr_metrics_fd, 0, 0)) >= 0)
+    {
+        for (i = 0; i < SR_METRICS_CLIENTS; i++)
+        {
+            if (sr_metrics_clients[i].fd < 0)
+            { break; }
+        }
+        if (i == SR_METRICS_CLIENTS)
+        {
+            sr_log_warn(SR_LOG_CORE, "metrics: %d clients already, "
+                        "turning one away", SR_METRICS_CLIENTS);
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        sr_metrics_clients[i].fd = fd;
+        sr_metrics_clients[i].since = time(0);
+        sr_metrics_clients[i].req_len = 0;
+        sr_metrics_clients[i].out_sent = 0;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_main(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void* sr_metrics_main(void* arg)
+{
+    struct pollfd fds[SR_METRICS_CLIENTS + 1];
+    int who[SR_METRICS_CLIENTS + 1];
+    int nfds, i;
+
+    sr_conf_pin("cpu_log", -1);
+
+    while (!__atomic_load_n(&sr_metrics_stopping, __ATOMIC_ACQUIRE))
+    {
+        time_t now = time(0);
+
+        fds[0].fd = sr_metrics_fd;
+        fds[0].events = POLLIN;
+        nfds = 1;
+        for (i = 0; i < SR_METRICS_CLIENTS; i++)
+        {
+            struct sr_metrics_client* c = &sr_metrics_clients[i];
+
+            if (c->fd < 0)
+            { continue; }
+            if (now - c->since > SR_METRICS_TIMEOUT)
+            {
+                sr_metrics_close(c);
+                continue;
+            }
+            fds[nfds].fd = c->fd;
+            fds[nfds].events = c->out ? POLLOUT : POLLIN;
+            who[nfds++] = i;
+        }
+
+        if (poll(fds, nfds, SR_METRICS_POLL) <= 0)
+        { continue; }
+
+        for (i = 1; i < nfds; i++)
+        {
+            if (fds[i].revents)
+            { sr_metrics_serve(&sr_metrics_clients[who[i]]); }
+        }
+        if (fds[0].revents & POLLIN)
+        { sr_metrics_accept(); }
+    }
+
+    for (i = 0; i < SR_METRICS_CLIENTS; i++)
+    {
+        if (sr_metrics_clients[i].fd >= 0)
+        { sr_metrics_close(&sr_metrics_clients[i]); }
+    }
+    return 0;
+} /* -- sr_metrics_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_listen(..)
+ * Scope: Local
+ *
+ * A listening socket for addr, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_metrics_listen(const char* addr)
+{
+    int fd, one = 1;
+
+    if (strchr(addr, '/'))
+    {
+        struct sockaddr_un un;
+
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(addr) >= sizeof(un.sun_path))
+        {
+            fprintf(stderr, "-o metrics=%s: path too long\n", addr);
+            return -1;
+        }
+        strcpy(un.sun_path, addr);
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        {
+            perror("socket(..):sr_metrics.c::sr_metrics_listen");
+            return -1;
+        }
+        unlink(addr);
+        if (bind(fd, (struct sockaddr*)&un, sizeof(un)) != 0)
+        {
+            fprintf(stderr, "-o metrics=%s: %s\n", addr, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        strcpy(sr_metrics_path, addr);
+    }
+    else
+    {
+        struct sockaddr_in sin;
+        const char* colon = strchr(addr, ':');
+        char host[64] = "127.0.0.1";
+        long port;
+        char* end;
+
+        if (colon)
+        {
+            if (colon - addr >= sizeof(host))
+            {
+                fprintf(stderr, "-o metrics=%s: bad host\n", addr);
+                return -1;
+            }
+            memcpy(host, addr, colon - addr);
+            host[colon - addr] = 0;
+        }
+        port = strtol(colon ? colon + 1 : addr, &end, 10);
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        if (*end || port <= 0 || port > 65535 ||
+            inet_pton(AF_INET, host, &sin.sin_addr) != 1)
+        {
+            fprintf(stderr, "-o metrics=%s: expected [host:]port or a "
+                    "socket path\n", addr);
+            return -1;
+        }
+
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        {
+            perror("socket(..):sr_metrics.c::sr_metrics_listen");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) != 0)
+        {
+            fprintf(stderr, "-o metrics=%s: %s\n", addr, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, SR_METRICS_CLIENTS) != 0)
+    {
+        perror("listen(..):sr_metrics.c::sr_metrics_listen");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+} /* -- sr_metrics_listen -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_metrics_start(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+int sr_metrics_start(void)
+{
+    const char* addr = sr_conf_str("metrics", 0);
+    int i;
+
+    if (!addr || !*addr)
+    { return 0; }
+
+    if ((sr_metrics_fd = sr_metrics_listen(addr)) < 0)
+    { return -1; }
+
+    for (i = 0; i < SR_METRICS_CLIENTS; i++)
+    { sr_metrics_clients[i].fd = -1; }
+
+    if (pthread_create(&sr_metrics_thread, 0, sr_metrics_main, 0) != 0)
+    {
+        perror("pthread_create(..):sr_metrics.c::sr_metrics_start");
+        close(sr_metrics_fd);
+        return -1;
+    }
+    sr_metrics_running = 1;
+
+    sr_log_info(SR_LOG_CORE, "metrics on %s", addr);
+    return 0;
+} /* -- sr_metrics_start -- */
+
+void sr_metrics_stop(void)
+{
+    if (!sr_metrics_running)
+    { return; }
+
+    __atomic_store_n(&sr_metrics_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(sr_metrics_thread, 0);
+    close(sr_metrics_fd);
+    if (sr_metrics_path[0])
+    { unlink(sr_metrics_path); }
+    sr_metrics_running = 0;
+} /* -- sr_metrics_stop -- */
@@ -0,0 +1,44 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_metrics.h
+ *
+ * Description:
+ *
+ * Metrics endpoint (-o metrics=ADDR).  A thread of its own answers
+ * HTTP GET /metrics with the counters in the Prometheus text format:
+ *
+ *   sr_interface_{rx,tx}_{packets,bytes}_total   sr_stats.h
+ *   sr_drops_total{reason}
+ *   sr_latency_seconds{what}   summary: p50, p90, p99, p99.9, sum, count
+ *   sr_arp_cache_entries       valid entries, of sr_arp_cache_capacity
+ *   sr_arp_pending_requests    next hops being resolved
+ *   sr_arp_pending_packets     frames queued on them
+ *   sr_arp_queue_overflows_total
+ *   sr_routes                  routing table entries
+ *   sr_memory_{objects,bytes,peak_bytes}{pool}   sr_mem.h
+ *
+ * ADDR is [host:]port, host 127.0.0.1 by default, or with a '/' in it
+ * the path of a Unix socket (curl --unix-socket PATH http://x/metrics).
+ *
+ * Scrapes only read: counters with relaxed loads, the ARP cache without
+ * its lock.  The forwarding threads never wait on this one.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_METRICS_H
+#define SR_METRICS_H
+
+#define SR_METRICS_CLIENTS  8     /* connections served at once */
+#define SR_METRICS_TIMEOUT  5     /* secs a client has to send a request */
+
+struct sr_instance;
+
+/* listen on -o metrics; 0 also when it isn't set, -1 if the address
+   can't be bound */
+int  sr_metrics_start(void);
+void sr_metrics_stop(void);
+
+/* export sr until it is removed; sr_destroy_instance() removes it */
+void sr_metrics_add(struct sr_instance* sr);
+void sr_metrics_remove(struct sr_instance* sr);
+
+#endif /* -- SR_METRICS_H -- */
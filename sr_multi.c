@@ -0,0 +1,376 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_multi.c
+ *
+ * Description:
+ *
+ * Multi-instance mode (sr -C config): one process hosts a virtual router
+ * for every line of the config, each with its own VNS session or data path
+ * backend.  Instead of a thread pair per router, the instances are
+ * sharded over a fixed pool of worker threads that each poll() the
+ * sessions of their instances, a single timer thread drives the ARP
+ * caches of all of them, and identical routing tables are shared (see
+ * sr_rt_share()).
+ *
+ * Config format, one virtual router per line ('#' starts a comment):
+ *
+ *     <host> [key=value ...]
+ *     vhost1  server=localhost port=8888 rtable=rtable.1
+ *     vhost2  backend=packet ifconfig=ifs.2 rtable=rtable.2
+ *
+ * with the keys server, port, topo, user, rtable, template, log,
+ * backend, ifconfig (the long names of -s -p -t -u -r -T -l -B -I);
+ * anything not given is taken from the command line.  Backends have to
+ * provide pollfds to share a worker, so replay and shm are not available.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "sr_backend.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_conf.h"
+#include "sr_log.h"
+#include "sr_metrics.h"
+
+#define SR_MULTI_MAX_INSTANCES 1024
+#define SR_MULTI_MAX_FDS       256    /* descriptors polled per worker */
+#define SR_MULTI_POLL_MS       100
+
+struct sr_multi
+{
+    struct sr_instance* insts;
+    int* live;                 /* 0 once an instance's session has ended */
+    int ninsts;
+    int nworkers;
+    int nlive;
+    pthread_mutex_t lock;      /* orders the ARP timer with instance teardown */
+};
+
+struct sr_multi_worker
+{
+    pthread_t thread;
+    int id;                    /* serves instances id, id + nworkers, ... */
+    struct sr_multi* m;
+};
+
+static const struct
+{
+    const char* key;
+    int opt;
+} sr_multi_keys[] =
+{
+    { "server", 's' }, { "port", 'p' }, { "topo", 't' }, { "user", 'u' },
+    { "rtable", 'r' }, { "template", 'T' }, { "log", 'l' },
+    { "backend", 'B' }, { "ifconfig", 'I' }, { 0, 0 }
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_multi_parse_line(..)
+ * Scope: Local
+ *
+ * Fill opts (preset with the command line settings) from one config
+ * line.  Returns 1 for an instance, 0 for a blank line, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_multi_parse_line(char* line, int lineno, struct sr_options* opts)
+{
+    char* save = 0;
+    char* tok;
+    char* hash;
+
+    if ((hash = strchr(line, '#')))
+    { *hash = '\0'; }
+
+    if (!(tok = strtok_r(line, " \t\r\n", &save)))
+    { return 0; }
+    opts->host = strdup(tok);
+
+    while ((tok = strtok_r(0, " \t\r\n", &save)))
+    {
+        char* eq = strchr(tok, '=');
+        int k;
+
+        if (!eq)
+        {
+            fprintf(stderr, "config line %d: expected key=value, got %s\n",
+                    lineno, tok);
+            return -1;
+        }
+        *eq = '\0';
+
+        for (k = 0; sr_multi_keys[k].key; k++)
+        {
+            if (strcmp(sr_multi_keys[k].key, tok) == 0)
+            { break; }
+        }
+        if (!sr_multi_keys[k].key)
+        {
+            fprintf(stderr, "config line %d: unknown key %s\n", lineno, tok);
+            return -1;
+        }
+        sr_parse_option(opts, sr_multi_keys[k].opt, strdup(eq + 1));
+    }
+
+    if (opts->backend && (strcmp(opts->backend, "replay") == 0 ||
+                          strcmp(opts->backend, "shm") == 0))
+    {
+        fprintf(stderr, "config line %d: the %s backend cannot share a "
+                "worker thread\n", lineno, opts->backend);
+        return -1;
+    }
+
+    return 1;
+} /* -- sr_multi_parse_line -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_multi_retire(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void sr_multi_retire(struct sr_multi* m, int i)
+{
+    struct sr_instance* sr = &m->insts[i];
+
+    pthread_mutex_lock(&m->lock);
+    m->live[i] = 0;
+    m->nlive--;
+    printf("instance %s done\n", sr->host);
+    sr_destroy_instance(sr);
+    pthread_mutex_unlock(&m->lock);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_multi_worker(..)
+ * Scope: Local
+ *
+ * Worker thread body: wait on the descriptors of every live instance
+ * of this shard and service each instance that has work with one
+ * sr_read_from_server() call, until all of them are done.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_multi_worker(void* arg)
+{
+    struct sr_multi_worker* w = arg;
+    struct sr_multi* m = w->m;
+    struct pollfd pfds[SR_MULTI_MAX_FDS];
+    int owner[SR_MULTI_MAX_FDS];
+    int i, k, n, live = 0;
+
+    sr_conf_pin("cpu_workers", w->id);
+
+    for (i = w->id; i < m->ninsts; i += m->nworkers)
+    { live++; }
+
+    while (live > 0)
+    {
+        n = 0;
+        for (i = w->id; i < m->ninsts; i += m->nworkers)
+        {
+            struct sr_instance* sr = &m->insts[i];
+            int first = n;
+
+            if (!m->live[i])
+            { continue; }
+
+            if (sr->backend)
+            { n += sr->backend->pollfds(sr, pfds + n, SR_MULTI_MAX_FDS - n); }
+            else if (n < SR_MULTI_MAX_FDS)
+            {
+                pfds[n].fd = sr->sockfd;
+                pfds[n].events = POLLIN;
+                n++;
+            }
+
+            for (k = first; k < n; k++)
+            { owner[k] = i; }
+        }
+
+        if ((k = poll(pfds, n, SR_MULTI_POLL_MS)) <= 0)
+        {
+            if (k < 0 && errno != EINTR)
+            { sr_log_err(SR_LOG_CORE, "sr_multi_worker: poll: %s", strerror(errno)); }
+            continue;
+        }
+
+        for (k = 0; k < n; k++)
+        {
+            i = owner[k];
+            if (!(pfds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+            { continue; }
+
+            /* -- one pass per instance, however many of its fds are ready -- */
+            while (k + 1 < n && owner[k + 1] == i)
+            { k++; }
+
+            if (sr_read_from_server(&m->insts[i]) != 1)
+            {
+                sr_multi_retire(m, i);
+                live--;
+            }
+        }
+    }
+
+    return 0;
+} /* -- sr_multi_worker -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_multi_arp_timer(..)
+ * Scope: Local
+ *
+ * The one ARP timer of the process, see sr_arpcache_timeout().
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_multi_arp_timer(void* arg)
+{
+    struct sr_multi* m = arg;
+    int i;
+
+    sr_conf_pin("cpu_arp", -1);
+
+    while (1)
+    {
+        sleep(1);
+
+        pthread_mutex_lock(&m->lock);
+        if (m->nlive == 0)
+        {
+            pthread_mutex_unlock(&m->lock);
+            break;
+        }
+        for (i = 0; i < m->ninsts; i++)
+        {
+            if (m->live[i])
+            { sr_arpcache_tick(&m->insts[i]); }
+        }
+        pthread_mutex_unlock(&m->lock);
+    }
+
+    return 0;
+} /* -- sr_multi_arp_timer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_multi_run(..)
+ * Scope: Global
+ *
+ * Bring up every instance of the config, one after the other, then
+ * serve them on worker threads (one per CPU when workers is 0) until
+ * all sessions have ended.
+ *
+ * RETURN VALUES:
+ *
+ *  0 when every session ended normally
+ *  1 on a startup error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_multi_run(const char* config, struct sr_options* defaults, int workers)
+{
+    struct sr_multi m;
+    struct sr_multi_worker* pool;
+    pthread_t timer;
+    char line[BUFSIZ];
+    FILE* fp;
+    int i, lineno = 0;
+
+    /* REQUIRES */
+    assert(config);
+    assert(defaults);
+
+    if (!(fp = fopen(config, "r")))
+    {
+        perror("fopen(..):sr_multi.c::sr_multi_run");
+        return 1;
+    }
+
+    memset(&m, 0, sizeof(m));
+    m.insts = (struct sr_instance*)calloc(SR_MULTI_MAX_INSTANCES,
+                                          sizeof(struct sr_instance));
+    m.live = (int*)calloc(SR_MULTI_MAX_INSTANCES, sizeof(int));
+    assert(m.insts && m.live);
+    pthread_mutex_init(&m.lock, 0);
+
+    while (fgets(line, BUFSIZ, fp))
+    {
+        struct sr_options opts = *defaults;
+        struct sr_instance* sr;
+        int ret;
+
+        if ((ret = sr_multi_parse_line(line, ++lineno, &opts)) == 0)
+        { continue; }
+        if (ret < 0 || m.ninsts == SR_MULTI_MAX_INSTANCES)
+        {
+            if (ret > 0)
+            { fprintf(stderr, "too many instances in %s\n", config); }
+            fclose(fp);
+            return 1;
+        }
+
+        sr = &m.insts[m.ninsts];
+        sr_init_instance(sr);
+        printf("-- instance %d: %s --\n", m.ninsts, opts.host);
+        if (sr_setup_instance(sr, &opts) != 0)
+        {
+            fprintf(stderr, "config line %d: instance %s failed to start\n",
+                    lineno, opts.host);
+            fclose(fp);
+            return 1;
+        }
+        sr_init_state(sr);
+        sr->routing_table = sr_rt_share(sr->routing_table);
+        sr_metrics_add(sr);
+
+        m.live[m.ninsts++] = 1;
+    }
+    fclose(fp);
+
+    if (m.ninsts == 0)
+    {
+        fprintf(stderr, "no instances in %s\n", config);
+        return 1;
+    }
+    m.nlive = m.ninsts;
+
+    if (workers <= 0)
+    { workers = sysconf(_SC_NPROCESSORS_ONLN); }
+    if (workers <= 0)
+    { workers = 1; }
+    if (workers > m.ninsts)
+    { workers = m.ninsts; }
+    m.nworkers = workers;
+
+    printf("%d instances on %d worker threads, %d distinct routing tables\n",
+           m.ninsts, m.nworkers, sr_rt_shared_count());
+
+    pthread_create(&timer, 0, sr_multi_arp_timer, &m);
+
+    pool = (struct sr_multi_worker*)calloc(workers,
+                                           sizeof(struct sr_multi_worker));
+    assert(pool);
+    for (i = 0; i < workers; i++)
+    {
+        pool[i].id = i;
+        pool[i].m = &m;
+        pthread_create(&pool[i].thread, 0, sr_multi_worker, &pool[i]);
+    }
+    for (i = 0; i < workers; i++)
+    { pthread_join(pool[i].thread, 0); }
+    pthread_join(timer, 0);
+
+    free(pool);
+    free(m.live);
+    free(m.insts);
+    pthread_mutex_destroy(&m.lock);
+
+    return 0;
+} /* -- sr_multi_run -- */
@@ -0,0 +1,532 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.c
+ *
+ * Description:
+ *
+ * Multi-threaded forwarding pipeline (-o pipeline=N).  Without it every
+ * frame is read, routed and written on the one thread that runs the
+ * sr_read_from_server() loop.  With it that thread only does the RX
+ * stage: it parses the session (or polls the backend), logs the frame
+ * and hands a copy to one of N worker threads, which run
+ * sr_handlepacket().  Frames the workers send are queued to a single TX
+ * thread that does all writes, so the session socket never sees two
+ * writers.
+ *
+ *     RX --rx ring--> worker i --tx ring--> TX
+ *
+ * Like RSS on a NIC, the RX stage picks the worker from a Toeplitz hash
+ * of the IP 5-tuple through an indirection table, so every packet of a
+ * TCP/UDP flow is handled by the same worker and leaves in order.  ARP,
+ * ICMP and anything that is not IP go to the control worker (worker 0),
+ * which thereby sees all ARP replies and ICMP in arrival order.  Each
+ * worker keeps its own route and ARP caches (sr_fcache.h).
+ *
+ * Every ring is SPSC (sr_ring.h), one pair per worker.  Threads that are
+ * not workers (the RX thread answering on the session, the ARP timer)
+ * write directly, serialized with the TX thread by sr->send_lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sr_ring.h"
+#include "sr_fcache.h"
+#include "sr_punt.h"
+#include "sr_conf.h"
+#include "sr_mem.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_stats.h"
+
+#define SR_PIPE_TX_BATCH  32     /* frames written per send_lock hold */
+#define SR_PIPE_WAIT_MS   100
+#define SR_PIPE_RETA      128    /* indirection table entries, power of two */
+#define SR_PIPE_CTL       0      /* the control worker */
+
+/* -- hash input: src, dst, sport, dport (as on the wire), protocol -- */
+#define SR_RSS_TUPLE      13
+
+/* -- a frame in flight between two stages -- */
+struct sr_pipe_pkt
+{
+    uint64_t rx_ns;                /* sr_stats_rx_ns of the RX stage */
+    unsigned int len;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+#define SR_PIPE_DATA(p) ((uint8_t*)((p) + 1))
+
+struct sr_pipe_worker
+{
+    pthread_t thread;
+    int id;
+    struct sr_pipeline* pipe;
+    struct sr_ring* rx;            /* from the RX thread */
+    struct sr_ring* tx;            /* to the TX thread */
+    struct sr_ring_bell bell;
+    unsigned long handled;
+
+    /* -- only ever touched by the worker itself -- */
+    struct sr_fcache fcache __attribute__ ((aligned(SR_RING_CACHELINE)));
+};
+
+struct sr_pipeline
+{
+    struct sr_instance* sr;
+    int nworkers;
+    struct sr_pipe_worker* workers;
+    unsigned char reta[SR_PIPE_RETA];  /* hash -> worker */
+    unsigned long steered_ctl;     /* frames sent to the control worker */
+    int stop;                      /* workers drain and exit */
+
+    pthread_t tx_thread;
+    struct sr_ring_bell tx_bell;
+    struct sr_ring** tx_rings;
+    int tx_stop;
+    unsigned long tx_sent;
+    unsigned long tx_errors;
+};
+
+/* -- the worker the calling thread is, 0 for any other thread -- */
+static __thread struct sr_pipe_worker* sr_pipe_self = 0;
+
+/* -- the key from Microsoft's RSS verification suite, used by most NICs -- */
+static const uint8_t sr_rss_key[40] =
+{
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+/* -- per input byte and value, the XOR of the key windows it selects -- */
+static uint32_t sr_rss_tbl[SR_RSS_TUPLE][256];
+static pthread_once_t sr_rss_once = PTHREAD_ONCE_INIT;
+
+/*---------------------------------------------------------------------
+ * Method: sr_rss_init(..)
+ * Scope: Local
+ *
+ * Toeplitz hashing XORs in the 32 key bits starting at bit i for every
+ * set bit i of the input; precompute that a byte at a time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rss_init(void)
+{
+    int pos, bit, v;
+
+    for (pos = 0; pos < SR_RSS_TUPLE; pos++)
+    {
+        uint32_t window[8];
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            int k = pos * 8 + bit;
+            uint64_t w = 0;
+            int b;
+
+            for (b = 0; b < 5; b++)
+            { w = (w << 8) | sr_rss_key[k / 8 + b]; }
+            window[bit] = (uint32_t)(w >> (8 - k % 8));
+        }
+
+        for (v = 0; v < 256; v++)
+        {
+            uint32_t h = 0;
+
+            for (bit = 0; bit < 8; bit++)
+            {
+                if (v & (0x80 >> bit))
+                { h ^= window[bit]; }
+            }
+            sr_rss_tbl[pos][v] = h;
+        }
+    }
+} /* -- sr_rss_init -- */
+
+static __inline__ uint32_t sr_rss_hash(const uint8_t* tuple)
+{
+    uint32_t h = 0;
+    int i;
+
+    for (i = 0; i < SR_RSS_TUPLE; i++)
+    { h ^= sr_rss_tbl[i][tuple[i]]; }
+    return h;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_steer(..)
+ * Scope: Local
+ *
+ * Pick the worker for a frame.  Fragments are hashed without ports
+ * (only the first one carries them) so a datagram stays on one worker.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pipeline_steer(struct sr_pipeline* pipe, uint8_t* packet,
+                             unsigned int len)
+{
+    uint8_t tuple[SR_RSS_TUPLE];
+    sr_ip_hdr_t* ip;
+    unsigned int hl;
+
+    ip = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+        ethertype(packet) != ethertype_ip || ip->ip_p == ip_protocol_icmp)
+    {
+        pipe->steered_ctl++;
+        return SR_PIPE_CTL;
+    }
+
+    memset(tuple, 0, sizeof(tuple));
+    memcpy(tuple, &ip->ip_src, 4);
+    memcpy(tuple + 4, &ip->ip_dst, 4);
+    tuple[12] = ip->ip_p;
+
+    hl = ip->ip_hl * 4;
+    if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+        !(ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) &&
+        len >= sizeof(sr_ethernet_hdr_t) + hl + 4)
+    { memcpy(tuple + 8, (uint8_t*)ip + hl, 4); }
+
+    return pipe->reta[sr_rss_hash(tuple) & (SR_PIPE_RETA - 1)];
+} /* -- sr_pipeline_steer -- */
+
+static struct sr_pipe_pkt* sr_pipe_pkt_new(enum sr_mem_kind kind, uint8_t* buf,
+                                           unsigned int len, const char* iface)
+{
+    struct sr_pipe_pkt* p = (struct sr_pipe_pkt*)sr_mem_alloc(kind, sizeof(*p) + len);
+    assert(p);
+    p->rx_ns = sr_stats_rx_ns;
+    p->len = len;
+    strncpy(p->iface, iface, sr_IFACE_NAMELEN);
+    memcpy(SR_PIPE_DATA(p), buf, len);
+    return p;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_worker(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void* sr_pipeline_worker(void* arg)
+{
+    struct sr_pipe_worker* w = arg;
+    struct sr_instance* sr = w->pipe->sr;
+    struct sr_pipe_pkt* p;
+
+    sr_pipe_self = w;
+    sr_conf_pin("cpu_workers", w->id);
+
+    while (1)
+    {
+        int n = 0;
+
+        while ((p = sr_ring_pop(w->rx)))
+        {
+            sr_stats_rx_ns = p->rx_ns;
+            sr_handlepacket(sr, SR_PIPE_DATA(p), p->len, p->iface);
+            sr_mem_free(p);
+            n++;
+        }
+        w->handled += n;
+
+        if (n)
+        { continue; }
+        if (__atomic_load_n(&w->pipe->stop, __ATOMIC_ACQUIRE))
+        { break; }
+        sr_ring_bell_wait(&w->bell, &w->rx, 1, SR_PIPE_WAIT_MS);
+    }
+
+    return 0;
+} /* -- sr_pipeline_worker -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_txer(..)
+ * Scope: Local
+ *
+ * TX thread body: write out what the workers queued, a batch per ring
+ * at a time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_pipeline_txer(void* arg)
+{
+    struct sr_pipeline* pipe = arg;
+    struct sr_instance* sr = pipe->sr;
+    struct sr_pipe_pkt* p;
+    int i;
+
+    sr_conf_pin("cpu_tx", -1);
+
+    while (1)
+    {
+        int n = 0;
+
+        for (i = 0; i < pipe->nworkers; i++)
+        {
+            int b;
+
+            if (!sr_ring_count(pipe->tx_rings[i]))
+            { continue; }
+
+            pthread_mutex_lock(&sr->send_lock);
+            for (b = 0; b < SR_PIPE_TX_BATCH &&
+                        (p = sr_ring_pop(pipe->tx_rings[i])); b++)
+            {
+                if (sr_send_packet_direct(sr, SR_PIPE_DATA(p), p->len,
+                                          p->iface) == 0)
+                { pipe->tx_sent++; }
+                else
+                { pipe->tx_errors++; }
+                sr_mem_free(p);
+            }
+            pthread_mutex_unlock(&sr->send_lock);
+            n += b;
+        }
+
+        if (n)
+        { continue; }
+        if (__atomic_load_n(&pipe->tx_stop, __ATOMIC_ACQUIRE))
+        { break; }
+        sr_ring_bell_wait(&pipe->tx_bell, pipe->tx_rings, pipe->nworkers,
+                          SR_PIPE_WAIT_MS);
+    }
+
+    return 0;
+} /* -- sr_pipeline_txer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_rx(..)
+ * Scope: Global
+ *
+ * RX stage, called from sr_receive_packet(): queue a copy of the frame
+ * to the worker of its flow, dropping it when that worker's ring is full.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_rx(struct sr_instance* sr, uint8_t* packet, unsigned int len,
+                    const char* iface)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    struct sr_pipe_worker* w;
+    struct sr_pipe_pkt* p;
+
+    /* -- with a punt path ARP skips the workers, so it never waits behind
+          (or is dropped with) a full ring of transit traffic -- */
+    if (len >= sizeof(sr_ethernet_hdr_t) && ethertype(packet) == ethertype_arp &&
+        sr_punt(sr, SR_PUNT_ARP, packet, len, iface))
+    { return; }
+
+    w = &pipe->workers[sr_pipeline_steer(pipe, packet, len)];
+    p = sr_pipe_pkt_new(SR_MEM_RX, packet, len, iface);
+
+    if (sr_ring_push(w->rx, p) != 0)
+    { sr_mem_free(p); }
+} /* -- sr_pipeline_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_tx(..)
+ * Scope: Global
+ *
+ * Called from sr_send_packet().  Workers queue the frame to the TX
+ * thread; everybody else writes it right away under sr->send_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_tx(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    struct sr_pipe_worker* w = sr_pipe_self;
+    struct sr_pipe_pkt* p;
+    int ret;
+
+    /* -- sr->pipeline may be torn down under us, so don't touch it here -- */
+    if (!w || w->pipe->sr != sr)
+    {
+        pthread_mutex_lock(&sr->send_lock);
+        ret = sr_send_packet_direct(sr, buf, len, iface);
+        pthread_mutex_unlock(&sr->send_lock);
+        return ret;
+    }
+
+    p = sr_pipe_pkt_new(SR_MEM_TX, buf, len, iface);
+    if (sr_ring_push(w->tx, p) != 0)
+    {
+        sr_mem_free(p);
+        return -1;
+    }
+    return 0;
+} /* -- sr_pipeline_tx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_fcache(..)
+ * Scope: Global
+ *
+ * The forwarding caches of the calling worker, or 0 when the caller is
+ * not a pipeline worker of sr and has to use the shared tables.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fcache* sr_pipeline_fcache(struct sr_instance* sr)
+{
+    struct sr_pipe_worker* w = sr_pipe_self;
+
+    if (!w || w->pipe->sr != sr)
+    { return 0; }
+    return &w->fcache;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_start(..)
+ * Scope: Global
+ *
+ * Start nworkers worker threads and the TX thread for sr.  The calling
+ * thread becomes the RX stage as soon as sr->pipeline is set.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_start(struct sr_instance* sr, int nworkers,
+                      unsigned int rx_ring, unsigned int tx_ring)
+{
+    struct sr_pipeline* pipe;
+    char name[SR_RING_NAMELEN];
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(nworkers > 0);
+
+    pthread_once(&sr_rss_once, sr_rss_init);
+
+    pipe = (struct sr_pipeline*)calloc(1, sizeof(struct sr_pipeline));
+    assert(pipe);
+    pipe->sr = sr;
+    pipe->nworkers = nworkers;
+    if (posix_memalign((void**)&pipe->workers, SR_RING_CACHELINE,
+                       nworkers * sizeof(struct sr_pipe_worker)) != 0)
+    { pipe->workers = 0; }
+    pipe->tx_rings = (struct sr_ring**)calloc(nworkers, sizeof(struct sr_ring*));
+    assert(pipe->workers && pipe->tx_rings);
+    memset(pipe->workers, 0, nworkers * sizeof(struct sr_pipe_worker));
+    sr_ring_bell_init(&pipe->tx_bell);
+
+    for (i = 0; i < SR_PIPE_RETA; i++)
+    { pipe->reta[i] = i % nworkers; }
+
+    for (i = 0; i < nworkers; i++)
+    {
+        struct sr_pipe_worker* w = &pipe->workers[i];
+
+        w->id = i;
+        w->pipe = pipe;
+        sr_fcache_init(&w->fcache);
+        sr_ring_bell_init(&w->bell);
+        snprintf(name, sizeof(name), "rx->worker%d", i);
+        w->rx = sr_ring_create(name, rx_ring, &w->bell);
+        snprintf(name, sizeof(name), "worker%d->tx", i);
+        w->tx = sr_ring_create(name, tx_ring, &pipe->tx_bell);
+        assert(w->rx && w->tx);
+        pipe->tx_rings[i] = w->tx;
+    }
+
+    for (i = 0; i < nworkers; i++)
+    {
+        if (pthread_create(&pipe->workers[i].thread, 0, sr_pipeline_worker,
+                           &pipe->workers[i]) != 0)
+        {
+            perror("pthread_create(..):sr_pipeline.c::sr_pipeline_start");
+            return -1;
+        }
+    }
+    if (pthread_create(&pipe->tx_thread, 0, sr_pipeline_txer, pipe) != 0)
+    {
+        perror("pthread_create(..):sr_pipeline.c::sr_pipeline_start");
+        return -1;
+    }
+
+    sr->pipeline = pipe;
+    printf("forwarding pipeline: %d workers, rx ring %u, tx ring %u\n",
+           nworkers, pipe->workers[0].rx->size, pipe->workers[0].tx->size);
+    return 0;
+} /* -- sr_pipeline_start -- */
+
+void sr_pipeline_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    int i;
+
+    if (!pipe)
+    { return; }
+
+    for (i = 0; i < pipe->nworkers; i++)
+    {
+        sr_ring_print_stats(pipe->workers[i].rx, fp);
+        sr_ring_print_stats(pipe->workers[i].tx, fp);
+    }
+    for (i = 0; i < pipe->nworkers; i++)
+    {
+        struct sr_pipe_worker* w = &pipe->workers[i];
+
+        fprintf(fp, "worker%d%s handled %lu  route cache %lu/%lu  "
+                "arp cache %lu/%lu  flushes %lu\n", i,
+                i == SR_PIPE_CTL ? " (control)" : "", w->handled,
+                w->fcache.rt_hits, w->fcache.rt_hits + w->fcache.rt_misses,
+                w->fcache.arp_hits, w->fcache.arp_hits + w->fcache.arp_misses,
+                w->fcache.flushes);
+    }
+    fprintf(fp, "steered to control %lu\n", pipe->steered_ctl);
+    fprintf(fp, "tx sent %lu errors %lu\n", pipe->tx_sent, pipe->tx_errors);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_stop(..)
+ * Scope: Global
+ *
+ * Drain the rings, stop the threads and fall back to inline forwarding.
+ * Called from the RX thread once it has stopped receiving.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_stop(struct sr_instance* sr)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    int i;
+
+    if (!pipe)
+    { return; }
+
+    __atomic_store_n(&pipe->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < pipe->nworkers; i++)
+    { sr_ring_bell_ring(&pipe->workers[i].bell); }
+    for (i = 0; i < pipe->nworkers; i++)
+    { pthread_join(pipe->workers[i].thread, 0); }
+
+    __atomic_store_n(&pipe->tx_stop, 1, __ATOMIC_RELEASE);
+    sr_ring_bell_ring(&pipe->tx_bell);
+    pthread_join(pipe->tx_thread, 0);
+
+    printf("forwarding pipeline statistics:\n");
+    sr_pipeline_print_stats(sr, stdout);
+
+    sr->pipeline = 0;
+
+    for (i = 0; i < pipe->nworkers; i++)
+    {
+        sr_ring_destroy(pipe->workers[i].rx);
+        sr_ring_destroy(pipe->workers[i].tx);
+        sr_ring_bell_destroy(&pipe->workers[i].bell);
+    }
+    sr_ring_bell_destroy(&pipe->tx_bell);
+    free(pipe->tx_rings);
+    free(pipe->workers);
+    free(pipe);
+} /* -- sr_pipeline_stop -- */
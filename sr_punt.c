@@ -0,0 +1,324 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_punt.c
+ *
+ * Description:
+ *
+ * Control-plane punt path, see sr_punt.h.
+ *
+ * Punted frames are copied into a job and pushed on an sr_ring; since
+ * any forwarding thread may punt, pushes are serialized by a mutex while
+ * the control thread pops without locking.  ARP, which forwarding itself
+ * depends on, has a ring of its own that is always served first, so a
+ * flood of ICMP work fills (and drops from) only the other ring.  The
+ * control thread runs the frame through sr_handlepacket() again, where
+ * sr_punt() now declines, so the slow path code is the same whether
+ * punting is on or off.
+ *
+ * The CPU budget is enforced per SR_PUNT_WINDOW_MS window of wall time:
+ * once the thread's CPU time in the window exceeds its share it sleeps
+ * until the next window, and the ring absorbs (or drops) what comes in.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_ring.h"
+#include "sr_punt.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_conf.h"
+#include "sr_mem.h"
+#include "sr_hist.h"
+
+#define SR_PUNT_WINDOW_MS   100
+#define SR_PUNT_CHECK_EVERY 8      /* jobs between looks at the CPU clock */
+#define SR_PUNT_WAIT_MS     100
+
+enum { SR_PUNT_HIGH, SR_PUNT_LOW, SR_PUNT_PRIOS };
+
+struct sr_punt_job
+{
+    enum sr_punt_kind kind;
+    uint32_t ip;                   /* SR_PUNT_ARPREQ */
+    unsigned int len;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+#define SR_PUNT_DATA(j) ((uint8_t*)((j) + 1))
+
+struct sr_punt
+{
+    struct sr_instance* sr;
+    struct sr_ring* rings[SR_PUNT_PRIOS];
+    struct sr_ring_bell bell;
+    pthread_mutex_t push_lock;     /* producers */
+    pthread_t thread;
+    int stop;
+
+    uint64_t budget_ns;            /* CPU time per window */
+    uint64_t win_start;            /* monotonic */
+    uint64_t win_cpu;              /* thread CPU time at win_start */
+
+    /* -- under push_lock -- */
+    unsigned long punted[SR_PUNT_KINDS];
+    unsigned long dropped[SR_PUNT_KINDS];
+
+    /* -- control thread only -- */
+    unsigned long handled;
+    unsigned long throttled;
+};
+
+static const char* sr_punt_names[SR_PUNT_KINDS] =
+{ "arp", "local", "ttl", "noroute", "arpreq" };
+
+/* -- set on the control thread, whose own punts are handled in place -- */
+static __thread struct sr_punt* sr_punt_self = 0;
+
+/*---------------------------------------------------------------------
+ * Method: sr_punt_throttle(..)
+ * Scope: Local
+ *
+ * Sleep out the rest of the window if the control thread has used up
+ * its CPU budget for it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_punt_throttle(struct sr_punt* punt)
+{
+    uint64_t now = sr_hist_now();
+    uint64_t cpu = sr_hist_clock(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t end = punt->win_start + SR_PUNT_WINDOW_MS * 1000000ULL;
+
+    if (now < end && cpu - punt->win_cpu >= punt->budget_ns)
+    {
+        struct timespec ts;
+
+        ts.tv_sec = (end - now) / 1000000000ULL;
+        ts.tv_nsec = (end - now) % 1000000000ULL;
+        nanosleep(&ts, 0);
+        punt->throttled++;
+        now = sr_hist_now();
+    }
+
+    if (now >= end)
+    {
+        punt->win_start = now;
+        punt->win_cpu = sr_hist_clock(CLOCK_THREAD_CPUTIME_ID);
+    }
+} /* -- sr_punt_throttle -- */
+
+static void sr_punt_handle(struct sr_punt* punt, struct sr_punt_job* j)
+{
+    struct sr_instance* sr = punt->sr;
+
+    if (j->kind == SR_PUNT_ARPREQ)
+    {
+        struct sr_if* iface = sr_get_interface(sr, j->iface);
+
+        if (iface)
+        { not_in_arp_sent(sr, j->ip, iface); }
+        return;
+    }
+
+    sr_handlepacket(sr, SR_PUNT_DATA(j), j->len, j->iface);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_punt_thread(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void* sr_punt_thread(void* arg)
+{
+    struct sr_punt* punt = arg;
+    struct sr_punt_job* j;
+    unsigned long n = 0;
+
+    sr_punt_self = punt;
+    sr_conf_pin("cpu_control", -1);
+    punt->win_start = sr_hist_now();
+    punt->win_cpu = sr_hist_clock(CLOCK_THREAD_CPUTIME_ID);
+
+    while (1)
+    {
+        /* -- one low priority job at a time, rechecking ARP in between -- */
+        if ((j = sr_ring_pop(punt->rings[SR_PUNT_HIGH])) ||
+            (j = sr_ring_pop(punt->rings[SR_PUNT_LOW])))
+        {
+            sr_punt_handle(punt, j);
+            sr_mem_free(j);
+            punt->handled++;
+            if (++n % SR_PUNT_CHECK_EVERY == 0)
+            { sr_punt_throttle(punt); }
+            continue;
+        }
+
+        if (__atomic_load_n(&punt->stop, __ATOMIC_ACQUIRE))
+        { break; }
+        sr_ring_bell_wait(&punt->bell, punt->rings, SR_PUNT_PRIOS,
+                          SR_PUNT_WAIT_MS);
+    }
+
+    return 0;
+} /* -- sr_punt_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_punt_push(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void sr_punt_push(struct sr_punt* punt, struct sr_punt_job* j)
+{
+    enum sr_punt_kind kind = j->kind;  /* j is the control thread's once pushed */
+    int prio = (kind == SR_PUNT_ARP || kind == SR_PUNT_ARPREQ) ? SR_PUNT_HIGH
+                                                               : SR_PUNT_LOW;
+    int ret;
+
+    pthread_mutex_lock(&punt->push_lock);
+    ret = sr_ring_push(punt->rings[prio], j);
+    if (ret == 0)
+    { punt->punted[kind]++; }
+    else
+    { punt->dropped[kind]++; }
+    pthread_mutex_unlock(&punt->push_lock);
+
+    if (ret != 0)
+    { sr_mem_free(j); }
+}
+
+int sr_punt(struct sr_instance* sr, enum sr_punt_kind kind, uint8_t* packet,
+            unsigned int len, const char* iface)
+{
+    struct sr_punt* punt = sr->punt;
+    struct sr_punt_job* j;
+
+    if (!punt || sr_punt_self == punt)
+    { return 0; }
+
+    j = (struct sr_punt_job*)sr_mem_alloc(SR_MEM_PUNT, sizeof(*j) + len);
+    assert(j);
+    j->kind = kind;
+    j->ip = 0;
+    j->len = len;
+    strncpy(j->iface, iface, sr_IFACE_NAMELEN);
+    memcpy(SR_PUNT_DATA(j), packet, len);
+
+    sr_punt_push(punt, j);
+    return 1;
+} /* -- sr_punt -- */
+
+int sr_punt_arpreq(struct sr_instance* sr, uint32_t ip, const char* iface)
+{
+    struct sr_punt* punt = sr->punt;
+    struct sr_punt_job* j;
+
+    if (!punt || sr_punt_self == punt)
+    { return 0; }
+
+    j = (struct sr_punt_job*)sr_mem_alloc(SR_MEM_PUNT, sizeof(*j));
+    assert(j);
+    j->kind = SR_PUNT_ARPREQ;
+    j->ip = ip;
+    j->len = 0;
+    strncpy(j->iface, iface, sr_IFACE_NAMELEN);
+
+    sr_punt_push(punt, j);
+    return 1;
+} /* -- sr_punt_arpreq -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_punt_start(..)
+ * Scope: Global
+ *
+ * Start the control thread with a ring of slots jobs, allowed cpu_pct
+ * percent of one CPU.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_punt_start(struct sr_instance* sr, unsigned int slots, int cpu_pct)
+{
+    struct sr_punt* punt;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (cpu_pct <= 0 || cpu_pct > 100)
+    { cpu_pct = 100; }
+
+    punt = (struct sr_punt*)calloc(1, sizeof(struct sr_punt));
+    assert(punt);
+    punt->sr = sr;
+    punt->budget_ns = SR_PUNT_WINDOW_MS * 1000000ULL * cpu_pct / 100;
+    pthread_mutex_init(&punt->push_lock, 0);
+    sr_ring_bell_init(&punt->bell);
+    punt->rings[SR_PUNT_HIGH] = sr_ring_create("punt arp", slots, &punt->bell);
+    punt->rings[SR_PUNT_LOW] = sr_ring_create("punt icmp", slots, &punt->bell);
+    assert(punt->rings[SR_PUNT_HIGH] && punt->rings[SR_PUNT_LOW]);
+
+    if (pthread_create(&punt->thread, 0, sr_punt_thread, punt) != 0)
+    {
+        perror("pthread_create(..):sr_punt.c::sr_punt_start");
+        return -1;
+    }
+
+    sr->punt = punt;
+    printf("control plane punt path: rings %u, %d%% of a CPU\n",
+           punt->rings[SR_PUNT_LOW]->size, cpu_pct);
+    return 0;
+} /* -- sr_punt_start -- */
+
+void sr_punt_print_stats(struct sr_instance* sr, FILE* fp)
+{
+    struct sr_punt* punt = sr->punt;
+    int k;
+
+    if (!punt)
+    { return; }
+
+    sr_ring_print_stats(punt->rings[SR_PUNT_HIGH], fp);
+    sr_ring_print_stats(punt->rings[SR_PUNT_LOW], fp);
+    for (k = 0; k < SR_PUNT_KINDS; k++)
+    {
+        fprintf(fp, "punt %-8s queued %10lu  dropped %lu\n", sr_punt_names[k],
+                punt->punted[k], punt->dropped[k]);
+    }
+    fprintf(fp, "control thread handled %lu, throttled %lu times\n",
+            punt->handled, punt->throttled);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_punt_stop(..)
+ * Scope: Global
+ *
+ * Let the control thread drain the ring and exit.  Nothing may punt any
+ * more, so stop the pipeline first.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_punt_stop(struct sr_instance* sr)
+{
+    struct sr_punt* punt = sr->punt;
+
+    if (!punt)
+    { return; }
+
+    __atomic_store_n(&punt->stop, 1, __ATOMIC_RELEASE);
+    sr_ring_bell_ring(&punt->bell);
+    pthread_join(punt->thread, 0);
+
+    printf("control plane statistics:\n");
+    sr_punt_print_stats(sr, stdout);
+
+    sr->punt = 0;
+
+    sr_ring_destroy(punt->rings[SR_PUNT_HIGH]);
+    sr_ring_destroy(punt->rings[SR_PUNT_LOW]);
+    sr_ring_bell_destroy(&punt->bell);
+    pthread_mutex_destroy(&punt->push_lock);
+    free(punt);
+} /* -- sr_punt_stop -- */
@@ -0,0 +1,49 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_punt.h
+ *
+ * Description:
+ *
+ * Control-plane punt path (-o punt=N).  Exception work that the fast path
+ * would otherwise do inline -- answering and learning ARP, building ARP
+ * requests, ICMP for the router itself and ICMP errors for TTL expiry or
+ * missing routes -- is queued to a bounded ring served by one control
+ * thread, which may use at most a set share of a CPU (-o punt_cpu).
+ *
+ * When its ring is full the punted packet is dropped, so a burst of
+ * control traffic costs the forwarding threads only the enqueue.  ARP
+ * gets a ring of its own, served first, so ICMP is what gets dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PUNT_H
+#define SR_PUNT_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+struct sr_instance;
+
+enum sr_punt_kind
+{
+    SR_PUNT_ARP,        /* ARP frame */
+    SR_PUNT_LOCAL,      /* IP for one of our addresses */
+    SR_PUNT_TTL,        /* TTL expired in transit */
+    SR_PUNT_NOROUTE,    /* no route to the destination */
+    SR_PUNT_ARPREQ,     /* ARP request to send for a next hop */
+    SR_PUNT_KINDS
+};
+
+int  sr_punt_start(struct sr_instance* sr, unsigned int slots, int cpu_pct);
+void sr_punt_stop(struct sr_instance* sr);
+
+/* 1 when the control thread took the frame over (or dropped it), 0 when
+   the caller has to handle it itself: punting is off or the caller is
+   the control thread */
+int  sr_punt(struct sr_instance* sr, enum sr_punt_kind kind, uint8_t* packet,
+             unsigned int len, const char* iface);
+/* same for an ARP request for ip (host byte order) out of iface */
+int  sr_punt_arpreq(struct sr_instance* sr, uint32_t ip, const char* iface);
+
+void sr_punt_print_stats(struct sr_instance* sr, FILE* fp);
+
+#endif /* -- SR_PUNT_H -- */
@@ -0,0 +1,531 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_raw.c
+ *
+ * Description:
+ *
+ * Raw interface backends.  Each router interface is bound to a host
+ * device named in the interface config (see sr_load_if_config()), either
+ *
+ *   - a TAP device, created or attached through /dev/net/tun, or
+ *   - an existing device (e.g. one end of a veth pair) through an
+ *     AF_PACKET socket with PACKET_MMAP TPACKET_V2 RX and TX rings.
+ *
+ * Frames then move through per-interface kernel queues (shared memory
+ * rings for AF_PACKET) instead of being serialized over the single VNS
+ * stream.  Received frames are drained in batches per poll; transmitted
+ * frames are queued on the TX ring and the kernel is kicked once per
+ * batch.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#ifdef _LINUX_
+#include <linux/if_tun.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif /* _LINUX_ */
+
+#include "sr_backend.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_log.h"
+
+#define SR_RAW_MAX_IFS   16
+#define SR_RAW_FRAME_SZ  2048   /* one frame slot in a PACKET_MMAP ring */
+#define SR_RAW_FRAME_NR  512    /* slots per ring */
+#define SR_RAW_BLOCK_SZ  4096
+#define SR_RAW_RX_BATCH  64     /* frames drained per interface per poll */
+#define SR_RAW_TX_BATCH  32     /* queued frames before the kernel is kicked */
+#define SR_RAW_TAP_BUFSZ 16384
+#define SR_RAW_POLL_MS   100
+
+struct sr_raw_if
+{
+    struct sr_if* iface;
+    int fd;
+    int tap;
+
+    /* -- PACKET_MMAP rings, AF_PACKET only -- */
+    uint8_t* map;
+    size_t map_len;
+    uint8_t* rx_ring;
+    uint8_t* tx_ring;
+    unsigned int rx_idx;
+    unsigned int tx_idx;
+    unsigned int tx_pending;
+    pthread_mutex_t tx_lock;
+
+    uint8_t* tap_buf;
+
+    unsigned long rx_frames;
+    unsigned long tx_frames;
+    unsigned long tx_drops;
+};
+
+struct sr_raw
+{
+    struct sr_raw_if ifs[SR_RAW_MAX_IFS];
+    struct pollfd pfds[SR_RAW_MAX_IFS];
+    int nifs;
+    pthread_t poller;  /* thread running the poll loop */
+};
+
+#ifdef _LINUX_
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_open_tap(..)
+ * Scope: Local
+ *
+ * Create (or attach to) the TAP device rif->iface->dev and bring it up.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_raw_open_tap(struct sr_raw_if* rif)
+{
+    struct ifreq ifr;
+    int ctl;
+
+    if ((rif->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0)
+    {
+        perror("open(..):sr_raw.c::sr_raw_open_tap(/dev/net/tun)");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, rif->iface->dev, IFNAMSIZ - 1);
+    if (ioctl(rif->fd, TUNSETIFF, &ifr) < 0)
+    {
+        perror("ioctl(..):sr_raw.c::sr_raw_open_tap(TUNSETIFF)");
+        return -1;
+    }
+
+    /* -- bring the link up so the host side can talk to us -- */
+    if ((ctl = socket(AF_INET, SOCK_DGRAM, 0)) >= 0)
+    {
+        if (ioctl(ctl, SIOCGIFFLAGS, &ifr) == 0)
+        {
+            ifr.ifr_flags |= IFF_UP;
+            ioctl(ctl, SIOCSIFFLAGS, &ifr);
+        }
+        close(ctl);
+    }
+
+    rif->tap = 1;
+    rif->tap_buf = malloc(SR_RAW_TAP_BUFSZ);
+    assert(rif->tap_buf);
+    return 0;
+} /* -- sr_raw_open_tap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_open_packet(..)
+ * Scope: Local
+ *
+ * Bind an AF_PACKET socket to rif->iface->dev and map its RX and TX
+ * rings.  The device is put in promiscuous mode since the router's MAC
+ * is not the device's own.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_raw_open_packet(struct sr_raw_if* rif)
+{
+    struct tpacket_req req;
+    struct sockaddr_ll sll;
+    struct packet_mreq mreq;
+    int version = TPACKET_V2;
+    int ifindex;
+
+    if ((ifindex = if_nametoindex(rif->iface->dev)) == 0)
+    {
+        fprintf(stderr, "sr_raw: no host device %s for %s\n",
+                rif->iface->dev, rif->iface->name);
+        return -1;
+    }
+
+    if ((rif->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+    {
+        perror("socket(..):sr_raw.c::sr_raw_open_packet");
+        return -1;
+    }
+
+    if (setsockopt(rif->fd, SOL_PACKET, PACKET_VERSION, &version,
+                   sizeof(version)) < 0)
+    {
+        perror("setsockopt(..):sr_raw.c::sr_raw_open_packet(PACKET_VERSION)");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_RAW_BLOCK_SZ;
+    req.tp_frame_size = SR_RAW_FRAME_SZ;
+    req.tp_frame_nr = SR_RAW_FRAME_NR;
+    req.tp_block_nr = SR_RAW_FRAME_NR * SR_RAW_FRAME_SZ / SR_RAW_BLOCK_SZ;
+
+    if (setsockopt(rif->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0 ||
+        setsockopt(rif->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        perror("setsockopt(..):sr_raw.c::sr_raw_open_packet(PACKET_*_RING)");
+        return -1;
+    }
+
+    rif->map_len = 2 * (size_t)req.tp_block_size * req.tp_block_nr;
+    rif->map = mmap(0, rif->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    rif->fd, 0);
+    if (rif->map == MAP_FAILED)
+    {
+        perror("mmap(..):sr_raw.c::sr_raw_open_packet");
+        rif->map = 0;
+        return -1;
+    }
+    rif->rx_ring = rif->map;
+    rif->tx_ring = rif->map + rif->map_len / 2;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(rif->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+    {
+        perror("bind(..):sr_raw.c::sr_raw_open_packet");
+        return -1;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(rif->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                   sizeof(mreq)) < 0)
+    { perror("setsockopt(..):sr_raw.c::sr_raw_open_packet(PROMISC)"); }
+
+    return 0;
+} /* -- sr_raw_open_packet -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_flush(..)
+ * Scope: Local
+ *
+ * Ask the kernel to transmit every frame queued on the TX ring.
+ * Caller holds rif->tx_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_raw_flush(struct sr_raw_if* rif)
+{
+    if (rif->tx_pending == 0)
+    { return; }
+
+    if (send(rif->fd, 0, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN &&
+        errno != ENOBUFS)
+    { sr_log_err(SR_LOG_IO, "sr_raw: send on %s: %s", rif->iface->name,
+                 strerror(errno)); }
+    rif->tx_pending = 0;
+}
+
+static struct sr_raw_if* sr_raw_find(struct sr_raw* raw, const char* name)
+{
+    int i;
+    for (i = 0; i < raw->nifs; i++)
+    {
+        if (strncmp(raw->ifs[i].iface->name, name, sr_IFACE_NAMELEN) == 0)
+        { return &raw->ifs[i]; }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_send(..)
+ * Scope: Local
+ *
+ * Backend send op.  TAP frames are written directly; AF_PACKET frames
+ * are copied into the next TX ring slot and the kernel is kicked once
+ * SR_RAW_TX_BATCH are queued, at the end of the poll pass that queued
+ * them, or immediately when sent from any other thread.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_raw_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       const char* iface)
+{
+    struct sr_raw* raw = sr->backend->priv;
+    struct sr_raw_if* rif = sr_raw_find(raw, iface);
+    struct tpacket2_hdr* hdr;
+    unsigned int status;
+
+    if (!rif)
+    {
+        sr_log_err(SR_LOG_IO, "sr_raw: send on unknown interface %s", iface);
+        return -1;
+    }
+
+    if (rif->tap)
+    {
+        if (write(rif->fd, buf, len) != (ssize_t)len)
+        {
+            rif->tx_drops++;
+            return -1;
+        }
+        rif->tx_frames++;
+        return 0;
+    }
+
+    if (len > SR_RAW_FRAME_SZ - TPACKET2_HDRLEN)
+    {
+        rif->tx_drops++;
+        return -1;
+    }
+
+    pthread_mutex_lock(&rif->tx_lock);
+
+    hdr = (struct tpacket2_hdr*)(rif->tx_ring + rif->tx_idx * SR_RAW_FRAME_SZ);
+    status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if (status == TP_STATUS_SEND_REQUEST || status == TP_STATUS_SENDING)
+    {
+        /* ring full, push what is queued and give up on this one */
+        sr_raw_flush(rif);
+        rif->tx_drops++;
+        pthread_mutex_unlock(&rif->tx_lock);
+        return -1;
+    }
+
+    memcpy((uint8_t*)hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
+           buf, len);
+    hdr->tp_len = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    rif->tx_idx = (rif->tx_idx + 1) % SR_RAW_FRAME_NR;
+    rif->tx_frames++;
+    if (++rif->tx_pending >= SR_RAW_TX_BATCH ||
+        !pthread_equal(pthread_self(), raw->poller))
+    { sr_raw_flush(rif); }
+
+    pthread_mutex_unlock(&rif->tx_lock);
+    return 0;
+} /* -- sr_raw_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_rx(..)
+ * Scope: Local
+ *
+ * Drain up to SR_RAW_RX_BATCH received frames from one interface.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_raw_rx(struct sr_instance* sr, struct sr_raw_if* rif)
+{
+    int n;
+
+    if (rif->tap)
+    {
+        for (n = 0; n < SR_RAW_RX_BATCH; n++)
+        {
+            ssize_t len = read(rif->fd, rif->tap_buf, SR_RAW_TAP_BUFSZ);
+            if (len <= 0)
+            { break; }
+            rif->rx_frames++;
+            sr_receive_packet(sr, rif->tap_buf, len, rif->iface->name);
+        }
+        return;
+    }
+
+    for (n = 0; n < SR_RAW_RX_BATCH; n++)
+    {
+        struct tpacket2_hdr* hdr = (struct tpacket2_hdr*)
+            (rif->rx_ring + rif->rx_idx * SR_RAW_FRAME_SZ);
+        struct sockaddr_ll* sll;
+
+        if (!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+              TP_STATUS_USER))
+        { break; }
+
+        /* frames the host sends on the device show up as well */
+        sll = (struct sockaddr_ll*)((uint8_t*)hdr +
+                                    TPACKET_ALIGN(sizeof(struct tpacket2_hdr)));
+        if (sll->sll_pkttype != PACKET_OUTGOING)
+        {
+            rif->rx_frames++;
+            sr_receive_packet(sr, (uint8_t*)hdr + hdr->tp_mac,
+                              hdr->tp_snaplen, rif->iface->name);
+        }
+
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        rif->rx_idx = (rif->rx_idx + 1) % SR_RAW_FRAME_NR;
+    }
+} /* -- sr_raw_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_poll(..)
+ * Scope: Local
+ *
+ * Backend poll op: wait for any interface to become readable, drain
+ * each readable one and then kick the TX rings filled along the way.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_raw_poll(struct sr_instance* sr)
+{
+    struct sr_raw* raw = sr->backend->priv;
+    int i, ret;
+
+    raw->poller = pthread_self();
+
+    ret = sr_wait_input(sr, raw->pfds, raw->nifs, SR_RAW_POLL_MS);
+    if (ret < 0)
+    {
+        if (errno == EINTR)
+        { return 1; }
+        sr_log_err(SR_LOG_IO, "sr_raw_poll: poll: %s", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < raw->nifs; i++)
+    {
+        if (raw->pfds[i].revents & POLLIN)
+        { sr_raw_rx(sr, &raw->ifs[i]); }
+    }
+
+    for (i = 0; i < raw->nifs; i++)
+    {
+        struct sr_raw_if* rif = &raw->ifs[i];
+        if (!rif->tap && rif->tx_pending)
+        {
+            pthread_mutex_lock(&rif->tx_lock);
+            sr_raw_flush(rif);
+            pthread_mutex_unlock(&rif->tx_lock);
+        }
+    }
+
+    return 1;
+} /* -- sr_raw_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_pollfds(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static int sr_raw_pollfds(struct sr_instance* sr, struct pollfd* pfds, int max)
+{
+    struct sr_raw* raw = sr->backend->priv;
+    int n = raw->nifs < max ? raw->nifs : max;
+
+    memcpy(pfds, raw->pfds, n * sizeof(struct pollfd));
+    return n;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_close(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void sr_raw_close(struct sr_instance* sr)
+{
+    struct sr_raw* raw = sr->backend->priv;
+    int i;
+
+    for (i = 0; i < raw->nifs; i++)
+    {
+        struct sr_raw_if* rif = &raw->ifs[i];
+
+        sr_log_debug(SR_LOG_IO, "%s: rx %lu tx %lu tx drops %lu",
+                     rif->iface->name, rif->rx_frames, rif->tx_frames,
+                     rif->tx_drops);
+        if (rif->map)
+        { munmap(rif->map, rif->map_len); }
+        if (rif->fd >= 0)
+        { close(rif->fd); }
+        free(rif->tap_buf);
+        pthread_mutex_destroy(&rif->tx_lock);
+    }
+
+    free(raw);
+    free(sr->backend);
+    sr->backend = 0;
+} /* -- sr_raw_close -- */
+
+#endif /* _LINUX_ */
+
+/*---------------------------------------------------------------------
+ * Method: sr_raw_open(..)
+ * Scope: Global
+ *
+ * Bind every interface of sr to its host device, as a TAP device when
+ * use_tap is set or through AF_PACKET otherwise, and install the backend.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_raw_open(struct sr_instance* sr, int use_tap)
+{
+#ifdef _LINUX_
+    struct sr_raw* raw;
+    struct sr_if* if_walker;
+
+    /* REQUIRES */
+    assert(sr);
+
+    raw = (struct sr_raw*)calloc(1, sizeof(struct sr_raw));
+    assert(raw);
+
+    sr->backend = (struct sr_backend*)calloc(1, sizeof(struct sr_backend));
+    assert(sr->backend);
+    sr->backend->name = use_tap ? "tap" : "packet";
+    sr->backend->send = sr_raw_send;
+    sr->backend->poll = sr_raw_poll;
+    sr->backend->pollfds = sr_raw_pollfds;
+    sr->backend->close = sr_raw_close;
+    sr->backend->priv = raw;
+    raw->poller = pthread_self();
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        struct sr_raw_if* rif;
+
+        if (raw->nifs == SR_RAW_MAX_IFS)
+        {
+            fprintf(stderr, "sr_raw: too many interfaces\n");
+            sr_raw_close(sr);
+            return -1;
+        }
+
+        rif = &raw->ifs[raw->nifs++];
+        rif->iface = if_walker;
+        rif->fd = -1;
+        pthread_mutex_init(&rif->tx_lock, 0);
+
+        if ((use_tap ? sr_raw_open_tap(rif) : sr_raw_open_packet(rif)) != 0)
+        {
+            sr_raw_close(sr);
+            return -1;
+        }
+
+        raw->pfds[raw->nifs - 1].fd = rif->fd;
+        raw->pfds[raw->nifs - 1].events = POLLIN;
+
+        printf("%s bound to %s device %s\n", if_walker->name,
+               sr->backend->name, if_walker->dev);
+    }
+
+    return 0;
+#else
+    fprintf(stderr, "raw interface backends are only supported on Linux\n");
+    return -1;
+#endif /* _LINUX_ */
+} /* -- sr_raw_open -- */
@@ -0,0 +1,543 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.c
+ *
+ * Description:
+ *
+ * pcap replay backend.  Frames are read from a capture file and fed
+ * straight into the router, either as fast as possible or at the timing
+ * they were recorded with (optionally scaled).  Each frame is tagged with
+ * an ingress interface through a mapping file keyed on the frame's source
+ * MAC.  Transmitted frames go to an output pcap when one is given and
+ * are otherwise only counted.  When the capture is exhausted the backend
+ * reports throughput and per-frame processing latency, and the main loop
+ * ends.
+ *
+ * Mapping file format, '#' starts a comment:
+ *
+ *     <src mac> <iface>     frames from this MAC enter on iface
+ *     *         <iface>     ingress for frames matching no other line
+ *     arp <ip> <mac>        static ARP entry, kept in the cache
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_backend.h"
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_mem.h"
+#include "sr_hist.h"
+
+#define SR_REPLAY_MAX_MAP   64
+#define SR_REPLAY_MAX_ARP   64
+#define SR_REPLAY_BATCH     64
+#define SR_REPLAY_MAX_FRAME 65535
+
+struct sr_replay_frame
+{
+    uint8_t* buf;
+    unsigned int len;
+    uint64_t ts;                /* ns since the first frame was captured */
+    struct sr_if* iface;        /* ingress */
+};
+
+struct sr_replay_map
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct sr_if* iface;
+};
+
+struct sr_replay_arp
+{
+    uint32_t ip;                /* host byte order, as the cache keys it */
+    unsigned char mac[ETHER_ADDR_LEN];
+};
+
+struct sr_replay
+{
+    struct sr_replay_frame* frames;
+    unsigned long nframes;
+    unsigned long next;
+    double speed;               /* 0 = as fast as possible */
+
+    struct sr_replay_map map[SR_REPLAY_MAX_MAP];
+    int nmap;
+    struct sr_if* default_iface;
+    struct sr_replay_arp arp[SR_REPLAY_MAX_ARP];
+    int narp;
+    time_t arp_refreshed;
+
+    FILE* out;                  /* transmitted frames, 0 = count only */
+    uint8_t* scratch;
+
+    uint64_t start;
+    uint64_t end;
+    uint64_t* proc_ns;          /* per-frame time in sr_receive_packet() */
+    unsigned long rx_frames, rx_bytes, unmapped;
+    unsigned long tx_frames, tx_bytes;
+};
+
+static uint32_t sr_replay_swap32(uint32_t v)
+{
+    return ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+           ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+static int sr_replay_parse_mac(const char* s, unsigned char* mac)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x",
+               &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETHER_ADDR_LEN)
+    { return -1; }
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+    { mac[i] = (unsigned char)b[i]; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_load_map(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_load_map(struct sr_instance* sr, struct sr_replay* rp,
+                              const char* filename)
+{
+    FILE* fp;
+    char line[BUFSIZ];
+    char a[32], b[32], c[32];
+    struct in_addr ip;
+    int n;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror("fopen(..):sr_replay.c::sr_replay_load_map");
+        return -1;
+    }
+
+    while (fgets(line, BUFSIZ, fp) != 0)
+    {
+        char* hash = strchr(line, '#');
+        if (hash)
+        { *hash = '\0'; }
+
+        n = sscanf(line, "%31s %31s %31s", a, b, c);
+        if (n <= 0)
+        { continue; }
+
+        if (strcmp(a, "arp") == 0)
+        {
+            if (n != 3 || rp->narp == SR_REPLAY_MAX_ARP ||
+                inet_aton(b, &ip) == 0 ||
+                sr_replay_parse_mac(c, rp->arp[rp->narp].mac) != 0)
+            { goto bad_line; }
+            rp->arp[rp->narp++].ip = ntohl(ip.s_addr);
+            continue;
+        }
+
+        if (n != 2 || !sr_get_interface(sr, b))
+        { goto bad_line; }
+
+        if (strcmp(a, "*") == 0)
+        {
+            rp->default_iface = sr_get_interface(sr, b);
+            continue;
+        }
+
+        if (rp->nmap == SR_REPLAY_MAX_MAP ||
+            sr_replay_parse_mac(a, rp->map[rp->nmap].mac) != 0)
+        { goto bad_line; }
+        rp->map[rp->nmap++].iface = sr_get_interface(sr, b);
+    }
+
+    fclose(fp);
+    return 0;
+
+bad_line:
+    fprintf(stderr, "Error in replay map %s: %s", filename, line);
+    fclose(fp);
+    return -1;
+} /* -- sr_replay_load_map -- */
+
+static struct sr_if* sr_replay_ingress(struct sr_replay* rp, uint8_t* frame)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    int i;
+
+    for (i = 0; i < rp->nmap; i++)
+    {
+        if (memcmp(rp->map[i].mac, eth->ether_shost, ETHER_ADDR_LEN) == 0)
+        { return rp->map[i].iface; }
+    }
+    return rp->default_iface;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_load_pcap(..)
+ * Scope: Local
+ *
+ * Read the whole capture up front so that file I/O stays out of the
+ * measured loop.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_load_pcap(struct sr_replay* rp, const char* filename)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    unsigned long cap = 0;
+    uint64_t last = 0, elapsed = 0;
+    int swapped;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror("fopen(..):sr_replay.c::sr_replay_load_pcap");
+        return -1;
+    }
+
+    if (fread(&fh, sizeof(fh), 1, fp) != 1 ||
+        (fh.magic != TCPDUMP_MAGIC &&
+         fh.magic != sr_replay_swap32(TCPDUMP_MAGIC)))
+    {
+        fprintf(stderr, "%s is not a pcap file\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    swapped = (fh.magic != TCPDUMP_MAGIC);
+
+    while (fread(&ph, sizeof(ph), 1, fp) == 1)
+    {
+        struct sr_replay_frame* f;
+        uint32_t caplen = ph.caplen;
+        uint32_t sec = ph.ts.tv_sec;
+        uint32_t usec = ph.ts.tv_usec;
+        uint64_t ts;
+
+        if (swapped)
+        {
+            caplen = sr_replay_swap32(caplen);
+            sec = sr_replay_swap32(sec);
+            usec = sr_replay_swap32(usec);
+        }
+        if (caplen > SR_REPLAY_MAX_FRAME)
+        {
+            fprintf(stderr, "%s: bad record length %u\n", filename, caplen);
+            break;
+        }
+
+        if (rp->nframes == cap)
+        {
+            cap = cap ? 2 * cap : 4096;
+            rp->frames = realloc(rp->frames,
+                                 cap * sizeof(struct sr_replay_frame));
+            assert(rp->frames);
+        }
+
+        f = &rp->frames[rp->nframes];
+        f->len = caplen;
+        /* -- time since the previous frame, none if the capture's clock
+              stepped back, so due times never go backwards -- */
+        ts = (uint64_t)sec * 1000000000ULL + (uint64_t)usec * 1000;
+        if (rp->nframes && ts > last)
+        { elapsed += ts - last; }
+        last = ts;
+        f->ts = elapsed;
+        f->buf = malloc(caplen ? caplen : 1);
+        assert(f->buf);
+        if (caplen && fread(f->buf, caplen, 1, fp) != 1)
+        {
+            free(f->buf);
+            break;
+        }
+        rp->nframes++;
+    }
+
+    fclose(fp);
+    return 0;
+} /* -- sr_replay_load_pcap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_refresh_arp(..)
+ * Scope: Local
+ *
+ * (Re)install static ARP entries that are missing from the cache, they
+ * time out like any other entry.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_replay_refresh_arp(struct sr_instance* sr, struct sr_replay* rp)
+{
+    time_t now = time(0);
+    int i;
+
+    if (now == rp->arp_refreshed)
+    { return; }
+    rp->arp_refreshed = now;
+
+    for (i = 0; i < rp->narp; i++)
+    {
+        struct sr_arpentry* entry = sr_arpcache_lookup(&sr->cache, rp->arp[i].ip);
+        struct sr_arpreq* req;
+        struct sr_packet* pkt;
+
+        if (entry)
+        {
+            sr_mem_free(entry);
+            continue;
+        }
+
+        /* -- flush anything that queued up while the entry was gone -- */
+        req = sr_arpcache_insert(&sr->cache, rp->arp[i].mac, rp->arp[i].ip);
+        if (req)
+        {
+            for (pkt = req->packets; pkt; pkt = pkt->next)
+            {
+                memcpy(((sr_ethernet_hdr_t*)pkt->buf)->ether_dhost,
+                       rp->arp[i].mac, ETHER_ADDR_LEN);
+                sr_send_packet(sr, pkt->buf, pkt->len, pkt->iface);
+            }
+            sr_arpreq_destroy(&sr->cache, req);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_send(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_send(struct sr_instance* sr, uint8_t* buf,
+                          unsigned int len, const char* iface)
+{
+    struct sr_replay* rp = sr->backend->priv;
+
+    rp->tx_frames++;
+    rp->tx_bytes += len;
+
+    if (rp->out)
+    {
+        struct pcap_pkthdr h;
+
+        gettimeofday(&h.ts, 0);
+        h.caplen = len;
+        h.len = len;
+        sr_dump(rp->out, &h, buf);
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_poll(..)
+ * Scope: Local
+ *
+ * Feed the next batch of frames to the router, waiting for each one's
+ * due time when replaying at recorded timing.  Returns 0 once the
+ * capture is exhausted.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_poll(struct sr_instance* sr)
+{
+    struct sr_replay* rp = sr->backend->priv;
+    int n;
+
+    sr_replay_refresh_arp(sr, rp);
+
+    if (rp->next == 0)
+    { rp->start = sr_hist_now(); }
+
+    for (n = 0; n < SR_REPLAY_BATCH && rp->next < rp->nframes; n++)
+    {
+        struct sr_replay_frame* f = &rp->frames[rp->next];
+        uint64_t t0, t1;
+
+        if (rp->speed > 0)
+        {
+            uint64_t due = rp->start + (uint64_t)(f->ts / rp->speed);
+            uint64_t now = sr_hist_now();
+            if (due > now)
+            {
+                struct timespec ts;
+                ts.tv_sec = (due - now) / 1000000000ULL;
+                ts.tv_nsec = (due - now) % 1000000000ULL;
+                nanosleep(&ts, 0);
+            }
+        }
+
+        /* the router may rewrite the frame, keep the loaded copy intact */
+        memcpy(rp->scratch, f->buf, f->len);
+
+        t0 = sr_hist_now();
+        sr_receive_packet(sr, rp->scratch, f->len, f->iface->name);
+        t1 = sr_hist_now();
+
+        rp->proc_ns[rp->rx_frames++] = t1 - t0;
+        rp->rx_bytes += f->len;
+        rp->end = t1;
+        rp->next++;
+    }
+
+    return rp->next < rp->nframes ? 1 : 0;
+} /* -- sr_replay_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_report(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static int sr_replay_cmp(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void sr_replay_report(struct sr_replay* rp)
+{
+    double secs = rp->end > rp->start ? (rp->end - rp->start) / 1e9 : 0.0;
+    unsigned long n = rp->rx_frames;
+
+    printf("---------------------------------------------\n");
+    printf("replayed  %lu frames, %lu bytes (%lu unmapped skipped)\n",
+           n, rp->rx_bytes, rp->unmapped);
+    printf("sent      %lu frames, %lu bytes\n", rp->tx_frames, rp->tx_bytes);
+    if (secs > 0)
+    {
+        printf("rate      %.0f pps, %.3f Mbps in %.3f s\n", n / secs,
+               rp->rx_bytes * 8.0 / secs / 1e6, secs);
+    }
+    if (n)
+    {
+        qsort(rp->proc_ns, n, sizeof(uint64_t), sr_replay_cmp);
+        printf("per frame p50 %.2f p99 %.2f p99.9 %.2f max %.2f us\n",
+               rp->proc_ns[n / 2] / 1e3,
+               rp->proc_ns[(unsigned long)(n * 0.99)] / 1e3,
+               rp->proc_ns[(unsigned long)(n * 0.999)] / 1e3,
+               rp->proc_ns[n - 1] / 1e3);
+    }
+    printf("---------------------------------------------\n");
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_close(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void sr_replay_close(struct sr_instance* sr)
+{
+    struct sr_replay* rp = sr->backend->priv;
+    unsigned long i;
+
+    if (rp->proc_ns)
+    { sr_replay_report(rp); }
+
+    if (rp->out)
+    { sr_dump_close(rp->out); }
+    for (i = 0; i < rp->nframes; i++)
+    { free(rp->frames[i].buf); }
+    free(rp->frames);
+    free(rp->proc_ns);
+    free(rp->scratch);
+    free(rp);
+    free(sr->backend);
+    sr->backend = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_replay_open(..)
+ * Scope: Global
+ *
+ * Install the replay backend: frames from 'pcap', ingress interfaces
+ * from 'map', transmitted frames to 'out' (0 to only count them).
+ * 'speed' scales the recorded timing, 0 replays as fast as possible.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_replay_open(struct sr_instance* sr, const char* pcap, const char* map,
+                   const char* out, double speed)
+{
+    struct sr_replay* rp;
+    unsigned long i, kept;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (!pcap || !map)
+    {
+        fprintf(stderr, "The replay backend needs a capture (-R) and a map (-m)\n");
+        return -1;
+    }
+
+    rp = (struct sr_replay*)calloc(1, sizeof(struct sr_replay));
+    assert(rp);
+    rp->speed = speed;
+
+    sr->backend = (struct sr_backend*)calloc(1, sizeof(struct sr_backend));
+    assert(sr->backend);
+    sr->backend->name = "replay";
+    sr->backend->send = sr_replay_send;
+    sr->backend->poll = sr_replay_poll;
+    sr->backend->close = sr_replay_close;
+    sr->backend->priv = rp;
+
+    rp->scratch = malloc(SR_REPLAY_MAX_FRAME);
+    assert(rp->scratch);
+
+    if (sr_replay_load_map(sr, rp, map) != 0 ||
+        sr_replay_load_pcap(rp, pcap) != 0)
+    {
+        sr_replay_close(sr);
+        return -1;
+    }
+
+    /* -- tag every frame with its ingress, dropping what maps nowhere -- */
+    for (i = kept = 0; i < rp->nframes; i++)
+    {
+        struct sr_replay_frame* f = &rp->frames[i];
+
+        if (f->len >= sizeof(sr_ethernet_hdr_t))
+        { f->iface = sr_replay_ingress(rp, f->buf); }
+        if (f->len < sizeof(sr_ethernet_hdr_t) || !f->iface)
+        {
+            free(f->buf);
+            rp->unmapped++;
+            continue;
+        }
+        rp->frames[kept++] = *f;
+    }
+    rp->nframes = kept;
+
+    rp->proc_ns = malloc((kept ? kept : 1) * sizeof(uint64_t));
+    assert(rp->proc_ns);
+
+    if (out)
+    {
+        rp->out = sr_dump_open(out, 0, SR_REPLAY_MAX_FRAME);
+        if (!rp->out)
+        {
+            sr_replay_close(sr);
+            return -1;
+        }
+    }
+
+    printf("replaying %lu frames from %s %s\n", kept, pcap,
+           speed > 0 ? "at recorded timing" : "at full speed");
+    return 0;
+} /* -- sr_replay_open -- */
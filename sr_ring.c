@@ -0,0 +1,206 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * Lock-free SPSC pointer rings, see sr_ring.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "sr_ring.h"
+#include "sr_flight.h"
+#include "sr_stats.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_create(..)
+ * Scope: Global
+ *
+ * Allocate a ring of size slots (rounded up to a power of two) whose
+ * consumer sleeps on bell.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_ring* sr_ring_create(const char* name, unsigned int size,
+                               struct sr_ring_bell* bell)
+{
+    struct sr_ring* ring;
+    unsigned int n = 2;
+
+    while (n < size)
+    { n <<= 1; }
+
+    if (posix_memalign((void**)&ring, SR_RING_CACHELINE, sizeof(*ring)) != 0)
+    { return 0; }
+    memset(ring, 0, sizeof(*ring));
+
+    ring->size = n;
+    ring->slots = (void**)calloc(n, sizeof(void*));
+    assert(ring->slots);
+    ring->bell = bell;
+    strncpy(ring->name, name, SR_RING_NAMELEN - 1);
+
+    return ring;
+} /* -- sr_ring_create -- */
+
+void sr_ring_destroy(struct sr_ring* ring)
+{
+    if (!ring)
+    { return; }
+    free(ring->slots);
+    free(ring);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_push(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+int sr_ring_push(struct sr_ring* ring, void* item)
+{
+    unsigned int head = ring->head;
+    unsigned int used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (used >= ring->size)
+    {
+        __atomic_store_n(&ring->drops, ring->drops + 1, __ATOMIC_RELAXED);
+        sr_flight_drop(1);
+        sr_stats_drop(SR_DROP_RING);
+        return -1;
+    }
+
+    ring->slots[head & (ring->size - 1)] = item;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&ring->pushed, ring->pushed + 1, __ATOMIC_RELAXED);
+    if (used + 1 > ring->hwm)
+    { __atomic_store_n(&ring->hwm, used + 1, __ATOMIC_RELAXED); }
+
+    if (ring->bell)
+    { sr_ring_bell_notify(ring->bell); }
+
+    return 0;
+} /* -- sr_ring_push -- */
+
+void* sr_ring_pop(struct sr_ring* ring)
+{
+    unsigned int tail = ring->tail;
+    void* item;
+
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+    { return 0; }
+
+    item = ring->slots[tail & (ring->size - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+unsigned int sr_ring_count(struct sr_ring* ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+void sr_ring_print_stats(struct sr_ring* ring, FILE* fp)
+{
+    fprintf(fp, "%-16s size %5u  now %5u  max %5u  pushed %10lu  drops %lu\n",
+            ring->name, ring->size, sr_ring_count(ring),
+            __atomic_load_n(&ring->hwm, __ATOMIC_RELAXED),
+            __atomic_load_n(&ring->pushed, __ATOMIC_RELAXED),
+            __atomic_load_n(&ring->drops, __ATOMIC_RELAXED));
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_bell_*(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+void sr_ring_bell_init(struct sr_ring_bell* bell)
+{
+    memset(bell, 0, sizeof(*bell));
+    pthread_mutex_init(&bell->lock, 0);
+    pthread_cond_init(&bell->cond, 0);
+}
+
+void sr_ring_bell_destroy(struct sr_ring_bell* bell)
+{
+    pthread_mutex_destroy(&bell->lock);
+    pthread_cond_destroy(&bell->cond);
+}
+
+void sr_ring_bell_ring(struct sr_ring_bell* bell)
+{
+    pthread_mutex_lock(&bell->lock);
+    bell->rung = 1;
+    pthread_cond_signal(&bell->cond);
+    pthread_mutex_unlock(&bell->lock);
+}
+
+void sr_ring_bell_wait_for(struct sr_ring_bell* bell, int (*ready)(void*),
+                           void* arg, int timeout_ms)
+{
+    struct timespec ts;
+
+    __atomic_store_n(&bell->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (ready(arg))
+    {
+        __atomic_store_n(&bell->sleeping, 0, __ATOMIC_RELAXED);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&bell->lock);
+    while (!bell->rung)
+    {
+        if (pthread_cond_timedwait(&bell->cond, &bell->lock, &ts) == ETIMEDOUT)
+        { break; }
+    }
+    bell->rung = 0;
+    pthread_mutex_unlock(&bell->lock);
+
+    __atomic_store_n(&bell->sleeping, 0, __ATOMIC_RELAXED);
+} /* -- sr_ring_bell_wait_for -- */
+
+struct sr_ring_set
+{
+    struct sr_ring** rings;
+    int n;
+};
+
+static int sr_ring_set_ready(void* arg)
+{
+    struct sr_ring_set* set = arg;
+    int i;
+
+    for (i = 0; i < set->n; i++)
+    {
+        if (sr_ring_count(set->rings[i]))
+        { return 1; }
+    }
+    return 0;
+}
+
+void sr_ring_bell_wait(struct sr_ring_bell* bell, struct sr_ring** rings,
+                       int n, int timeout_ms)
+{
+    struct sr_ring_set set;
+
+    set.rings = rings;
+    set.n = n;
+    sr_ring_bell_wait_for(bell, sr_ring_set_ready, &set, timeout_ms);
+}
@@ -0,0 +1,103 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ *
+ * Description:
+ *
+ * Bounded lock-free single-producer / single-consumer rings of pointers,
+ * used to hand packets between the threads of the forwarding pipeline
+ * (see sr_pipeline.c).  Each ring keeps occupancy and drop statistics.
+ *
+ * A consumer that serves one or more rings can sleep on a doorbell
+ * (struct sr_ring_bell) shared by those rings; producers only touch the
+ * doorbell's mutex when the consumer has announced it is going to sleep.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define SR_RING_CACHELINE 64
+#define SR_RING_NAMELEN   32
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ring_bell
+ *
+ * Wakeup for a consumer sleeping on one or more rings
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ring_bell
+{
+    int sleeping __attribute__ ((aligned(SR_RING_CACHELINE)));
+    int rung;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ring
+ *
+ * Producer and consumer fields live on separate cache lines; the
+ * statistics are written by the producer only.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ring
+{
+    /* -- producer -- */
+    unsigned int head __attribute__ ((aligned(SR_RING_CACHELINE)));
+    unsigned int hwm;              /* highest occupancy seen */
+    unsigned long pushed;
+    unsigned long drops;           /* pushes refused because the ring was full */
+
+    /* -- consumer -- */
+    unsigned int tail __attribute__ ((aligned(SR_RING_CACHELINE)));
+
+    /* -- fixed -- */
+    unsigned int size __attribute__ ((aligned(SR_RING_CACHELINE)));
+    void** slots;
+    struct sr_ring_bell* bell;     /* consumer's doorbell, may be 0 */
+    char name[SR_RING_NAMELEN];
+};
+
+struct sr_ring* sr_ring_create(const char* name, unsigned int size,
+                               struct sr_ring_bell* bell);
+void  sr_ring_destroy(struct sr_ring* ring);
+
+/* producer: 0 on success, -1 (and a drop) when full */
+int   sr_ring_push(struct sr_ring* ring, void* item);
+/* consumer: next item or 0 when empty */
+void* sr_ring_pop(struct sr_ring* ring);
+
+unsigned int sr_ring_count(struct sr_ring* ring);
+void  sr_ring_print_stats(struct sr_ring* ring, FILE* fp);
+
+void  sr_ring_bell_init(struct sr_ring_bell* bell);
+void  sr_ring_bell_destroy(struct sr_ring_bell* bell);
+/* consumer: sleep until ready(arg) holds, the bell is rung or timeout_ms
+   passes; ready is checked after the consumer has announced the sleep,
+   so a producer that makes it hold and then calls sr_ring_bell_notify()
+   is never missed */
+void  sr_ring_bell_wait_for(struct sr_ring_bell* bell, int (*ready)(void*),
+                            void* arg, int timeout_ms);
+/* consumer: sleep until one of the n rings on this bell has items, the
+   bell is rung or timeout_ms passes */
+void  sr_ring_bell_wait(struct sr_ring_bell* bell, struct sr_ring** rings,
+                        int n, int timeout_ms);
+/* wake the consumer regardless of the rings, e.g. to shut it down */
+void  sr_ring_bell_ring(struct sr_ring_bell* bell);
+
+/* producer, after publishing: wake the consumer if it is going to sleep.
+   Pairs with the fence in sr_ring_bell_wait_for(): either the consumer
+   sees what was published or we see it going to sleep. */
+static __inline__ void sr_ring_bell_notify(struct sr_ring_bell* bell)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&bell->sleeping, __ATOMIC_RELAXED))
+    { sr_ring_bell_ring(bell); }
+}
+
+#endif /* -- SR_RING_H -- */
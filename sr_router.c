@@ -24,27 +24,27 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_fcache.h"
+#include "sr_punt.h"
+#include "sr_icmp.h"
+#include "sr_mem.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 
 
 
-#define DEFAULT_TTL           (255)
 
 
 
 
 void Arp(struct sr_instance* sr,sr_arp_hdr_t *packet, unsigned int len,struct sr_if *iface);
 void Ip(struct sr_instance* sr, uint8_t* packet, unsigned int length,char* interface);
-int IpdestonUs(struct sr_instance* sr, sr_ip_hdr_t* Ipheader);
+struct sr_if* IpdestonUs(struct sr_instance* sr, sr_ip_hdr_t* Ipheader);
 void ICMP_Echo_reply(struct sr_instance* sr, uint8_t* packet,unsigned int length,char* interface);
 int ip_checksum(sr_ip_hdr_t *ip_header);
 struct sr_rt *find_longest_prefix_match(struct sr_instance *sr, uint32_t next_hop);
-struct sr_rt *find_routing_table(struct sr_instance *sr, uint32_t next_hop_ip);
-void not_in_arp_sent(struct sr_instance* sr, struct sr_arpreq* request, struct sr_if* req_iface);
-void ICMP_Port_unreachable(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface);
-void ICMP_Network_unreachable(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface);
-void ICMP_time_exceeded(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface);
 void ICMP_Host_unreachable(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface);
-void Setup_eth_and_sent(struct sr_instance *sr, sr_ethernet_hdr_t* packet, unsigned int length,struct sr_rt* route);
+static void sr_eth_send(struct sr_instance *sr, sr_ethernet_hdr_t* packet, unsigned int length,struct sr_rt* route, int fwd);
 
 
 static const uint8_t broadcast[ETHER_ADDR_LEN] =
@@ -63,19 +63,39 @@ void sr_init(struct sr_instance* sr)
     assert(sr);
 
     /* Initialize cache and cache cleanup thread */
-    sr_arpcache_init(&(sr->cache));
+    sr_init_state(sr);
 
     pthread_attr_init(&(sr->attr));
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
     pthread_t thread;
 
     pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
     
+} /* -- sr_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_init_state(void)
+ * Scope:  Global
+ *
+ * Initialize the routing subsystem without starting its ARP timer
+ * thread, for instances whose sr_arpcache_tick() is driven by a timer
+ * shared with other instances (see sr_multi.c)
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_init_state(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    sr_arpcache_init(&(sr->cache));
+    sr->icmp_limit = sr_icmp_limit_create();
+    sr->reply_path = sr_icmp_reply_path();
+
     /* Add initialization code here! */
 
-} /* -- sr_init -- */
+} /* -- sr_init_state -- */
 
 /*---------------------------------------------------------------------
  * Method: sr_handlepacket(uint8_t* p,char* interface)
@@ -103,24 +123,31 @@ void sr_handlepacket(struct sr_instance* sr,
   assert(packet);
   assert(interface);
 
-   /* fill in code here */
+  sr_stats_stage_start();
 
   /*check length whether enough*/
   if (len < sizeof(sr_ethernet_hdr_t))
   {
     /*The frame is too short, just drop it*/
+     sr_stats_drop(SR_DROP_RUNT);
      return;
   }
 
-  printf("*** -> Received packet of length %d \n",len);
+  sr_log_debug(SR_LOG_FWD, "received %u bytes on %s", len, interface);
 
   struct sr_if* iface = sr_get_interface(sr, interface);
   if (!iface) {
+      sr_stats_drop(SR_DROP_NO_IFACE);
       return;
   }
 
   /*ARP*/
   if (ethertype(packet) == ethertype_arp){
+
+      /*handled by the control thread when punting*/
+      if (sr_punt(sr, SR_PUNT_ARP, packet, len, interface)) {
+          return;
+      }
          
       sr_arp_hdr_t* arp_hdr = (sr_arp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
       int arp_length  = len- sizeof(sr_ethernet_hdr_t);
@@ -131,6 +158,7 @@ void sr_handlepacket(struct sr_instance* sr,
       Ip(sr,packet,len,interface);
   }
   else{
+    sr_stats_drop(SR_DROP_ETHERTYPE);
     return;
   }
 }/* end sr_ForwardPacket */
@@ -150,14 +178,15 @@ void Arp(struct sr_instance* sr,sr_arp_hdr_t* arp_hdr, unsigned int len, struct
    if (len < sizeof(sr_arp_hdr_t))
    {
       /* Not big enough to be an ARP packet... */
+      sr_stats_drop(SR_DROP_BAD_ARP);
       return;
    }
 
    if (ntohs(arp_hdr->ar_op) == arp_op_request) {
 
-        /*malloc space and built up reply packet*/
+        /*build up reply packet on the stack, sr_send_packet copies if it must*/
 
-        uint8_t* reply_packet = (uint8_t *) malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
+        uint8_t reply_packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
         sr_ethernet_hdr_t* eth_header = (sr_ethernet_hdr_t*)reply_packet;
         sr_arp_hdr_t* arp_headr = (sr_arp_hdr_t*)(reply_packet + sizeof(sr_ethernet_hdr_t));
 
@@ -187,8 +216,6 @@ void Arp(struct sr_instance* sr,sr_arp_hdr_t* arp_hdr, unsigned int len, struct
 
         sr_send_packet(sr, reply_packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t),
             iface->name);
-            
-        free(reply_packet);
 
 
     } else if (ntohs(arp_hdr->ar_op) == arp_op_reply) {
@@ -199,15 +226,23 @@ void Arp(struct sr_instance* sr,sr_arp_hdr_t* arp_hdr, unsigned int len, struct
             
         if (arqreq != NULL)
         {      
-            while (arqreq->packets != NULL)
+            struct sr_packet* temp;
+            uint64_t now = sr_stats_latency ? sr_hist_now() : 0;
+
+            /*insert took the request off the queue, so it is ours to free*/
+
+            for (temp = arqreq->packets; temp != NULL; temp = temp->next)
             {
-              struct sr_packet* temp = arqreq->packets;
               memcpy(((sr_ethernet_hdr_t*) temp->buf)->ether_dhost,
                   arp_hdr->ar_sha, ETHER_ADDR_LEN);
+              if (now) {
+                sr_stats_lat(SR_LAT_ARP_WAIT, now - temp->queued_ns);
+                if (temp->rx_ns)
+                  sr_stats_lat(SR_LAT_FORWARD, now - temp->rx_ns);
+              }
               sr_send_packet(sr, temp->buf, temp->len, temp->iface);
-              arqreq->packets = arqreq->packets->next;
-
             }
+            sr_arpreq_destroy(&sr->cache, arqreq);
         }
         else
         {
@@ -226,46 +261,75 @@ void Ip(struct sr_instance* sr,uint8_t * packet,unsigned int len,char* interface
     /*check Ip length*/
     if (len < sizeof(sr_ip_hdr_t)+sizeof(sr_ethernet_hdr_t))
     {
+       sr_stats_drop(SR_DROP_BAD_IP);
        return;
     }
 
     sr_ip_hdr_t * ipheader = (sr_ip_hdr_t *) (packet + sizeof(sr_ethernet_hdr_t));
 
+    /*header with options*/
+    if (ipheader->ip_hl < 5 ||
+        len < ipheader->ip_hl * 4 + sizeof(sr_ethernet_hdr_t))
+    {
+       sr_stats_drop(SR_DROP_BAD_IP);
+       return;
+    }
+
     /*checksum*/
     if (!ip_checksum(ipheader)) {
+        sr_stats_drop(SR_DROP_CHECKSUM);
         return;
     }
 
 
     /*destination address on us*/
-    if (IpdestonUs(sr, ipheader)==1)
+    struct sr_if* local_if = IpdestonUs(sr, ipheader);
+    if (local_if)
     {
+      if (sr_punt(sr, SR_PUNT_LOCAL, packet, len, interface)) {
+        return;
+      }
 
       if(ip_protocol((uint8_t*)ipheader) == ip_protocol_icmp){
         ICMP_Echo_reply(sr, packet, len,interface);
 
       }else{
         /*Port unreachable(3,3)*/
-        ICMP_Port_unreachable(sr, packet, len,interface);
+        sr_icmp_send_error(sr, SR_ICMP_PORT_UNREACH, local_if, packet, len,
+                           interface);
       }
 
     }else{
-        struct sr_rf* in_routering_table = find_routing_table(sr, ipheader->ip_dst);
+        sr_stats_stage(SR_LAT_PARSE);
+        struct sr_rt* in_routering_table = find_routing_table(sr, ipheader->ip_dst);
+        sr_stats_stage(SR_LAT_LPM);
 
         if (!in_routering_table) {
           /*Network unreachable(3,0)*/
-          ICMP_Network_unreachable(sr, packet, len,interface);
+          if (!sr_punt(sr, SR_PUNT_NOROUTE, packet, len, interface)) {
+            sr_stats_drop(SR_DROP_NO_ROUTE);
+            sr_icmp_send_error(sr, SR_ICMP_NET_UNREACH,
+                               sr_get_interface(sr, interface), packet, len,
+                               interface);
+          }
           return;
         }
         else if (ipheader->ip_ttl <= 1) {
-          ICMP_time_exceeded(sr, packet, len,interface);
+          if (!sr_punt(sr, SR_PUNT_TTL, packet, len, interface)) {
+            sr_stats_drop(SR_DROP_TTL);
+            sr_icmp_send_error(sr, SR_ICMP_TIME_EXCEEDED,
+                               sr_get_interface(sr, interface), packet, len,
+                               interface);
+          }
           return;
         }
         else{
+          /*TTL shares a 16 bit word with the protocol (RFC 1624)*/
+          uint16_t old_word = htons(ipheader->ip_ttl << 8 | ipheader->ip_p);
           ipheader->ip_ttl = ipheader->ip_ttl-1;
-          ipheader->ip_sum = 0;
-          ipheader->ip_sum = cksum(ipheader, sizeof(sr_ip_hdr_t));
-          Setup_eth_and_sent(sr,(sr_ethernet_hdr_t *) (packet),len, in_routering_table);
+          ipheader->ip_sum = cksum_update16(ipheader->ip_sum, old_word,
+                               htons(ipheader->ip_ttl << 8 | ipheader->ip_p));
+          sr_eth_send(sr,(sr_ethernet_hdr_t *) (packet),len, in_routering_table, 1);
         }
         return;
     }
@@ -275,50 +339,40 @@ void Ip(struct sr_instance* sr,uint8_t * packet,unsigned int len,char* interface
 /*--------------------------------------------------------------------------------------------------------------------------------------------*/
 /*--------------------------------------------------------------------------------------------------------------------------------------------*/
 
+/*Answer an echo request in place: the reply is the request with the
+  addresses swapped, type 0 and a fresh TTL, so both checksums are
+  patched for just those words and the payload is never touched*/
 void ICMP_Echo_reply(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface)
 {
 
   sr_ip_hdr_t* ipheader = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
 
-  sr_icmp_hdr_t* icmpHeader = (sr_icmp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-
-  int icmpLength = length - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t);
-
+  unsigned int ipLength = ipheader->ip_hl * 4;
 
-
-  struct sr_rt *route_table = find_routing_table(sr, ipheader->ip_src);
-
-  if (!route_table) {
-      return;
+  if (length < sizeof(sr_ethernet_hdr_t) + ipLength + sizeof(sr_icmp_hdr_t)) {
+    return;
   }
 
+  sr_icmp_hdr_t* icmpHeader = (sr_icmp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + ipLength);
 
   if(icmpHeader->icmp_type == (uint8_t)8){
 
-    /*Send echo Reply*/
-    uint8_t* replyPacket = (uint8_t *)malloc(length);
-
-    memcpy(replyPacket, packet, length);
-
-
-    sr_ip_hdr_t *replyIpHeader = (sr_ip_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t));
-    sr_icmp_hdr_t *replyIcmpHeader = (sr_icmp_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)); 
-
-    /*setup ICMP*/
-    replyIcmpHeader->icmp_type = (uint8_t)0;
-    replyIcmpHeader->icmp_code = (uint8_t)0;
-    replyIcmpHeader->icmp_sum = (uint16_t)0;
-    replyIcmpHeader->icmp_sum = cksum(replyIcmpHeader, icmpLength);
-
-    /* setup IP */
-    uint32_t ip_src = replyIpHeader->ip_src;
-    replyIpHeader->ip_src = replyIpHeader->ip_dst;
-    replyIpHeader->ip_dst = ip_src;
-    replyIpHeader->ip_ttl = INIT_TTL;
-    replyIpHeader->ip_sum = 0;
-    replyIpHeader->ip_sum = cksum(replyIpHeader, sizeof(sr_ip_hdr_t));
-
-    Setup_eth_and_sent(sr, (sr_ethernet_hdr_t*) replyPacket,length, route_table);
+    /*setup ICMP: type 8 -> 0, code 0*/
+    uint16_t old_word = htons(icmpHeader->icmp_type << 8 | icmpHeader->icmp_code);
+    icmpHeader->icmp_type = (uint8_t)0;
+    icmpHeader->icmp_code = (uint8_t)0;
+    icmpHeader->icmp_sum = cksum_update16(icmpHeader->icmp_sum, old_word, 0);
+
+    /* setup IP: swapping the addresses leaves the sum as it is */
+    uint32_t ip_src = ipheader->ip_src;
+    ipheader->ip_src = ipheader->ip_dst;
+    ipheader->ip_dst = ip_src;
+    old_word = htons(ipheader->ip_ttl << 8 | ipheader->ip_p);
+    ipheader->ip_ttl = INIT_TTL;
+    ipheader->ip_sum = cksum_update16(ipheader->ip_sum, old_word,
+                         htons(ipheader->ip_ttl << 8 | ipheader->ip_p));
+
+    sr_icmp_reply(sr, packet, length, packet, interface);
   }else{
     return;
   }
@@ -330,12 +384,13 @@ void ICMP_Echo_reply(struct sr_instance* sr, uint8_t * packet,unsigned int lengt
 /*--------------------------------------------------------------------------------------------------------------------------------------------*/
 /*--------------------------------------------------------------------------------------------------------------------------------------------*/
 
-int IpdestonUs(struct sr_instance* sr,sr_ip_hdr_t* Ipheader){
+/*the interface the packet is addressed to, if it is for us*/
+struct sr_if* IpdestonUs(struct sr_instance* sr,sr_ip_hdr_t* Ipheader){
      struct sr_if* interface= sr->if_list;
      while (interface){
         if (Ipheader->ip_dst == interface->ip)
         {
-           return 1;
+           return interface;
         }else{
           interface = interface->next;
         }
@@ -351,16 +406,8 @@ int IpdestonUs(struct sr_instance* sr,sr_ip_hdr_t* Ipheader){
 
 
 int ip_checksum(sr_ip_hdr_t *ip_header) {
-  uint16_t checksum_two, checksum_one = ip_header->ip_sum;
-  int ip_length = ip_header->ip_hl * 4;;
-
-  ip_header->ip_sum = 0;
-  checksum_two = cksum(ip_header, ip_length);
-  ip_header->ip_sum = checksum_one;
-  if (checksum_one != checksum_two) {
-    return 0;
-  }
-  return 1;
+  /*summed as received, so the header is only read*/
+  return cksum_ok(ip_header, ip_header->ip_hl * 4);
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------------*/
@@ -370,6 +417,12 @@ struct sr_rt *find_routing_table(struct sr_instance *sr, uint32_t next_hop) {
   struct sr_rt *ans;
   struct sr_rt *current_table;
   uint32_t current_table_prefix, final_prefix, current_mask;
+  struct sr_fcache *fc = sr_pipeline_fcache(sr);
+
+  /*pipeline workers try their own cache first*/
+  if (fc && sr_fcache_get_route(fc, sr, next_hop, &ans)) {
+    return ans;
+  }
 
   ans = 0;
   
@@ -385,6 +438,10 @@ struct sr_rt *find_routing_table(struct sr_instance *sr, uint32_t next_hop) {
       }
     }
   }
+
+  if (fc) {
+    sr_fcache_put_route(fc, next_hop, ans);
+  }
   return ans;
 }
 
@@ -393,41 +450,96 @@ struct sr_rt *find_routing_table(struct sr_instance *sr, uint32_t next_hop) {
 
 
 void Setup_eth_and_sent(struct sr_instance *sr, sr_ethernet_hdr_t* packet, unsigned int length,struct sr_rt* route)
+{
+   sr_eth_send(sr, packet, length, route, 0);
+}
+
+/*Same, fwd for a frame in transit: time its stages and its way through*/
+static void sr_eth_send(struct sr_instance *sr, sr_ethernet_hdr_t* packet, unsigned int length,struct sr_rt* route, int fwd)
 {
    uint32_t next_hop;
    struct sr_arpentry* arp_entry;
+   struct sr_fcache* fc = sr_pipeline_fcache(sr);
          
    assert(route);
    /*get gw addr first*/
    next_hop = ntohl(route->gw.s_addr);
+
+   packet->ether_type = htons(ethertype_ip);
+   memcpy(packet->ether_shost, sr_get_interface(sr, route->interface)->addr, ETHER_ADDR_LEN);
+   if (fwd)
+      sr_stats_stage(SR_LAT_REWRITE);
+
+   /*pipeline workers try their own cache first*/
+   if (fc && sr_fcache_get_arp(fc, sr, next_hop, packet->ether_dhost))
+   {
+      if (fwd) {
+         sr_stats_stage(SR_LAT_ARP);
+         sr_stats_forward();
+      }
+      sr_send_packet(sr, (uint8_t*) packet, length, route->interface);
+      if (fwd)
+         sr_stats_stage(SR_LAT_SEND);
+      return;
+   }
+
    /*look up cache*/
    arp_entry = sr_arpcache_lookup(&sr->cache, next_hop);
    
-   packet->ether_type = htons(ethertype_ip);
-   memcpy(packet->ether_shost, sr_get_interface(sr, route->interface)->addr, ETHER_ADDR_LEN);
    /*find it*/
    if (arp_entry != NULL)
    {
       memcpy(packet->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
+      if (fwd) {
+         sr_stats_stage(SR_LAT_ARP);
+         sr_stats_forward();
+      }
       sr_send_packet(sr, (uint8_t*) packet, length, route->interface);
+      if (fwd)
+         sr_stats_stage(SR_LAT_SEND);
       
-      free(arp_entry);
+      if (fc)
+      {
+         sr_fcache_put_arp(fc, arp_entry);
+      }
+      sr_mem_free(arp_entry);
    }
    else
    {
-      struct sr_arpreq* arpreq = sr_arpcache_queuereq(&sr->cache, next_hop,(uint8_t*) packet, length, route->interface);
-      struct sr_if* req_iface = sr_get_interface(sr, route->interface);
-      not_in_arp_sent(sr, arpreq,req_iface);
+      struct sr_arpreq* arpreq;
+      time_t now = time(NULL);
+      int send_req = 0;
+
+      if (fwd)
+         sr_stats_stage(SR_LAT_ARP);
+
+      /*queue the packet, and ask at most once a second per next hop*/
+      pthread_mutex_lock(&sr->cache.lock);
+      arpreq = sr_arpcache_queuereq(&sr->cache, next_hop,(uint8_t*) packet, length, route->interface);
+      if (arpreq && difftime(now, arpreq->sent) >= 1.0)
+      {
+         arpreq->sent = now;
+         arpreq->times_sent++;
+         send_req = 1;
+      }
+      pthread_mutex_unlock(&sr->cache.lock);
+
+      if (send_req && !sr_punt_arpreq(sr, next_hop, route->interface))
+      {
+         struct sr_if* req_iface = sr_get_interface(sr, route->interface);
+         not_in_arp_sent(sr, next_hop, req_iface);
+      }
    }
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------------*/
 /*----------------------------------------------------------------------------------------------------------------------------------------------*/
 
-void not_in_arp_sent(struct sr_instance* sr, struct sr_arpreq* request, struct sr_if* req_iface)
+/*Broadcast an ARP request for ip (host byte order) out of req_iface*/
+void not_in_arp_sent(struct sr_instance* sr, uint32_t ip, struct sr_if* req_iface)
 {
 
-   uint8_t* packet = (uint8_t *) malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
+   uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
 
    sr_ethernet_hdr_t* eth_header = (sr_ethernet_hdr_t*) packet;
 
@@ -441,7 +553,7 @@ void not_in_arp_sent(struct sr_instance* sr, struct sr_arpreq* request, struct s
    arp_header->ar_hrd = htons(arp_hrd_ethernet);
    arp_header->ar_pro = htons(ethertype_ip);
    arp_header->ar_op = htons(arp_op_request);
-   arp_header->ar_tip = htonl(request->ip);
+   arp_header->ar_tip = htonl(ip);
    memcpy(arp_header->ar_sha, req_iface->addr, ETHER_ADDR_LEN);
    memset(arp_header->ar_tha, 0, ETHER_ADDR_LEN);
 
@@ -457,135 +569,3 @@ void not_in_arp_sent(struct sr_instance* sr, struct sr_arpreq* request, struct s
 
 /*----------------------------------------------------------------------------------------------------------------------------------------------*/
 /*----------------------------------------------------------------------------------------------------------------------------------------------*/
-
-void ICMP_Port_unreachable(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface){
-
-  sr_ip_hdr_t* ipheader = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
-
-  struct sr_rt *route_table = find_routing_table(sr, ipheader->ip_src);
-
-  if (!route_table) {
-      return;
-  }
-
-  
-  uint8_t* replyPacket = (uint8_t *)malloc(sizeof(sr_icmp_t3_hdr_t)  + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-
-  sr_ip_hdr_t *replyIpHeader = (sr_ip_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t));
-  sr_icmp_t3_hdr_t *replyIcmpHeader = (sr_icmp_t3_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)); 
-
-  /*setup ICMP*/
-  replyIcmpHeader->icmp_type = (uint8_t)3;
-  replyIcmpHeader->icmp_code = (uint8_t)3;
-  replyIcmpHeader->icmp_sum = (uint16_t)0;
-  replyIcmpHeader->unused = 0;
-  replyIcmpHeader->next_mtu = 0;
-  memcpy(&replyIcmpHeader->data[0], ipheader, ICMP_DATA_SIZE);
-  replyIcmpHeader->icmp_sum = cksum(replyIcmpHeader, sizeof(sr_icmp_t3_hdr_t));
-
-  /* setup IP */
-  memcpy(replyIpHeader, ipheader, sizeof(sr_ip_hdr_t));
-  replyIpHeader->ip_src = ipheader->ip_dst;
-  replyIpHeader->ip_dst = ipheader->ip_src;
-  replyIpHeader->ip_ttl = INIT_TTL;
-  replyIpHeader->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-  replyIpHeader->ip_tos = 0;
-  replyIpHeader->ip_p = ip_protocol_icmp;
-  replyIpHeader->ip_sum = 0;
-  replyIpHeader->ip_sum = cksum(replyIpHeader, sizeof(sr_ip_hdr_t));
-
-  Setup_eth_and_sent(sr, (sr_ethernet_hdr_t*) replyPacket,sizeof(sr_icmp_t3_hdr_t)  + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), route_table);
-
-}
-
-
-/*----------------------------------------------------------------------------------------------------------------------------------------------*/
-/*----------------------------------------------------------------------------------------------------------------------------------------------*/
-
-
-void ICMP_Network_unreachable(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface){
-
-  struct sr_if *iface = sr_get_interface(sr, interface);
-  sr_ip_hdr_t* ipheader = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
-
-  struct sr_rt *route_table = find_routing_table(sr, ipheader->ip_src);
-
-  if (!route_table) {
-      return;
-  }
-
-  
-  uint8_t* replyPacket = (uint8_t *)malloc(sizeof(sr_icmp_t3_hdr_t)  + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-
-  sr_ip_hdr_t *replyIpHeader = (sr_ip_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t));
-  sr_icmp_t3_hdr_t *replyIcmpHeader = (sr_icmp_t3_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)); 
-
-  /*setup ICMP*/
-  replyIcmpHeader->icmp_type = (uint8_t)3;
-  replyIcmpHeader->icmp_code = (uint8_t)0;
-  replyIcmpHeader->icmp_sum = (uint16_t)0;
-  replyIcmpHeader->unused = 0;
-  replyIcmpHeader->next_mtu = 0;
-  memcpy(&replyIcmpHeader->data[0], ipheader, ICMP_DATA_SIZE);
-  replyIcmpHeader->icmp_sum = cksum(replyIcmpHeader, sizeof(sr_icmp_t3_hdr_t));
-
-  /* setup IP */
-  memcpy(replyIpHeader, ipheader, sizeof(sr_ip_hdr_t));
-  replyIpHeader->ip_src = iface->ip;
-  replyIpHeader->ip_dst = ipheader->ip_src;
-  replyIpHeader->ip_ttl = DEFAULT_TTL;
-  replyIpHeader->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-  replyIpHeader->ip_tos = 0;
-  replyIpHeader->ip_p = ip_protocol_icmp;
-  replyIpHeader->ip_sum = 0;
-  replyIpHeader->ip_sum = cksum(replyIpHeader, sizeof(sr_ip_hdr_t));
-
-  Setup_eth_and_sent(sr, (sr_ethernet_hdr_t*) replyPacket,sizeof(sr_icmp_t3_hdr_t)  + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), route_table);
-
-}
-
-/*----------------------------------------------------------------------------------------------------------------------------------------------*/
-/*----------------------------------------------------------------------------------------------------------------------------------------------*/
-
-void ICMP_time_exceeded(struct sr_instance* sr, uint8_t * packet,unsigned int length,char* interface){
-
-  struct sr_if *iface = sr_get_interface(sr, interface);
-  sr_ip_hdr_t* ipheader = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
-
-  struct sr_rt *route_table = find_routing_table(sr, ipheader->ip_src);
-
-  if (!route_table) {
-      return;
-  }
-
-  
-  uint8_t* replyPacket = (uint8_t *)malloc(sizeof(sr_icmp_t11_hdr_t)  + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-
-  sr_ip_hdr_t *replyIpHeader = (sr_ip_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t));
-  sr_icmp_t11_hdr_t *replyIcmpHeader = (sr_icmp_t11_hdr_t *)(replyPacket + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)); 
-
-  /*setup ICMP*/
-  replyIcmpHeader->icmp_type = (uint8_t)11;
-  replyIcmpHeader->icmp_code = (uint8_t)0;
-  replyIcmpHeader->icmp_sum = (uint16_t)0;
-  replyIcmpHeader->unused = 0;
-  memcpy(&replyIcmpHeader->data[0], ipheader, ICMP_T11_DATA_SIZE);
-  replyIcmpHeader->icmp_sum = cksum(replyIcmpHeader, sizeof(sr_icmp_t11_hdr_t));
-
-  /* setup IP */
-  memcpy(replyIpHeader, ipheader, sizeof(sr_ip_hdr_t));
-  replyIpHeader->ip_src = iface->ip;
-  replyIpHeader->ip_dst = ipheader->ip_src;
-  replyIpHeader->ip_ttl = DEFAULT_TTL;
-  replyIpHeader->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t11_hdr_t));
-  replyIpHeader->ip_tos = 0;
-  replyIpHeader->ip_p = ip_protocol_icmp;
-  replyIpHeader->ip_sum = 0;
-  replyIpHeader->ip_sum = cksum(replyIpHeader, sizeof(sr_ip_hdr_t));
-
-  Setup_eth_and_sent(sr, (sr_ethernet_hdr_t*) replyPacket,sizeof(sr_icmp_t11_hdr_t)  + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t), route_table);
-
-}
-
-/*----------------------------------------------------------------------------------------------------------------------------------------------*/
-/*----------------------------------------------------------------------------------------------------------------------------------------------*/
@@ -33,6 +33,12 @@
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_backend;
+struct sr_pipeline;
+struct sr_punt;
+struct sr_icmp_limit;
+struct pollfd;
+struct sr_capture;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -51,22 +57,85 @@ struct sr_instance
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
     struct sr_rt* routing_table; /* routing table */
+    unsigned int rt_gen;        /* bumped when the routing table is loaded */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_capture* capture; /* -l packet capture, 0 when off */
+    struct sr_backend* backend; /* data path, 0 for the VNS session */
+    struct sr_pipeline* pipeline; /* threaded forwarding, 0 when inline */
+    struct sr_punt* punt;       /* control thread, 0 when handled inline */
+    struct sr_icmp_limit* icmp_limit; /* 0 when ICMP errors are unlimited */
+    int reply_path;             /* enum sr_reply_path, see sr_icmp.h */
+    int busy_poll;              /* usecs to spin for input, 0 = block */
+    pthread_mutex_t send_lock;  /* serializes writers while pipelined */
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_options
+ *
+ * Settings for one virtual router, from the command line or from a line
+ * of the multi-instance config (see sr_multi.c)
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_options
+{
+    char* host;           /* -v */
+    char* user;           /* -u */
+    char* server;         /* -s */
+    char* rtable;         /* -r */
+    char* template;       /* -T */
+    unsigned int port;    /* -p */
+    unsigned int topo;    /* -t */
+    char* logfile;        /* -l */
+    char* backend;        /* -B */
+    char* ifconfig;       /* -I */
+    char* replay;         /* -R capture to replay */
+    char* replay_map;     /* -m ingress mapping for the replay */
+    char* replay_out;     /* -w capture of transmitted frames */
+    double replay_speed;  /* -x timing scale, 0 = full speed */
+    char* shm_path;       /* -S socket the shm peer offers its rings on */
+    int busy_poll;        /* -b usecs to spin for input before blocking */
+};
+
+#define SR_BUSY_POLL_US 1000      /* spin budget of a plain -b */
+
 /* -- sr_main.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
+void sr_default_options(struct sr_options* );
+int  sr_parse_option(struct sr_options* , int , char* );
+void sr_init_instance(struct sr_instance* );
+int  sr_setup_instance(struct sr_instance* , struct sr_options* );
+void sr_destroy_instance(struct sr_instance* );
+
+/* -- sr_multi.c -- */
+int sr_multi_run(const char* config, struct sr_options* defaults, int workers);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_direct(struct sr_instance* , uint8_t* , unsigned int ,
+                          const char*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_read_from_server_expect(struct sr_instance* , int );
+void sr_receive_packet(struct sr_instance* , uint8_t* , unsigned int , char* );
+int sr_wait_input(struct sr_instance* , struct pollfd* , int , int );
+
+/* -- sr_pipeline.c -- */
+int  sr_pipeline_start(struct sr_instance* , int , unsigned int , unsigned int );
+void sr_pipeline_stop(struct sr_instance* );
+void sr_pipeline_rx(struct sr_instance* , uint8_t* , unsigned int , const char* );
+int  sr_pipeline_tx(struct sr_instance* , uint8_t* , unsigned int , const char* );
+void sr_pipeline_print_stats(struct sr_instance* , FILE* );
+struct sr_fcache* sr_pipeline_fcache(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
+void sr_init_state(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void not_in_arp_sent(struct sr_instance* , uint32_t , struct sr_if* );
+struct sr_rt* find_routing_table(struct sr_instance* , uint32_t );
+void Setup_eth_and_sent(struct sr_instance* , sr_ethernet_hdr_t* , unsigned int , struct sr_rt* );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 
 #include <sys/socket.h>
@@ -21,6 +22,7 @@
 
 #include "sr_rt.h"
 #include "sr_router.h"
+#include "sr_mem.h"
 
 /*---------------------------------------------------------------------
  * Method:
@@ -39,6 +41,8 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
     struct in_addr gw_addr;
     struct in_addr mask_addr;
     int clear_routing_table = 0;
+    int ret = 0;
+    struct sr_rt* old_table = sr->routing_table;
 
     /* -- REQUIRES -- */
     assert(filename);
@@ -58,21 +62,24 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     dest);
-            return -1; 
+            ret = -1;
+            break;
         }
         if(inet_aton(gw,&gw_addr) == 0)
         { 
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     gw);
-            return -1; 
+            ret = -1;
+            break;
         }
         if(inet_aton(mask,&mask_addr) == 0)
         { 
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     mask);
-            return -1; 
+            ret = -1;
+            break;
         }
         if( clear_routing_table == 0 ){
             printf("Loading routing table from server, clear local routing table.\n");
@@ -82,6 +89,24 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
         sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
     } /* -- while -- */
 
+    fclose(fp);
+
+    if( !clear_routing_table )
+    { return ret; } /* -- nothing loaded, the old table stays -- */
+
+    if( ret != 0 )
+    {
+        /* -- keep the old table rather than half of the new one -- */
+        sr_free_rt(sr->routing_table);
+        sr->routing_table = old_table;
+        return ret;
+    }
+
+    /* -- cached lookups of the old table are stale now; tables are only
+          reloaded before forwarding starts, so nobody is still reading it -- */
+    __atomic_add_fetch(&sr->rt_gen, 1, __ATOMIC_RELEASE);
+    sr_rt_unshare(old_table);
+
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
@@ -102,7 +127,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     /* -- empty list special case -- */
     if(sr->routing_table == 0)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+        sr->routing_table = (struct sr_rt*)sr_mem_alloc(SR_MEM_ROUTES, sizeof(struct sr_rt));
         assert(sr->routing_table);
         sr->routing_table->next = 0;
         sr->routing_table->dest = dest;
@@ -119,7 +144,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
       rt_walker = rt_walker->next; 
     }
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+    rt_walker->next = (struct sr_rt*)sr_mem_alloc(SR_MEM_ROUTES, sizeof(struct sr_rt));
     assert(rt_walker->next);
     rt_walker = rt_walker->next;
 
@@ -176,3 +201,120 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\n",entry->interface);
 
 } /* -- sr_print_routing_entry -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_share(..) / sr_rt_unshare(..)
+ *
+ * Routing tables of instances hosted in the same process (see
+ * sr_multi.c) are interned: a freshly loaded table that is identical,
+ * entry for entry, to one already in use is freed and the existing one
+ * is shared read-only instead.  sr_rt_unshare() drops a reference and
+ * frees the table with the last one; a table that was never shared is
+ * freed right away, so it releases any instance's table.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt_shared
+{
+    struct sr_rt* table;
+    int refs;
+    struct sr_rt_shared* next;
+};
+
+static struct sr_rt_shared* sr_rt_shared_list = 0;
+static pthread_mutex_t sr_rt_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sr_rt_equal(struct sr_rt* a, struct sr_rt* b)
+{
+    for( ; a && b; a = a->next, b = b->next)
+    {
+        if(a->dest.s_addr != b->dest.s_addr || a->gw.s_addr != b->gw.s_addr ||
+           a->mask.s_addr != b->mask.s_addr ||
+           strncmp(a->interface, b->interface, sr_IFACE_NAMELEN) != 0)
+        { return 0; }
+    }
+    return a == b;
+}
+
+void sr_free_rt(struct sr_rt* table)
+{
+    struct sr_rt* next;
+    for( ; table; table = next)
+    {
+        next = table->next;
+        sr_mem_free(table);
+    }
+}
+
+struct sr_rt* sr_rt_share(struct sr_rt* table)
+{
+    struct sr_rt_shared* sh;
+
+    if(!table)
+    { return 0; }
+
+    pthread_mutex_lock(&sr_rt_shared_lock);
+    for(sh = sr_rt_shared_list; sh; sh = sh->next)
+    {
+        if(sr_rt_equal(sh->table, table))
+        { break; }
+    }
+
+    if(sh)
+    {
+        sr_free_rt(table);
+    }
+    else
+    {
+        sh = (struct sr_rt_shared*)sr_mem_calloc(SR_MEM_ROUTES, sizeof(struct sr_rt_shared));
+        assert(sh);
+        sh->table = table;
+        sh->next = sr_rt_shared_list;
+        sr_rt_shared_list = sh;
+    }
+    sh->refs++;
+    pthread_mutex_unlock(&sr_rt_shared_lock);
+
+    return sh->table;
+} /* -- sr_rt_share -- */
+
+void sr_rt_unshare(struct sr_rt* table)
+{
+    struct sr_rt_shared *sh, *prev = 0;
+
+    pthread_mutex_lock(&sr_rt_shared_lock);
+    for(sh = sr_rt_shared_list; sh; prev = sh, sh = sh->next)
+    {
+        if(sh->table == table)
+        { break; }
+    }
+
+    if(sh && --sh->refs == 0)
+    {
+        if(prev)
+        { prev->next = sh->next; }
+        else
+        { sr_rt_shared_list = sh->next; }
+        sr_free_rt(sh->table);
+        sr_mem_free(sh);
+    }
+    else if(!sh)
+    {
+        sr_free_rt(table); /* -- never shared, the caller's alone -- */
+    }
+    pthread_mutex_unlock(&sr_rt_shared_lock);
+} /* -- sr_rt_unshare -- */
+
+/* number of distinct tables currently shared */
+int sr_rt_shared_count(void)
+{
+    struct sr_rt_shared* sh;
+    int n = 0;
+
+    pthread_mutex_lock(&sr_rt_shared_lock);
+    for(sh = sr_rt_shared_list; sh; sh = sh->next)
+    { n++; }
+    pthread_mutex_unlock(&sr_rt_shared_lock);
+
+    return n;
+}
@@ -42,6 +42,12 @@ void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
+void sr_free_rt(struct sr_rt* table);
+
+/* -- sharing identical tables between instances of one process -- */
+struct sr_rt* sr_rt_share(struct sr_rt* table);
+void sr_rt_unshare(struct sr_rt* table);
+int  sr_rt_shared_count(void);
 
 
 #endif  /* --  sr_RT_H -- */
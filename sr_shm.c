@@ -0,0 +1,247 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory backend for a co-located VNS peer (see sr_shmring.h).
+ * The VNS session is still used for the handshake, hardware info and
+ * control messages, but frames in both directions move through the
+ * per-interface rings of a segment the peer hands over on a Unix socket.
+ *
+ * When idle the poll loop sleeps on the ring eventfd together with the
+ * VNS socket.  With busy polling it first keeps spinning on the rings for
+ * up to busy_poll usecs after the last frame, so under load the peer
+ * never has to make a system call to wake it up.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_backend.h"
+#include "sr_shmring.h"
+#include "sr_router.h"
+#include "sr_log.h"
+
+#define SR_SHM_RX_BATCH   64     /* frames drained per interface per pass */
+#define SR_SHM_POLL_MS    100
+#define SR_SHM_CTL_EVERY  1024   /* busy passes between checks of the socket */
+
+struct sr_shm_state
+{
+    struct sr_shm shm;
+    int busy_poll;         /* usecs to spin after the last frame */
+    struct timespec last_rx;
+    unsigned int passes;   /* poll passes since the socket was last checked */
+    pthread_mutex_t tx_lock[SR_SHM_MAX_IFS];
+
+    unsigned long rx_frames;
+    unsigned long tx_frames;
+    unsigned long tx_drops;
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_send(..)
+ * Scope: Local
+ *
+ * Backend send op.  Frames are copied into the interface's ring towards
+ * the peer; a full ring drops the frame.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_shm_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       const char* iface)
+{
+    struct sr_shm_state* st = sr->backend->priv;
+    int idx = sr_shm_find(&st->shm, iface);
+    int ret;
+
+    if (idx < 0)
+    {
+        sr_log_err(SR_LOG_IO, "sr_shm: send on unknown interface %s", iface);
+        return -1;
+    }
+
+    pthread_mutex_lock(&st->tx_lock[idx]);
+    ret = sr_shm_push(&st->shm, idx, buf, len);
+    pthread_mutex_unlock(&st->tx_lock[idx]);
+
+    if (ret != 0)
+    {
+        st->tx_drops++;
+        return -1;
+    }
+    st->tx_frames++;
+    return 0;
+} /* -- sr_shm_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_ctl_ready(..)
+ * Scope: Local
+ *
+ * Whether a VNS control message is waiting on the session socket.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_shm_ctl_ready(struct sr_instance* sr)
+{
+    struct pollfd pfd;
+
+    pfd.fd = sr->sockfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* -- whether busy polling should keep spinning rather than sleep -- */
+static int sr_shm_spin(struct sr_shm_state* st)
+{
+    struct timespec now;
+
+    if (!st->busy_poll)
+    { return 0; }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - st->last_rx.tv_sec) * 1000000L +
+           (now.tv_nsec - st->last_rx.tv_nsec) / 1000 < st->busy_poll;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_poll(..)
+ * Scope: Local
+ *
+ * Backend poll op: drain up to SR_SHM_RX_BATCH frames from each ring
+ * towards the router.  When nothing arrived (and busy polling has spun
+ * long enough), wait for frames or for a control message, and hand
+ * control messages to sr_read_from_server_expect(); its result (0 on
+ * VNSCLOSE) ends the main loop just as with the plain VNS session.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_shm_poll(struct sr_instance* sr)
+{
+    struct sr_shm_state* st = sr->backend->priv;
+    int nifs = sr_shm_nifs(&st->shm);
+    int i, n, got = 0;
+
+    /* -- frames are only meaningful once the hardware info is in -- */
+    if (!sr->if_list)
+    { return sr_read_from_server_expect(sr, 0); }
+
+    for (i = 0; i < nifs; i++)
+    {
+        for (n = 0; n < SR_SHM_RX_BATCH; n++)
+        {
+            unsigned int len;
+            uint8_t* frame = sr_shm_peek(&st->shm, i, &len);
+
+            if (!frame)
+            { break; }
+            sr_receive_packet(sr, frame, len, (char*)sr_shm_name(&st->shm, i));
+            sr_shm_consume(&st->shm, i);
+        }
+        got += n;
+    }
+    st->rx_frames += got;
+    if (got && st->busy_poll)
+    { clock_gettime(CLOCK_MONOTONIC, &st->last_rx); }
+
+    /* -- keep an eye on the session even while the rings stay busy -- */
+    if (got || sr_shm_spin(st))
+    {
+        if (++st->passes < SR_SHM_CTL_EVERY)
+        { return 1; }
+        st->passes = 0;
+        return sr_shm_ctl_ready(sr) ? sr_read_from_server_expect(sr, 0) : 1;
+    }
+
+    st->passes = 0;
+    if (sr_shm_wait(&st->shm, sr->sockfd, SR_SHM_POLL_MS) & SR_SHM_WAKE_FD)
+    { return sr_read_from_server_expect(sr, 0); }
+
+    return 1;
+} /* -- sr_shm_poll -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_backend_close(..)
+ * Scope: Local
+ *---------------------------------------------------------------------*/
+
+static void sr_shm_backend_close(struct sr_instance* sr)
+{
+    struct sr_shm_state* st = sr->backend->priv;
+    int i;
+
+    sr_log_debug(SR_LOG_IO, "shm: rx %lu tx %lu tx drops %lu", st->rx_frames,
+                 st->tx_frames, st->tx_drops);
+    for (i = 0; i < SR_SHM_MAX_IFS; i++)
+    { pthread_mutex_destroy(&st->tx_lock[i]); }
+    if (st->shm.hdr)
+    {
+        for (i = 0; i < sr_shm_nifs(&st->shm); i++)
+        {
+            sr_log_debug(SR_LOG_IO, "%s: peer ring drops %lu",
+                         sr_shm_name(&st->shm, i),
+                         sr_shm_drops(&st->shm, i, SR_SHM_ROUTER));
+        }
+    }
+    sr_shm_close(&st->shm);
+
+    free(st);
+    free(sr->backend);
+    sr->backend = 0;
+} /* -- sr_shm_backend_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_open(..)
+ * Scope: Global
+ *
+ * Attach to the segment offered by the VNS peer at path and install the
+ * backend.  Must be called after sr_connect_to_server(), since the
+ * session socket keeps carrying control messages.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_open(struct sr_instance* sr, const char* path, int busy_poll)
+{
+    struct sr_shm_state* st;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(path);
+
+    st = (struct sr_shm_state*)calloc(1, sizeof(struct sr_shm_state));
+    assert(st);
+    st->busy_poll = busy_poll;
+    for (i = 0; i < SR_SHM_MAX_IFS; i++)
+    { pthread_mutex_init(&st->tx_lock[i], 0); }
+
+    sr->backend = (struct sr_backend*)calloc(1, sizeof(struct sr_backend));
+    assert(sr->backend);
+    sr->backend->name = "shm";
+    sr->backend->send = sr_shm_send;
+    sr->backend->poll = sr_shm_poll;
+    sr->backend->close = sr_shm_backend_close;
+    sr->backend->priv = st;
+
+    if (sr_shm_attach(&st->shm, path) != 0)
+    {
+        sr_shm_backend_close(sr);
+        return -1;
+    }
+
+    printf("attached to shared memory rings at %s (%d interfaces%s)\n", path,
+           sr_shm_nifs(&st->shm), busy_poll ? ", busy polling" : "");
+    return 0;
+} /* -- sr_shm_open -- */
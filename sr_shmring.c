@@ -0,0 +1,512 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shmring.c
+ *
+ * Description:
+ *
+ * Shared memory SPSC frame rings, see sr_shmring.h.
+ *
+ * Segment layout: a header (interface names, ring geometry and one
+ * "going to sleep" flag per side), followed by two rings per interface.
+ * Ring 2*i carries frames towards the router, ring 2*i+1 towards the
+ * peer.  Each ring is a head index written only by its producer, a tail
+ * index written only by its consumer (on separate cache lines), and a
+ * power of two number of fixed size slots holding a length word and the
+ * frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifdef _LINUX_
+#include <sys/eventfd.h>
+#endif /* _LINUX_ */
+
+#include "sr_shmring.h"
+
+#define SR_SHM_MAGIC     0x53524d31 /* "SRM1" */
+#define SR_SHM_CACHELINE 64
+
+struct sr_shm_flag
+{
+    uint32_t v;
+} __attribute__ ((aligned(SR_SHM_CACHELINE)));
+
+struct sr_shm_ring
+{
+    struct sr_shm_flag head;   /* next slot to produce, producer only */
+    struct sr_shm_flag tail;   /* next slot to consume, consumer only */
+    struct sr_shm_flag drops;  /* frames refused because the ring was full,
+                                  or dropped by the consumer as malformed */
+};
+
+struct sr_shm_hdr
+{
+    uint32_t magic;
+    uint32_t nifs;
+    uint32_t slots;
+    uint32_t slot_size;
+    char names[SR_SHM_MAX_IFS][sr_IFACE_NAMELEN];
+    struct sr_shm_flag waiting[2]; /* side is about to sleep on its eventfd */
+};
+
+#define SR_SHM_ALIGN(x) (((x) + SR_SHM_CACHELINE - 1) & ~(SR_SHM_CACHELINE - 1))
+
+static size_t sr_shm_ring_size(unsigned int slots)
+{
+    return SR_SHM_ALIGN(sizeof(struct sr_shm_ring)) +
+           (size_t)slots * SR_SHM_SLOT_SZ;
+}
+
+static size_t sr_shm_size(int nifs, unsigned int slots)
+{
+    return SR_SHM_ALIGN(sizeof(struct sr_shm_hdr)) +
+           2 * (size_t)nifs * sr_shm_ring_size(slots);
+}
+
+static struct sr_shm_ring* sr_shm_ring(struct sr_shm* shm, int ifidx,
+                                       int to_side)
+{
+    return (struct sr_shm_ring*)((uint8_t*)shm->hdr +
+        SR_SHM_ALIGN(sizeof(struct sr_shm_hdr)) +
+        (2 * (size_t)ifidx + to_side) * sr_shm_ring_size(shm->slots));
+}
+
+static uint8_t* sr_shm_slot(struct sr_shm* shm, struct sr_shm_ring* ring,
+                            uint32_t idx)
+{
+    return (uint8_t*)ring + SR_SHM_ALIGN(sizeof(struct sr_shm_ring)) +
+           (size_t)(idx & (shm->slots - 1)) * SR_SHM_SLOT_SZ;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_create(..)
+ * Scope: Global
+ *
+ * Peer side: create a segment with a ring pair for each of the nifs
+ * interfaces in names, and the two eventfds.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_create(struct sr_shm* shm, char names[][sr_IFACE_NAMELEN],
+                  int nifs, unsigned int slots)
+{
+#ifdef _LINUX_
+    int i;
+
+    assert(shm);
+    assert(nifs > 0 && nifs <= SR_SHM_MAX_IFS);
+    assert(slots && (slots & (slots - 1)) == 0);
+
+    memset(shm, 0, sizeof(*shm));
+    shm->side = SR_SHM_PEER;
+    shm->mem_fd = shm->efd_rx = shm->efd_tx = -1;
+    shm->nifs = nifs;
+    shm->slots = slots;
+    shm->len = sr_shm_size(nifs, slots);
+
+    if ((shm->mem_fd = memfd_create("sr_shm", 0)) < 0 ||
+        ftruncate(shm->mem_fd, shm->len) < 0)
+    {
+        perror("memfd_create(..):sr_shmring.c::sr_shm_create");
+        return -1;
+    }
+
+    shm->hdr = mmap(0, shm->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    shm->mem_fd, 0);
+    if (shm->hdr == MAP_FAILED)
+    {
+        perror("mmap(..):sr_shmring.c::sr_shm_create");
+        close(shm->mem_fd);
+        return -1;
+    }
+
+    shm->hdr->nifs = nifs;
+    shm->hdr->slots = slots;
+    shm->hdr->slot_size = SR_SHM_SLOT_SZ;
+    for (i = 0; i < nifs; i++)
+    { strncpy(shm->hdr->names[i], names[i], sr_IFACE_NAMELEN); }
+
+    shm->efd_rx = eventfd(0, EFD_NONBLOCK);
+    shm->efd_tx = eventfd(0, EFD_NONBLOCK);
+    if (shm->efd_rx < 0 || shm->efd_tx < 0)
+    {
+        perror("eventfd(..):sr_shmring.c::sr_shm_create");
+        return -1;
+    }
+
+    __atomic_store_n(&shm->hdr->magic, SR_SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+#else
+    fprintf(stderr, "shared memory rings are only supported on Linux\n");
+    return -1;
+#endif /* _LINUX_ */
+} /* -- sr_shm_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_listen(..)
+ * Scope: Global
+ *
+ * Peer side: listen on the Unix socket the router attaches through.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_listen(const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 1) < 0)
+    {
+        perror("socket/bind/listen(..):sr_shmring.c::sr_shm_listen");
+        return -1;
+    }
+    return fd;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_offer(..)
+ * Scope: Global
+ *
+ * Peer side: accept the router on listen_fd and pass it the segment and
+ * the eventfds (towards the router first).
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_offer(struct sr_shm* shm, int listen_fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int fds[3];
+    char c = 'S';
+    int fd;
+
+    if ((fd = accept(listen_fd, 0, 0)) < 0)
+    {
+        perror("accept(..):sr_shmring.c::sr_shm_offer");
+        return -1;
+    }
+
+    fds[0] = shm->mem_fd;
+    fds[1] = shm->efd_tx;   /* wakes the router */
+    fds[2] = shm->efd_rx;   /* wakes the peer */
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &msg, 0) != 1)
+    {
+        perror("sendmsg(..):sr_shmring.c::sr_shm_offer");
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+} /* -- sr_shm_offer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_attach(..)
+ * Scope: Global
+ *
+ * Router side: connect to the peer's socket at path, receive the segment
+ * and eventfds and map the segment.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_attach(struct sr_shm* shm, const char* path)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    struct stat st;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int fds[3];
+    uint32_t nifs, slots;
+    char c;
+    int fd;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->side = SR_SHM_ROUTER;
+    shm->mem_fd = shm->efd_rx = shm->efd_tx = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_shmring.c::sr_shm_attach");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect(..):sr_shmring.c::sr_shm_attach");
+        close(fd);
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    if (recvmsg(fd, &msg, 0) != 1 || (cmsg = CMSG_FIRSTHDR(&msg)) == 0 ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        fprintf(stderr, "sr_shm_attach: no segment received from %s\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    shm->mem_fd = fds[0];
+    shm->efd_rx = fds[1];
+    shm->efd_tx = fds[2];
+
+    if (fstat(shm->mem_fd, &st) < 0)
+    {
+        perror("fstat(..):sr_shmring.c::sr_shm_attach");
+        return -1;
+    }
+    shm->len = st.st_size;
+    shm->hdr = mmap(0, shm->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    shm->mem_fd, 0);
+    if (shm->hdr == MAP_FAILED)
+    {
+        perror("mmap(..):sr_shmring.c::sr_shm_attach");
+        shm->hdr = 0;
+        return -1;
+    }
+
+    /* -- the header is the peer's to write: read it once, check that,
+          and use only the copy -- */
+    nifs = __atomic_load_n(&shm->hdr->nifs, __ATOMIC_RELAXED);
+    slots = __atomic_load_n(&shm->hdr->slots, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&shm->hdr->magic, __ATOMIC_ACQUIRE) != SR_SHM_MAGIC ||
+        shm->hdr->slot_size != SR_SHM_SLOT_SZ ||
+        nifs == 0 || nifs > SR_SHM_MAX_IFS ||
+        slots == 0 || (slots & (slots - 1)) != 0 ||
+        slots > (SIZE_MAX - SR_SHM_ALIGN(sizeof(struct sr_shm_hdr))) /
+                (2 * SR_SHM_MAX_IFS) / (2 * SR_SHM_SLOT_SZ) ||
+        shm->len < sr_shm_size(nifs, slots))
+    {
+        fprintf(stderr, "sr_shm_attach: segment from %s is not usable\n", path);
+        return -1;
+    }
+    shm->nifs = nifs;
+    shm->slots = slots;
+
+    return 0;
+} /* -- sr_shm_attach -- */
+
+void sr_shm_close(struct sr_shm* shm)
+{
+    if (shm->hdr)
+    { munmap(shm->hdr, shm->len); }
+    if (shm->mem_fd >= 0)
+    { close(shm->mem_fd); }
+    if (shm->efd_rx >= 0)
+    { close(shm->efd_rx); }
+    if (shm->efd_tx >= 0)
+    { close(shm->efd_tx); }
+    memset(shm, 0, sizeof(*shm));
+    shm->mem_fd = shm->efd_rx = shm->efd_tx = -1;
+}
+
+int sr_shm_nifs(struct sr_shm* shm)
+{
+    return shm->nifs;
+}
+
+const char* sr_shm_name(struct sr_shm* shm, int ifidx)
+{
+    return shm->hdr->names[ifidx];
+}
+
+int sr_shm_find(struct sr_shm* shm, const char* name)
+{
+    int i;
+    for (i = 0; i < shm->nifs; i++)
+    {
+        if (strncmp(shm->hdr->names[i], name, sr_IFACE_NAMELEN) == 0)
+        { return i; }
+    }
+    return -1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_push(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+int sr_shm_push(struct sr_shm* shm, int ifidx, const uint8_t* buf,
+                unsigned int len)
+{
+    int to = !shm->side;
+    struct sr_shm_ring* ring = sr_shm_ring(shm, ifidx, to);
+    uint32_t head = ring->head.v;
+    uint32_t tail = __atomic_load_n(&ring->tail.v, __ATOMIC_ACQUIRE);
+    uint8_t* slot;
+
+    if (head - tail >= shm->slots ||
+        len > SR_SHM_SLOT_SZ - sizeof(uint32_t))
+    {
+        __atomic_fetch_add(&ring->drops.v, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    slot = sr_shm_slot(shm, ring, head);
+    *(uint32_t*)slot = len;
+    memcpy(slot + sizeof(uint32_t), buf, len);
+    __atomic_store_n(&ring->head.v, head + 1, __ATOMIC_RELEASE);
+
+    /* pairs with the fence in sr_shm_wait(): either the consumer sees
+       the new head or we see its waiting flag */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->hdr->waiting[to].v, __ATOMIC_RELAXED))
+    {
+        uint64_t one = 1;
+        if (write(shm->efd_tx, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        { perror("write(..):sr_shmring.c::sr_shm_push"); }
+    }
+
+    return 0;
+} /* -- sr_shm_push -- */
+
+int sr_shm_full(struct sr_shm* shm, int ifidx)
+{
+    struct sr_shm_ring* ring = sr_shm_ring(shm, ifidx, !shm->side);
+    return ring->head.v - __atomic_load_n(&ring->tail.v, __ATOMIC_ACQUIRE) >=
+           shm->slots;
+}
+
+uint8_t* sr_shm_peek(struct sr_shm* shm, int ifidx, unsigned int* len)
+{
+    struct sr_shm_ring* ring = sr_shm_ring(shm, ifidx, shm->side);
+    uint32_t tail = ring->tail.v;
+    uint8_t* slot;
+
+    /* -- the length word is the peer's too: drop frames that claim to
+          run past their slot -- */
+    while (__atomic_load_n(&ring->head.v, __ATOMIC_ACQUIRE) != tail)
+    {
+        slot = sr_shm_slot(shm, ring, tail);
+        *len = __atomic_load_n((uint32_t*)slot, __ATOMIC_RELAXED);
+        if (*len <= SR_SHM_SLOT_SZ - sizeof(uint32_t))
+        { return slot + sizeof(uint32_t); }
+
+        __atomic_fetch_add(&ring->drops.v, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->tail.v, ++tail, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+void sr_shm_consume(struct sr_shm* shm, int ifidx)
+{
+    struct sr_shm_ring* ring = sr_shm_ring(shm, ifidx, shm->side);
+    __atomic_store_n(&ring->tail.v, ring->tail.v + 1, __ATOMIC_RELEASE);
+}
+
+int sr_shm_pending(struct sr_shm* shm)
+{
+    int i;
+    for (i = 0; i < shm->nifs; i++)
+    {
+        struct sr_shm_ring* ring = sr_shm_ring(shm, i, shm->side);
+        if (__atomic_load_n(&ring->head.v, __ATOMIC_ACQUIRE) != ring->tail.v)
+        { return 1; }
+    }
+    return 0;
+}
+
+unsigned long sr_shm_drops(struct sr_shm* shm, int ifidx, int to_side)
+{
+    return __atomic_load_n(&sr_shm_ring(shm, ifidx, to_side)->drops.v,
+                           __ATOMIC_RELAXED);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_wait(..)
+ * Scope: Global
+ *
+ * Announce that this side is going to sleep, re-check the rings and
+ * block on the eventfd (and extra_fd).  Producers that see the
+ * announcement write the eventfd.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_wait(struct sr_shm* shm, int extra_fd, int timeout_ms)
+{
+    struct pollfd pfds[2];
+    int mask = 0;
+
+    __atomic_store_n(&shm->hdr->waiting[shm->side].v, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (sr_shm_pending(shm))
+    {
+        __atomic_store_n(&shm->hdr->waiting[shm->side].v, 0, __ATOMIC_RELAXED);
+        return SR_SHM_WAKE_RING;
+    }
+
+    pfds[0].fd = shm->efd_rx;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd = extra_fd;
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+
+    if (poll(pfds, extra_fd >= 0 ? 2 : 1, timeout_ms) < 0 && errno != EINTR)
+    { perror("poll(..):sr_shmring.c::sr_shm_wait"); }
+
+    __atomic_store_n(&shm->hdr->waiting[shm->side].v, 0, __ATOMIC_RELAXED);
+
+    if (pfds[0].revents & POLLIN)
+    {
+        uint64_t v;
+        if (read(shm->efd_rx, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        { perror("read(..):sr_shmring.c::sr_shm_wait"); }
+        mask |= SR_SHM_WAKE_RING;
+    }
+    if (extra_fd >= 0 && (pfds[1].revents & (POLLIN | POLLHUP)))
+    { mask |= SR_SHM_WAKE_FD; }
+
+    return mask;
+} /* -- sr_shm_wait -- */
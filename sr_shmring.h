@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shmring.h
+ *
+ * Description:
+ *
+ * Shared memory frame rings between the router and a co-located VNS-side
+ * peer (see vns_local -M).  The peer creates one memory segment holding a
+ * pair of lock-free single-producer / single-consumer rings per interface,
+ * one towards the router and one back, plus one eventfd per direction for
+ * wakeups.  The segment and the eventfds are handed to the router over a
+ * Unix socket.
+ *
+ * A consumer that runs out of frames announces that it is going to sleep
+ * before blocking on its eventfd; producers only write the eventfd when
+ * the other side has announced it, so a busy-polling consumer costs the
+ * producer no system calls at all.
+ *
+ * Each side must serialize its own producers; the rings themselves only
+ * support one producer and one consumer.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHMRING_H
+#define SR_SHMRING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#include <stddef.h>
+
+#include "sr_protocol.h"
+
+#define SR_SHM_MAX_IFS  16
+#define SR_SHM_SLOT_SZ  2048   /* bytes per slot, including the length word */
+#define SR_SHM_SLOTS    1024   /* slots per ring, a power of two */
+
+#define SR_SHM_ROUTER   0      /* sides; also the direction a ring flows to */
+#define SR_SHM_PEER     1
+
+struct sr_shm_hdr;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm
+ *
+ * One side's handle on a mapped segment
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm
+{
+    struct sr_shm_hdr* hdr;
+    size_t len;
+    int side;          /* SR_SHM_ROUTER or SR_SHM_PEER */
+    int efd_rx;        /* signalled when frames arrive for this side */
+    int efd_tx;        /* signals the other side */
+    int mem_fd;
+    int nifs;          /* from the header, once checked: the peer can */
+    unsigned int slots; /* rewrite the header at any time */
+};
+
+int  sr_shm_create(struct sr_shm* shm, char names[][sr_IFACE_NAMELEN],
+                   int nifs, unsigned int slots);
+int  sr_shm_listen(const char* path);
+int  sr_shm_offer(struct sr_shm* shm, int listen_fd);
+int  sr_shm_attach(struct sr_shm* shm, const char* path);
+void sr_shm_close(struct sr_shm* shm);
+
+int         sr_shm_nifs(struct sr_shm* shm);
+const char* sr_shm_name(struct sr_shm* shm, int ifidx);
+int         sr_shm_find(struct sr_shm* shm, const char* name);
+
+/* produce on ifidx towards the other side; -1 and a drop when full */
+int  sr_shm_push(struct sr_shm* shm, int ifidx, const uint8_t* buf,
+                 unsigned int len);
+/* whether a push on ifidx would find the ring full, for producers that
+   would rather wait than drop */
+int  sr_shm_full(struct sr_shm* shm, int ifidx);
+/* next frame for this side on ifidx, 0 when empty; the frame stays in
+   the ring until sr_shm_consume() */
+uint8_t* sr_shm_peek(struct sr_shm* shm, int ifidx, unsigned int* len);
+void sr_shm_consume(struct sr_shm* shm, int ifidx);
+
+/* whether any ring towards this side holds frames */
+int  sr_shm_pending(struct sr_shm* shm);
+/* sleep until frames arrive, extra_fd (if >= 0) is readable or timeout
+   (ms) expires; returns a mask of SR_SHM_WAKE_* */
+int  sr_shm_wait(struct sr_shm* shm, int extra_fd, int timeout_ms);
+
+#define SR_SHM_WAKE_RING  1
+#define SR_SHM_WAKE_FD    2
+
+unsigned long sr_shm_drops(struct sr_shm* shm, int ifidx, int to_side);
+
+#endif /* -- SR_SHMRING_H -- */
@@ -0,0 +1,286 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Forwarding counters, see sr_stats.h.
+ *
+ * A block is only ever written by its thread, with relaxed stores, and
+ * read with relaxed loads, so a sum never sees a torn counter.  Threads
+ * past SR_STATS_THREADS share one more block and add to it atomically.
+ * Blocks are never freed: a thread may still count after the dump
+ * thread has stopped, and the counts outlive the threads that made them.
+ *
+ * SIGUSR1 only posts a semaphore; the dump thread does the printing.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "sr_stats.h"
+#include "sr_protocol.h"
+#include "sr_conf.h"
+
+const char* sr_drop_names[SR_DROPS] =
+{
+    "runt", "no_iface", "ethertype", "bad_arp", "arp_other", "bad_ip",
+    "checksum", "no_route", "ttl", "arp_queue", "ring", "tx_error"
+};
+
+const char* sr_lat_names[SR_LATS] =
+{
+    "forward", "arp_wait", "parse", "lpm", "rewrite", "arp", "send"
+};
+
+__thread struct sr_stats_block* sr_stats_self = 0;
+
+int sr_stats_latency = 1;
+__thread uint64_t sr_stats_rx_ns = 0;
+__thread uint64_t sr_stats_mark_ns = 0;
+
+static struct sr_stats_block* sr_stats_blocks[SR_STATS_THREADS];
+static int sr_stats_nblocks = 0;
+static struct sr_stats_block sr_stats_shared = { { { 0 } }, 1 };
+static pthread_mutex_t sr_stats_print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct
+{
+    char inst[32];
+    char name[sr_IFACE_NAMELEN];
+} sr_stats_ifs[SR_STATS_IFS];
+static int sr_stats_nifs = 0;
+static pthread_mutex_t sr_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static sem_t sr_stats_sem;
+static int sr_stats_running = 0;
+static int sr_stats_stopping = 0;
+static pthread_t sr_stats_thread;
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_attach(..)
+ * Scope: Global
+ *
+ * Slow path of the first count a thread makes.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_stats_block* sr_stats_attach(void)
+{
+    struct sr_stats_block* b = 0;
+
+    pthread_mutex_lock(&sr_stats_lock);
+    if (sr_stats_nblocks < SR_STATS_THREADS &&
+        posix_memalign((void**)&b, 64, sizeof(*b)) == 0)
+    {
+        memset(b, 0, sizeof(*b));
+        __atomic_store_n(&sr_stats_blocks[sr_stats_nblocks], b,
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&sr_stats_nblocks, sr_stats_nblocks + 1,
+                         __ATOMIC_RELEASE);
+    }
+    else
+    { b = &sr_stats_shared; }
+    pthread_mutex_unlock(&sr_stats_lock);
+
+    sr_stats_self = b;
+    return b;
+} /* -- sr_stats_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_add_if(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+int sr_stats_add_if(const char* inst, const char* name)
+{
+    int i;
+
+    pthread_mutex_lock(&sr_stats_lock);
+    i = sr_stats_nifs;
+    if (i < SR_STATS_IFS)
+    {
+        strncpy(sr_stats_ifs[i].inst, inst, sizeof(sr_stats_ifs[i].inst) - 1);
+        strncpy(sr_stats_ifs[i].name, name, sr_IFACE_NAMELEN - 1);
+        __atomic_store_n(&sr_stats_nifs, i + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sr_stats_lock);
+
+    return i;
+} /* -- sr_stats_add_if -- */
+
+const char* sr_stats_if_name(int index, const char** inst)
+{
+    if (index >= SR_STATS_IFS)
+    {
+        if (inst)
+        { *inst = ""; }
+        return "other";
+    }
+    if (inst)
+    { *inst = sr_stats_ifs[index].inst; }
+    return sr_stats_ifs[index].name;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_read(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+static void sr_stats_sum(struct sr_stats* sum, struct sr_stats* c)
+{
+    unsigned long* to = (unsigned long*)sum;
+    unsigned long* from = (unsigned long*)c;
+    size_t i;
+
+    for (i = 0; i < sizeof(*sum) / sizeof(unsigned long); i++)
+    { to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED); }
+}
+
+int sr_stats_read(struct sr_stats* sum)
+{
+    int n = __atomic_load_n(&sr_stats_nblocks, __ATOMIC_ACQUIRE);
+    int i;
+
+    memset(sum, 0, sizeof(*sum));
+    for (i = 0; i < n; i++)
+    { sr_stats_sum(sum, &__atomic_load_n(&sr_stats_blocks[i],
+                                         __ATOMIC_ACQUIRE)->c); }
+    sr_stats_sum(sum, &sr_stats_shared.c);
+
+    return __atomic_load_n(&sr_stats_nifs, __ATOMIC_ACQUIRE);
+} /* -- sr_stats_read -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_print(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+void sr_stats_print(FILE* fp)
+{
+    static struct sr_stats sum;   /* too big for a thread's stack */
+    int nifs, i, multi = 0;
+
+    pthread_mutex_lock(&sr_stats_print_lock);
+    nifs = sr_stats_read(&sum);
+
+    for (i = 1; i < nifs; i++)
+    {
+        if (strcmp(sr_stats_ifs[i].inst, sr_stats_ifs[0].inst) != 0)
+        { multi = 1; }
+    }
+
+    fprintf(fp, "%-20s %12s %14s %12s %14s\n", "interface", "rx packets",
+            "rx bytes", "tx packets", "tx bytes");
+    for (i = 0; i <= SR_STATS_IFS; i++)
+    {
+        struct sr_stats_if* s = &sum.ifs[i];
+        char label[64];
+        const char* inst;
+        const char* name;
+
+        if (i >= nifs && i < SR_STATS_IFS)
+        { continue; }
+        if (i == SR_STATS_IFS && !s->rx_packets && !s->tx_packets)
+        { continue; }
+
+        name = sr_stats_if_name(i, &inst);
+        snprintf(label, sizeof(label), "%s%s%s", multi ? inst : "",
+                 multi && *inst ? "/" : "", name);
+        fprintf(fp, "%-20s %12lu %14lu %12lu %14lu\n", label, s->rx_packets,
+                s->rx_bytes, s->tx_packets, s->tx_bytes);
+    }
+
+    fprintf(fp, "drops:");
+    for (i = 0; i < SR_DROPS; i++)
+    { fprintf(fp, " %s %lu", sr_drop_names[i], sum.drops[i]); }
+    fprintf(fp, "\n");
+
+    for (i = 0; i < SR_LATS; i++)
+    {
+        const unsigned long* h = sum.lat[i];
+        unsigned long n = sr_hist_count(h);
+
+        if (!n)
+        { continue; }
+        fprintf(fp, "latency %-8s %10lu  p50 %.2f p99 %.2f p99.9 %.2f "
+                "max %.2f us\n", sr_lat_names[i], n,
+                sr_hist_percentile(h, 0.5) / 1e3,
+                sr_hist_percentile(h, 0.99) / 1e3,
+                sr_hist_percentile(h, 0.999) / 1e3,
+                sr_hist_percentile(h, 1.0) / 1e3);
+    }
+    fflush(fp);
+    pthread_mutex_unlock(&sr_stats_print_lock);
+} /* -- sr_stats_print -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_start(..)
+ * Scope: Global
+ *---------------------------------------------------------------------*/
+
+static void sr_stats_signal(int sig)
+{
+    sem_post(&sr_stats_sem);
+}
+
+static void* sr_stats_main(void* arg)
+{
+    sr_conf_pin("cpu_log", -1);
+
+    for (;;)
+    {
+        if (sem_wait(&sr_stats_sem) != 0)
+        { continue; }
+        if (__atomic_load_n(&sr_stats_stopping, __ATOMIC_ACQUIRE))
+        { break; }
+        sr_stats_print(stdout);
+    }
+
+    return 0;
+} /* -- sr_stats_main -- */
+
+int sr_stats_start(void)
+{
+    struct sigaction sa;
+
+    sr_stats_latency = sr_conf_int("latency", 1);
+
+    sem_init(&sr_stats_sem, 0, 0);
+    if (pthread_create(&sr_stats_thread, 0, sr_stats_main, 0) != 0)
+    {
+        perror("pthread_create(..):sr_stats.c::sr_stats_start");
+        return -1;
+    }
+    sr_stats_running = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sr_stats_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, 0);
+    return 0;
+} /* -- sr_stats_start -- */
+
+void sr_stats_stop(void)
+{
+    struct sigaction sa;
+
+    if (!sr_stats_running)
+    { return; }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGUSR1, &sa, 0);
+
+    __atomic_store_n(&sr_stats_stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&sr_stats_sem);
+    pthread_join(sr_stats_thread, 0);
+    sem_destroy(&sr_stats_sem);
+    sr_stats_running = 0;
+} /* -- sr_stats_stop -- */
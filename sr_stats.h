@@ -0,0 +1,194 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Forwarding counters: frames and bytes received and sent on each
+ * interface, frames dropped, by reason, and latency histograms
+ * (sr_hist.h), as set with -o latency:
+ *
+ *   1 (default)  forward   socket read to sr_send_packet(), forwarded frames
+ *                arp_wait  time queued on an unresolved next hop
+ *   2            also each stage of forwarding a frame: parse, lpm,
+ *                rewrite (TTL, checksum, source MAC), arp (next hop
+ *                lookup) and send
+ *   0            none
+ *
+ * Every thread that counts gets a block of counters of its own, cache
+ * line aligned, the first time it counts; an increment is a plain add to
+ * memory no other core writes.  Readers sum the blocks (sr_stats_read),
+ * so totals are as fresh as the last increment each thread made.
+ *
+ * kill -USR1 prints them to stdout.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "sr_hist.h"
+
+#define SR_STATS_IFS     32   /* interfaces counted on their own */
+#define SR_STATS_THREADS 64   /* threads with a block of their own */
+
+enum sr_drop
+{
+    SR_DROP_RUNT = 0,     /* shorter than an ethernet header */
+    SR_DROP_NO_IFACE,     /* arrived on an interface we don't have */
+    SR_DROP_ETHERTYPE,    /* neither ARP nor IP */
+    SR_DROP_BAD_ARP,      /* truncated ARP */
+    SR_DROP_ARP_OTHER,    /* ARP request for another host */
+    SR_DROP_BAD_IP,       /* truncated IP, bad header length */
+    SR_DROP_CHECKSUM,     /* bad IP header checksum */
+    SR_DROP_NO_ROUTE,
+    SR_DROP_TTL,          /* TTL expired in transit */
+    SR_DROP_ARP_QUEUE,    /* the next hop's ARP queue was full, or out of
+                             memory to queue on it */
+    SR_DROP_RING,         /* a pipeline or punt ring was full */
+    SR_DROP_TX_ERROR,     /* the session or backend refused the frame */
+    SR_DROPS
+};
+
+extern const char* sr_drop_names[SR_DROPS];
+
+enum sr_lat
+{
+    SR_LAT_FORWARD = 0,
+    SR_LAT_ARP_WAIT,
+    SR_LAT_PARSE,         /* -- stages, -o latency=2 -- */
+    SR_LAT_LPM,
+    SR_LAT_REWRITE,
+    SR_LAT_ARP,
+    SR_LAT_SEND,
+    SR_LATS
+};
+
+extern const char* sr_lat_names[SR_LATS];
+
+struct sr_stats_if
+{
+    unsigned long rx_packets;
+    unsigned long rx_bytes;
+    unsigned long tx_packets;
+    unsigned long tx_bytes;
+};
+
+struct sr_stats
+{
+    unsigned long drops[SR_DROPS];
+    /* by sr_if index; the last one counts every interface after the
+       first SR_STATS_IFS */
+    struct sr_stats_if ifs[SR_STATS_IFS + 1];
+    unsigned long lat[SR_LATS][SR_HIST_BUCKETS];
+    unsigned long lat_ns[SR_LATS];     /* sum of the values */
+};
+
+struct sr_stats_block
+{
+    struct sr_stats c;
+    int shared;           /* 1 for the block threads past the limit share */
+} __attribute__ ((aligned (64)));
+
+extern __thread struct sr_stats_block* sr_stats_self;
+struct sr_stats_block* sr_stats_attach(void);
+
+extern int sr_stats_latency;              /* -o latency */
+extern __thread uint64_t sr_stats_rx_ns;  /* when this frame was read */
+extern __thread uint64_t sr_stats_mark_ns; /* when its last stage ended */
+
+/* index for the counters of instance inst's interface name */
+int  sr_stats_add_if(const char* inst, const char* name);
+
+/* read -o latency, have SIGUSR1 dump; -1 if the dump thread can't be
+   started */
+int  sr_stats_start(void);
+void sr_stats_stop(void);
+
+/* sum every thread's counters into sum; returns the number of
+   interfaces, whose names sr_stats_if_name gives */
+int  sr_stats_read(struct sr_stats* sum);
+const char* sr_stats_if_name(int index, const char** inst);
+void sr_stats_print(FILE* fp);
+
+static __inline__ void sr_stats_bump(struct sr_stats_block* b,
+                                     unsigned long* c, unsigned long n)
+{
+    if (__builtin_expect(b->shared, 0))
+    { __atomic_add_fetch(c, n, __ATOMIC_RELAXED); }
+    else
+    { __atomic_store_n(c, *c + n, __ATOMIC_RELAXED); }
+}
+
+static __inline__ struct sr_stats_block* sr_stats_me(void)
+{
+    struct sr_stats_block* b = sr_stats_self;
+    return __builtin_expect(b != 0, 1) ? b : sr_stats_attach();
+}
+
+static __inline__ void sr_stats_drop(enum sr_drop why)
+{
+    struct sr_stats_block* b = sr_stats_me();
+    sr_stats_bump(b, &b->c.drops[why], 1);
+}
+
+static __inline__ void sr_stats_rx(int index, unsigned int len)
+{
+    struct sr_stats_block* b = sr_stats_me();
+    sr_stats_bump(b, &b->c.ifs[index].rx_packets, 1);
+    sr_stats_bump(b, &b->c.ifs[index].rx_bytes, len);
+}
+
+static __inline__ void sr_stats_tx(int index, unsigned int len)
+{
+    struct sr_stats_block* b = sr_stats_me();
+    sr_stats_bump(b, &b->c.ifs[index].tx_packets, 1);
+    sr_stats_bump(b, &b->c.ifs[index].tx_bytes, len);
+}
+
+static __inline__ void sr_stats_lat(enum sr_lat what, uint64_t ns)
+{
+    struct sr_stats_block* b = sr_stats_me();
+    sr_stats_bump(b, &b->c.lat[what][sr_hist_bucket(ns)], 1);
+    sr_stats_bump(b, &b->c.lat_ns[what], ns);
+}
+
+/* the frame was just read: stamp it */
+static __inline__ void sr_stats_rx_stamp(void)
+{
+    if (sr_stats_latency)
+    { sr_stats_rx_ns = sr_hist_now(); }
+}
+
+/* a frame's stages start */
+static __inline__ void sr_stats_stage_start(void)
+{
+    if (sr_stats_latency > 1)
+    { sr_stats_mark_ns = sr_hist_now(); }
+}
+
+/* stage what of a frame ends */
+static __inline__ void sr_stats_stage(enum sr_lat what)
+{
+    if (sr_stats_latency > 1)
+    {
+        uint64_t now = sr_hist_now();
+        sr_stats_lat(what, now - sr_stats_mark_ns);
+        sr_stats_mark_ns = now;
+    }
+}
+
+/* a forwarded frame is about to be sent; after sr_stats_stage() the
+   stamp it took is reused */
+static __inline__ void sr_stats_forward(void)
+{
+    if (sr_stats_latency && sr_stats_rx_ns)
+    {
+        uint64_t now = sr_stats_latency > 1 ? sr_stats_mark_ns : sr_hist_now();
+        sr_stats_lat(SR_LAT_FORWARD, now - sr_stats_rx_ns);
+    }
+}
+
+#endif /* -- SR_STATS_H -- */
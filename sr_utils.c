@@ -5,8 +5,18 @@
 #include "sr_utils.h"
 
 
-uint16_t cksum (const void *_data, int len) {
-  const uint8_t *data = _data;
+/* The 16 bit one's complement sum of the Internet checksum (RFC 1071)
+   does not depend on byte order, and is the same whether it is taken
+   over 16, 32 or 64 bit words as long as the carries wrap around.  So
+   the fast versions add native words as wide as they can and swap the
+   folded sum to network order at the end, which gives the same bits as
+   the reference loop below.  On first use cksum_sum() picks the widest
+   version the CPU supports for buffers of CKSUM_SIMD_MIN bytes and up,
+   and the wide word loop for shorter ones: below that the vector setup
+   and the horizontal add cost more than they save (see cksum_bench),
+   and a 20 byte IP header is the common case. */
+
+static uint16_t cksum_sum_ref (const uint8_t *data, int len) {
   uint32_t sum;
 
   for (sum = 0;len >= 2; data += 2, len -= 2)
@@ -15,10 +25,191 @@ uint16_t cksum (const void *_data, int len) {
     sum += data[0] << 8;
   while (sum > 0xffff)
     sum = (sum >> 16) + (sum & 0xffff);
+  return sum;
+}
+
+static __inline__ uint64_t cksum_add64 (uint64_t a, uint64_t b) {
+  a += b;
+  return a + (a < b);
+}
+
+/* fold a native sum to 16 bits, in host order like cksum_sum_ref() */
+static __inline__ uint16_t cksum_fold (uint64_t sum) {
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  while (sum > 0xffff)
+    sum = (sum >> 16) + (sum & 0xffff);
+  return ntohs((uint16_t)sum);
+}
+
+static uint64_t cksum_tail (const uint8_t *data, int len, uint64_t sum) {
+  uint64_t w64;
+  uint32_t w32;
+  uint16_t w16;
+
+  for (; len >= 8; data += 8, len -= 8) {
+    memcpy(&w64, data, 8);
+    sum = cksum_add64(sum, w64);
+  }
+  if (len >= 4) {
+    memcpy(&w32, data, 4);
+    sum = cksum_add64(sum, w32);
+    data += 4; len -= 4;
+  }
+  if (len >= 2) {
+    memcpy(&w16, data, 2);
+    sum = cksum_add64(sum, w16);
+    data += 2; len -= 2;
+  }
+  if (len > 0) {
+    w16 = 0;
+    memcpy(&w16, data, 1);
+    sum = cksum_add64(sum, w16);
+  }
+  return sum;
+}
+
+static uint16_t cksum_sum_wide (const uint8_t *data, int len) {
+  return cksum_fold(cksum_tail(data, len, 0));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CKSUM_X86
+
+/* 32 bit lanes are widened to 64 bits, so they cannot overflow before
+   len (an int) runs out */
+__attribute__((target("sse2")))
+static uint16_t cksum_sum_sse2 (const uint8_t *data, int len) {
+  __m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128(), v;
+  uint64_t lanes[2];
+
+  for (; len >= 16; data += 16, len -= 16) {
+    v = _mm_loadu_si128((const __m128i *)data);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+  }
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return cksum_fold(cksum_tail(data, len, cksum_add64(lanes[0], lanes[1])));
+}
+
+__attribute__((target("avx2")))
+static uint16_t cksum_sum_avx2 (const uint8_t *data, int len) {
+  __m256i acc = _mm256_setzero_si256(), zero = _mm256_setzero_si256(), v;
+  uint64_t lanes[4], sum;
+
+  for (; len >= 32; data += 32, len -= 32) {
+    v = _mm256_loadu_si256((const __m256i *)data);
+    acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+    acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+  }
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  sum = cksum_add64(cksum_add64(lanes[0], lanes[1]),
+                    cksum_add64(lanes[2], lanes[3]));
+  return cksum_fold(cksum_tail(data, len, sum));
+}
+#endif
+
+static const struct {
+  const char *name;
+  uint16_t (*sum)(const uint8_t *, int);
+} cksum_impls[CKSUM_IMPLS] = {
+  { "ref", cksum_sum_ref },
+  { "wide", cksum_sum_wide },
+#ifdef CKSUM_X86
+  { "sse2", cksum_sum_sse2 },
+  { "avx2", cksum_sum_avx2 },
+#else
+  { "sse2", 0 },
+  { "avx2", 0 },
+#endif
+};
+
+static uint16_t cksum_sum_pick (const uint8_t *data, int len);
+static uint16_t (*cksum_sum_long)(const uint8_t *, int) = cksum_sum_pick;
+static uint16_t (*cksum_sum_short)(const uint8_t *, int) = cksum_sum_pick;
+
+static __inline__ uint16_t cksum_sum (const uint8_t *data, int len) {
+  return __atomic_load_n(len < CKSUM_SIMD_MIN ? &cksum_sum_short :
+                         &cksum_sum_long, __ATOMIC_RELAXED)(data, len);
+}
+
+const char *cksum_impl_name (int impl) {
+  return impl >= 0 && impl < CKSUM_IMPLS ? cksum_impls[impl].name : "?";
+}
+
+int cksum_impl_supported (int impl) {
+  if (impl < 0 || impl >= CKSUM_IMPLS || !cksum_impls[impl].sum)
+    return 0;
+#ifdef CKSUM_X86
+  __builtin_cpu_init();
+  if (impl == CKSUM_SSE2)
+    return __builtin_cpu_supports("sse2");
+  if (impl == CKSUM_AVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return 1;
+}
+
+/* use impl at every length, or for -1 the best supported one from
+   CKSUM_SIMD_MIN bytes and wide below; returns the one chosen (the long
+   one for -1) */
+int cksum_use (int impl) {
+  int short_impl = impl;
+
+  if (impl < 0) {
+    for (impl = CKSUM_IMPLS - 1; !cksum_impl_supported(impl); impl--)
+      ;
+    short_impl = impl < CKSUM_WIDE ? impl : CKSUM_WIDE;
+  }
+  if (!cksum_impl_supported(impl))
+    return -1;
+  __atomic_store_n(&cksum_sum_short, cksum_impls[short_impl].sum,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&cksum_sum_long, cksum_impls[impl].sum, __ATOMIC_RELAXED);
+  return impl;
+}
+
+static uint16_t cksum_sum_pick (const uint8_t *data, int len) {
+  cksum_use(-1);
+  return cksum_sum(data, len);
+}
+
+uint16_t cksum (const void *_data, int len) {
+  uint16_t sum;
+
+  sum = cksum_sum(_data, len);
   sum = htons (~sum);
   return sum ? sum : 0xffff;
 }
 
+int cksum_ok (const void *_data, int len) {
+  return cksum_sum(_data, len) == 0xffff;
+}
+
+/* The one's complement sum does not depend on byte order, so the update
+   works on the fields as they are: HC' = ~(~HC + ~m + m') */
+uint16_t cksum_update16 (uint16_t sum, uint16_t old, uint16_t new) {
+  uint32_t s = (uint16_t)~sum + (uint16_t)~old + new;
+
+  while (s > 0xffff)
+    s = (s >> 16) + (s & 0xffff);
+  return ~s;
+}
+
+uint16_t cksum_update32 (uint16_t sum, uint32_t old, uint32_t new) {
+  sum = cksum_update16(sum, old >> 16, new >> 16);
+  return cksum_update16(sum, old & 0xffff, new & 0xffff);
+}
+
+uint16_t cksum_add (uint16_t sum, const void *data, int len) {
+  uint32_t s = (uint16_t)~sum +
+               htons(cksum_sum(data, len));
+
+  while (s > 0xffff)
+    s = (s >> 16) + (s & 0xffff);
+  return ~s;
+}
+
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
@@ -29,6 +29,25 @@
 #define SR_UTILS_H
 
 uint16_t cksum(const void *_data, int len);
+/* 1 if the one's complement sum over data, checksum field included, is
+   all ones, i.e. the checksum in it is correct */
+int cksum_ok(const void *_data, int len);
+/* RFC 1624 eqn. 3: the checksum sum after a 16 or 32 bit field changed
+   from old to new; all values as they are stored (network byte order) */
+uint16_t cksum_update16(uint16_t sum, uint16_t old, uint16_t new);
+uint16_t cksum_update32(uint16_t sum, uint32_t old, uint32_t new);
+/* the checksum sum after len bytes of data, all zero when sum was taken,
+   were filled in; data must start at an even offset into the sum */
+uint16_t cksum_add(uint16_t sum, const void *data, int len);
+
+/* versions of the sum behind cksum() and cksum_ok(), all giving the same
+   bits; unless cksum_use() says otherwise (-1 = best) the best one the
+   CPU supports is used from CKSUM_SIMD_MIN bytes, and wide below */
+enum { CKSUM_REF, CKSUM_WIDE, CKSUM_SSE2, CKSUM_AVX2, CKSUM_IMPLS };
+#define CKSUM_SIMD_MIN 64
+const char *cksum_impl_name(int impl);
+int cksum_impl_supported(int impl);
+int cksum_use(int impl);
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
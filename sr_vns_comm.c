@@ -30,25 +30,34 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_flight.h"
+#include "sr_backend.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_mem.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
+static void sr_log_packet(struct sr_instance* , uint8_t* , int ,
+                          const char* , enum sr_capture_dir );
+static int  sr_arp_req_not_for_us(uint8_t * packet /* lent */,
                                   unsigned int len,
-                                  char* interface  /* lent */);
+                                  struct sr_if* iface /* borrowed */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
 /*-----------------------------------------------------------------------------
@@ -61,6 +70,37 @@ static void sr_session_closed_help()
 {
 }
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_connect_to_unix_server()
+ * Scope: Local
+ *
+ * Open the session socket to a server listening on a Unix domain socket
+ *
+ *---------------------------------------------------------------------------*/
+static int sr_connect_to_unix_server(struct sr_instance* sr, const char* path)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if ((sr->sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_client.c::sr_connect_to_unix_server(..)");
+        return -1;
+    }
+
+    if (connect(sr->sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect(..):sr_client.c::sr_connect_to_unix_server(..)");
+        close(sr->sockfd);
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_connect_to_unix_server -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_connect_to_server()
  * Scope: Global
@@ -89,6 +129,15 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
     /* purify UMR be gone ! */
     memset((void*)&command,0,sizeof(c_open));
 
+    /* a server name with a '/' in it is the path of a Unix domain socket,
+       e.g. one served by vns_local -U */
+    if (strchr(server, '/'))
+    {
+        if (sr_connect_to_unix_server(sr, server) != 0)
+        { return -1; }
+        goto connected;
+    }
+
     /* zero out server address struct */
     memset(&(sr->sr_addr),0,sizeof(struct sockaddr_in));
 
@@ -121,6 +170,7 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         return -1;
     }
 
+connected:
     /* wait for authentication to be completed (server sends the first message) */
     if(sr_read_from_server_expect(sr, VNS_AUTH_REQUEST)!= 1 ||
        sr_read_from_server_expect(sr, VNS_AUTH_STATUS) != 1)
@@ -328,9 +378,59 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 
 int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 {
+    if (sr->backend)
+    { return sr->backend->poll(sr); }
+
+    /* -- busy polling, spin for the next message before recv() blocks -- */
+    if (sr->busy_poll)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = sr->sockfd;
+        pfd.events = POLLIN;
+        sr_wait_input(sr, &pfd, 1, -1);
+    }
+
     return sr_read_from_server_expect(sr, 0);
 }
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_wait_input(..)
+ * Scope: global
+ *
+ * poll() for the receive path.  With busy polling (-b, -o busy_poll=us)
+ * the descriptors are polled without blocking for up to sr->busy_poll
+ * usecs, and only then with timeout_ms; any input restarts the spin, so
+ * a busy router never sleeps while an idle one stops burning its CPU.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_wait_input(struct sr_instance* sr, struct pollfd* pfds, int n,
+                  int timeout_ms)
+{
+    struct timespec start, now;
+    long spun_us;
+    int ret;
+
+    if (!sr->busy_poll)
+    { return poll(pfds, n, timeout_ms); }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1)
+    {
+        if ((ret = poll(pfds, n, 0)) != 0)
+        { return ret; }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        spun_us = (now.tv_sec - start.tv_sec) * 1000000L +
+                  (now.tv_nsec - start.tv_nsec) / 1000;
+        if (spun_us >= sr->busy_poll)
+        { break; }
+    }
+
+    return poll(pfds, n, timeout_ms);
+} /* -- sr_wait_input -- */
+
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
     int command, len;
@@ -376,7 +476,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         return -1;
     }
 
-    if((buf = malloc(len)) == 0)
+    if((buf = sr_mem_alloc(SR_MEM_RX, len)) == 0)
     {
         fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
         return -1;
@@ -400,6 +500,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
                 { continue; }
                 fprintf(stderr,"Error: failed reading command body %d\n",ret);
                 close(sr->sockfd);
+                sr_mem_free(buf);
                 return -1;
             }
             bytes_read += ret;
@@ -414,6 +515,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
     if(expected_cmd && command!=expected_cmd) {
         if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
             fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+            sr_mem_free(buf);
             return -1;
         }
     }
@@ -426,23 +528,9 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
+            sr_receive_packet(sr,
                     (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
+                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header),
                     (char*)(buf + sizeof(c_base)));
 
             break;
@@ -454,8 +542,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
 
-            if(buf)
-            { free(buf); }
+            sr_mem_free(buf);
             return 0;
             break;
 
@@ -472,6 +559,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             if(sr_verify_routing_table(sr) != 0)
             {
                 fprintf(stderr,"Routing table not consistent with hardware\n");
+                sr_mem_free(buf);
                 return -1;
             }
             printf(" <-- Ready to process packets --> \n");
@@ -496,25 +584,72 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             break;
 
         default:
-            Debug("unknown command: %d\n", command);
+            sr_log_warn(SR_LOG_IO, "unknown command: %d", command);
             break;
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
+    sr_mem_free(buf);
     return ret;
 }/* -- sr_read_from_server -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_receive_packet(..)
+ * Scope: Global
+ *
+ * Common receive path for a frame that arrived on 'interface', whether it
+ * was read from the VNS session or from a backend.  Counts it, drops ARP
+ * requests meant for other hosts, logs the frame and hands it to the
+ * router.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_receive_packet(struct sr_instance* sr /* borrowed */,
+                       uint8_t* packet /* lent */,
+                       unsigned int len,
+                       char* interface /* lent */)
+{
+    struct sr_if* iface = sr_get_interface(sr, interface);
+
+    if ( !iface )
+    {
+        sr_stats_drop(SR_DROP_NO_IFACE);
+        return;
+    }
+    sr_stats_rx(iface->index, len);
+    sr_stats_rx_stamp();
+
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(packet, len, iface) )
+    {
+        sr_stats_drop(SR_DROP_ARP_OTHER);
+        return;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, packet, len, interface, SR_CAPTURE_IN);
+
+    /* -- pipelined, a worker thread takes it from here -- */
+    if ( sr->pipeline )
+    {
+        sr_pipeline_rx(sr, packet, len, interface);
+        return;
+    }
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, packet, len, interface);
+} /* -- sr_receive_packet -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
  * Scope: Local
  *
  * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Returns the interface, or 0 if they are not.
  *
  *----------------------------------------------------------------------------*/
 
-static int
+static struct sr_if*
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
                                 const char* name /* borrowed */ )
@@ -531,12 +666,12 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
     iface = sr_get_interface(sr, name);
 
     if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
+        sr_log_err(SR_LOG_IO, "send on unknown interface %s", name);
         return 0;
     }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
+        sr_log_err(SR_LOG_IO, "source address does not match interface %s", name);
         return 0;
     }
 
@@ -546,7 +681,7 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
      * Note: This check should really be done server side ...
      */
 
-    return 1;
+    return iface;
 
 } /* -- sr_ether_addrs_match_interface -- */
 
@@ -564,8 +699,42 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
+    int ret;
+
+    /* -- pipelined, the TX thread does the writing -- */
+    if ( sr->pipeline )
+    { return sr_pipeline_tx(sr, buf, len, iface); }
+
+    /* -- the control thread writes too -- */
+    if ( sr->punt )
+    {
+        pthread_mutex_lock(&sr->send_lock);
+        ret = sr_send_packet_direct(sr, buf, len, iface);
+        pthread_mutex_unlock(&sr->send_lock);
+        return ret;
+    }
+
+    return sr_send_packet_direct(sr, buf, len, iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_direct(..)
+ * Scope: Global
+ *
+ * Write the packet to the session or backend from the calling thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_direct(struct sr_instance* sr /* borrowed */,
+                          uint8_t* buf /* borrowed */ ,
+                          unsigned int len,
+                          const char* iface /* borrowed */)
+{
+    c_packet_header sr_pkt;
+    struct iovec iov[2];
     unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct sr_if* ifp;
+    int ret;
 
     /* REQUIRES */
     assert(sr);
@@ -574,39 +743,55 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 
     /* don't waste my time ... */
     if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
+        sr_log_err(SR_LOG_IO, "frame of %u bytes too short to send", len);
+        sr_stats_drop(SR_DROP_TX_ERROR);
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    if ( sr->backend ){
+        sr_log_packet(sr, buf, len, iface, SR_CAPTURE_OUT);
+
+        if ( ! (ifp = sr_ether_addrs_match_interface( sr, buf, iface)) ){
+            sr_log_err(SR_LOG_IO, "bad ethernet header on a frame to %s", iface);
+            sr_stats_drop(SR_DROP_TX_ERROR);
+            return -1;
+        }
+
+        if ( (ret = sr->backend->send(sr, buf, len, iface)) == 0 )
+        { sr_stats_tx(ifp->index, len); }
+        else
+        { sr_stats_drop(SR_DROP_TX_ERROR); }
+        return ret;
+    }
 
     /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    sr_log_packet(sr, buf, len, iface, SR_CAPTURE_OUT);
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
+    if ( ! (ifp = sr_ether_addrs_match_interface( sr, buf, iface)) ){
+        sr_log_err(SR_LOG_IO, "bad ethernet header on a frame to %s", iface);
+        sr_stats_drop(SR_DROP_TX_ERROR);
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
+    /* -- header on the stack, frame straight from buf: nothing copied -- */
+    sr_pkt.mLen  = htonl(total_len);
+    sr_pkt.mType = htonl(VNSPACKET);
+    strncpy(sr_pkt.mInterfaceName,iface,16);
+    iov[0].iov_base = &sr_pkt;
+    iov[0].iov_len  = sizeof(c_packet_header);
+    iov[1].iov_base = buf;
+    iov[1].iov_len  = len;
+
+    if( writev(sr->sockfd, iov, 2) < (ssize_t)total_len ){
+        sr_log_err(SR_LOG_IO, "error writing a frame to the server: %s",
+                   strerror(errno));
+        sr_stats_drop(SR_DROP_TX_ERROR);
         return -1;
     }
 
-    free(sr_pkt);
-
+    sr_stats_tx(ifp->index, len);
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_send_packet_direct -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -614,25 +799,19 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
  *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   const char* iface, enum sr_capture_dir dir)
 {
-    struct pcap_pkthdr h;
-    int size;
-
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
-    {return; }
+    sr_flight_record(buf, len);
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    if(!sr->capture)
+    {return; }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- queued for the writer thread, see sr_capture.c -- */
+    sr_capture_packet(sr->capture, buf, len, iface, dir);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -641,20 +820,16 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
  *
  *---------------------------------------------------------------------------*/
 
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
+static int sr_arp_req_not_for_us(uint8_t * packet /* lent */,
+                                 unsigned int len,
+                                 struct sr_if* iface /* borrowed */)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 
     if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
     { return 0; }
 
-    assert(iface);
-
     e_hdr = (struct sr_ethernet_hdr*)packet;
     a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
 
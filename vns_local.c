@@ -0,0 +1,1382 @@
+/*-----------------------------------------------------------------------------
+ * File: vns_local.c
+ *
+ * Description:
+ *
+ * Local stand-in for the VNS server, used to benchmark sr without a live
+ * VNS deployment.  It speaks the protocol declared in vnscommand.h to a
+ * single sr client over TCP loopback or a Unix domain socket: it runs the
+ * auth handshake, answers VNSOPEN / VNS_OPEN_TEMPLATE, serves the routing
+ * table (template mode) and the hardware info, and answers ARP requests
+ * for every address it is asked about.
+ *
+ * Once the session is up it drives the router with synthetic UDP or ICMP
+ * echo frames, or with frames read from a pcap file, at a target rate.
+ * Every frame it sends is tagged through its IP id so that frames coming
+ * back from the router can be matched, and on exit it reports the offered
+ * and delivered rate, the loss and the latency distribution.
+ *
+ * With -M the frames themselves move through shared memory rings (see
+ * sr_shmring.h) offered to the router on a Unix socket, and the VNS
+ * session only carries the handshake and control messages.
+ *
+ * Interface file format, one interface per line ('#' starts a comment):
+ *
+ *     <name> <ip> <mac>
+ *     eth1   10.0.1.1  00:00:00:00:01:01
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sched.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_dumper.h"
+#include "sr_shmring.h"
+#include "sha1.h"
+#include "vnscommand.h"
+
+#define VL_DEFAULT_PORT  8888
+#define VL_DEFAULT_VHOST "vrhost"
+#define VL_DEFAULT_COUNT 10000
+#define VL_DEFAULT_SIZE  128
+#define VL_MAX_IFS       16
+#define VL_MAX_MSG       10000
+#define VL_NTAGS         65536
+#define VL_SALT_LEN      20
+#define VL_AUTH_KEY_LEN  64
+#define VL_SHA1_LEN      20
+#define VL_DRAIN_MS      1000
+#define VL_MAX_FLOWS     4096
+#define VL_UDP_SPORT     4000
+#define VL_UDP_DPORT     5000
+
+struct vl_if
+{
+    char name[sr_IFACE_NAMELEN];
+    uint32_t ip;                 /* network byte order */
+    unsigned char addr[ETHER_ADDR_LEN];
+};
+
+struct vl_frame
+{
+    uint8_t* buf;
+    unsigned int len;
+};
+
+struct vl_state
+{
+    int fd;                      /* session with the router */
+    pthread_mutex_t wlock;       /* serializes writes to fd (or the rings) */
+
+    /* -- shared memory transport, -M -- */
+    int use_shm;
+    int busy_poll;
+    struct sr_shm shm;
+
+    struct vl_if ifs[VL_MAX_IFS];
+    int nifs;
+    char vhost[IDSIZE];
+    const char* rtable_file;
+    const char* key_file;
+
+    /* -- traffic -- */
+    int inject;                  /* index of the ingress interface */
+    uint32_t src_ip;             /* nbo */
+    uint32_t dst_ip;             /* nbo */
+    int echo;                    /* send ICMP echo instead of UDP */
+    unsigned int flows;          /* UDP source ports cycled through, -F */
+    unsigned int ttl_every;      /* every n-th frame expires at the router, -X */
+    unsigned int rate;           /* frames per second, 0 = unpaced */
+    unsigned long count;
+    unsigned int size;
+    struct vl_frame* frames;     /* pcap-sourced frames, if any */
+    unsigned long nframes;
+
+    /* -- results -- */
+    uint64_t* tx_time;           /* indexed by IP id tag */
+    uint64_t* lat;
+    unsigned long nlat;
+    unsigned long sent, sent_bytes, untagged;
+    unsigned long received, recv_bytes, arp_replies;
+    unsigned long reordered;     /* arrived behind a later frame of its flow */
+    uint16_t last_tag[VL_MAX_FLOWS];
+    unsigned char seen[VL_MAX_FLOWS];
+    uint64_t t_first_tx, t_last_tx, t_first_rx, t_last_rx;
+    int done_sending;
+};
+
+static uint64_t vl_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Local VNS stand-in and traffic generator\n");
+    printf("Format: %s [-h] [-p port | -U unix_path] [-v host]\n", argv0);
+    printf("           [-i iface file] [-r rtable file] [-k auth_key file]\n");
+    printf("           [-I inject iface] [-a src ip] [-d dst ip] [-e]\n");
+    printf("           [-f pcap file] [-R rate] [-n count] [-S size]\n");
+    printf("           [-M shm socket] [-b] [-F flows] [-X n]\n");
+    printf("   -e sends ICMP echo requests instead of UDP, -F spreads the UDP\n");
+    printf("   frames over that many flows (source ports); -X sends every n-th\n");
+    printf("   frame with TTL 1 to load the router's ICMP error path\n");
+    printf("   -R is in frames per second, 0 sends as fast as possible\n");
+    printf("   -M exchanges frames through shared memory rings offered on the\n");
+    printf("   given socket (sr -B shm -S), -b busy polls them\n");
+    printf("   the router reads its credentials from ./auth_key; when -k is\n");
+    printf("   given the reply is checked against that (64 byte) key\n");
+    printf("   defaults port=%d host=%s count=%d size=%d\n",
+           VL_DEFAULT_PORT, VL_DEFAULT_VHOST, VL_DEFAULT_COUNT,
+           VL_DEFAULT_SIZE);
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_write_all(..) / vl_read_all(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int vl_write_all(struct vl_state* vl, const void* buf, unsigned int len)
+{
+    const uint8_t* p = buf;
+    int ret = 0;
+
+    pthread_mutex_lock(&vl->wlock);
+    while (len > 0)
+    {
+        ssize_t n = write(vl->fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("write(..):vns_local.c::vl_write_all");
+            ret = -1;
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+    pthread_mutex_unlock(&vl->wlock);
+
+    return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_output(..)
+ * Scope: local
+ *
+ * Send a VNSPACKET message for interface ifidx, either over the session
+ * or, in shm mode, as a bare frame on the interface's ring.  A full ring
+ * is waited out rather than dropped so that unpaced runs measure the
+ * router and not the ring size.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vl_output(struct vl_state* vl, int ifidx, const uint8_t* msg,
+                     unsigned int len)
+{
+    const uint8_t* frame = msg + sizeof(c_packet_header);
+    unsigned int flen = len - sizeof(c_packet_header);
+    int ret;
+
+    if (!vl->use_shm)
+    { return vl_write_all(vl, msg, len); }
+
+    if (flen > SR_SHM_SLOT_SZ - sizeof(uint32_t))
+    {
+        fprintf(stderr, "frame of %u bytes does not fit a ring slot\n", flen);
+        return -1;
+    }
+
+    pthread_mutex_lock(&vl->wlock);
+    while (sr_shm_full(&vl->shm, ifidx))
+    {
+        pthread_mutex_unlock(&vl->wlock);
+        pthread_testcancel();
+        if (!vl->busy_poll)
+        { sched_yield(); }
+        pthread_mutex_lock(&vl->wlock);
+    }
+    ret = sr_shm_push(&vl->shm, ifidx, frame, flen);
+    pthread_mutex_unlock(&vl->wlock);
+
+    return ret;
+} /* -- vl_output -- */
+
+static int vl_read_all(int fd, void* buf, unsigned int len)
+{
+    uint8_t* p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("read(..):vns_local.c::vl_read_all");
+            return -1;
+        }
+        if (n == 0)
+        { return 0; }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_read_msg(..)
+ * Scope: local
+ *
+ * Read one command from the router.  The returned buffer is malloc'd and
+ * has both header fields converted to host byte order.
+ *
+ * RETURN VALUES:
+ *
+ *  1 on success, 0 when the router closed the session, -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vl_read_msg(int fd, uint8_t** out)
+{
+    uint32_t len;
+    uint8_t* buf;
+    int ret;
+
+    if ((ret = vl_read_all(fd, &len, 4)) != 1)
+    { return ret; }
+
+    len = ntohl(len);
+    if (len < sizeof(c_base) || len > VL_MAX_MSG)
+    {
+        fprintf(stderr, "Error: bad command length %u from router\n", len);
+        return -1;
+    }
+
+    if ((buf = malloc(len)) == 0)
+    {
+        fprintf(stderr, "Error: out of memory (vl_read_msg)\n");
+        return -1;
+    }
+    ((c_base*)buf)->mLen = len;
+
+    if ((ret = vl_read_all(fd, buf + 4, len - 4)) != 1)
+    {
+        free(buf);
+        return ret;
+    }
+    ((c_base*)buf)->mType = ntohl(((c_base*)buf)->mType);
+
+    *out = buf;
+    return 1;
+} /* -- vl_read_msg -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_load_ifs(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int vl_parse_mac(const char* s, unsigned char* mac)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x",
+               &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != ETHER_ADDR_LEN)
+    { return -1; }
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+    { mac[i] = (unsigned char)b[i]; }
+    return 0;
+}
+
+static int vl_load_ifs(struct vl_state* vl, const char* filename)
+{
+    FILE* fp;
+    char line[BUFSIZ];
+    char name[sr_IFACE_NAMELEN], ip[32], mac[32];
+    struct in_addr addr;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror("fopen(..):vns_local.c::vl_load_ifs");
+        return -1;
+    }
+
+    while (fgets(line, BUFSIZ, fp) != 0)
+    {
+        char* hash = strchr(line, '#');
+        if (hash)
+        { *hash = '\0'; }
+        if (sscanf(line, "%31s %31s %31s", name, ip, mac) != 3)
+        { continue; }
+
+        if (vl->nifs == VL_MAX_IFS)
+        {
+            fprintf(stderr, "Too many interfaces in %s\n", filename);
+            break;
+        }
+        if (inet_aton(ip, &addr) == 0 ||
+            vl_parse_mac(mac, vl->ifs[vl->nifs].addr) != 0)
+        {
+            fprintf(stderr, "Bad interface line in %s: %s", filename, line);
+            fclose(fp);
+            return -1;
+        }
+        strncpy(vl->ifs[vl->nifs].name, name, sr_IFACE_NAMELEN);
+        vl->ifs[vl->nifs].ip = addr.s_addr;
+        vl->nifs++;
+    }
+
+    fclose(fp);
+    return 0;
+} /* -- vl_load_ifs -- */
+
+/* Default topology: three interfaces on 10.0.{1,2,3}.1/24 */
+static void vl_default_ifs(struct vl_state* vl)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        struct vl_if* vif = &vl->ifs[i];
+        snprintf(vif->name, sr_IFACE_NAMELEN, "eth%d", i + 1);
+        vif->ip = htonl(0x0a000001 | ((i + 1) << 8));
+        memset(vif->addr, 0, ETHER_ADDR_LEN);
+        vif->addr[4] = i + 1;
+        vif->addr[5] = 1;
+    }
+    vl->nifs = 3;
+}
+
+static struct vl_if* vl_find_if(struct vl_state* vl, const char* name)
+{
+    int i;
+    for (i = 0; i < vl->nifs; i++)
+    {
+        if (strncmp(vl->ifs[i].name, name, sr_IFACE_NAMELEN) == 0)
+        { return &vl->ifs[i]; }
+    }
+    return 0;
+}
+
+/* Simulated hosts get a locally administered MAC derived from their IP. */
+static void vl_host_mac(uint32_t ip_nbo, unsigned char* mac)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    memcpy(mac + 2, &ip_nbo, 4);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_handshake(..)
+ * Scope: local
+ *
+ * Run the server side of sr_connect_to_server(): auth request / status,
+ * open, optional rtable, then hardware info.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vl_send_auth_request(struct vl_state* vl, uint8_t* salt)
+{
+    uint8_t buf[sizeof(c_auth_request) + VL_SALT_LEN];
+    c_auth_request* req = (c_auth_request*)buf;
+    int i;
+
+    for (i = 0; i < VL_SALT_LEN; i++)
+    { salt[i] = (uint8_t)rand(); }
+
+    req->mLen = htonl(sizeof(buf));
+    req->mType = htonl(VNS_AUTH_REQUEST);
+    memcpy(req->salt, salt, VL_SALT_LEN);
+    return vl_write_all(vl, buf, sizeof(buf));
+}
+
+static int vl_check_auth_reply(struct vl_state* vl, uint8_t* msg,
+                               const uint8_t* salt)
+{
+    c_auth_reply* ar = (c_auth_reply*)msg;
+    char key[VL_AUTH_KEY_LEN + 1];
+    SHA1Context sha1;
+    uint32_t ulen;
+    FILE* fp;
+    int i;
+
+    if (ar->mType != VNS_AUTH_REPLY || ar->mLen < sizeof(*ar))
+    { return 0; }
+
+    ulen = ntohl(ar->usernameLen);
+    if (ar->mLen < sizeof(*ar) + ulen + VL_SHA1_LEN)
+    { return 0; }
+
+    printf("auth reply from user %.*s\n", (int)ulen, ar->username);
+
+    if (!vl->key_file)
+    { return 1; }
+
+    if ((fp = fopen(vl->key_file, "r")) == 0)
+    {
+        perror("unable to read auth key file");
+        return 0;
+    }
+    memset(key, 0, sizeof(key));
+    if (fgets(key, sizeof(key), fp) != key)
+    {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    SHA1Reset(&sha1);
+    SHA1Input(&sha1, salt, VL_SALT_LEN);
+    SHA1Input(&sha1, (unsigned char*)key, VL_AUTH_KEY_LEN);
+    if (!SHA1Result(&sha1))
+    { return 0; }
+    for (i = 0; i < 5; i++)
+    { sha1.Message_Digest[i] = htonl(sha1.Message_Digest[i]); }
+
+    return memcmp(ar->username + ulen, sha1.Message_Digest, VL_SHA1_LEN) == 0;
+}
+
+static int vl_send_auth_status(struct vl_state* vl, int ok)
+{
+    const char* msg = ok ? "welcome to vns_local" : "bad credentials";
+    uint8_t buf[sizeof(c_auth_status) + 64];
+    c_auth_status* st = (c_auth_status*)buf;
+    unsigned int len = sizeof(c_auth_status) + strlen(msg) + 1;
+
+    st->mLen = htonl(len);
+    st->mType = htonl(VNS_AUTH_STATUS);
+    st->auth_ok = ok;
+    strcpy(st->msg, msg);
+    return vl_write_all(vl, buf, len);
+}
+
+static int vl_send_rtable(struct vl_state* vl)
+{
+    uint8_t buf[VL_MAX_MSG];
+    c_rtable* rt = (c_rtable*)buf;
+    size_t max = sizeof(buf) - sizeof(c_rtable);
+    size_t n = 0;
+    FILE* fp;
+
+    if (vl->rtable_file)
+    {
+        if ((fp = fopen(vl->rtable_file, "r")) == 0)
+        {
+            perror("unable to read rtable file");
+            return -1;
+        }
+        n = fread(rt->rtable, 1, max, fp);
+        fclose(fp);
+    }
+    else
+    {
+        /* one connected /24 per interface plus a default out the first */
+        int i;
+        for (i = 0; i < vl->nifs && n < max; i++)
+        {
+            struct in_addr net, gw;
+            char net_s[INET_ADDRSTRLEN], gw_s[INET_ADDRSTRLEN];
+
+            net.s_addr = vl->ifs[i].ip & htonl(0xffffff00);
+            gw.s_addr = vl->ifs[i].ip ^ htonl(0xff);
+            inet_ntop(AF_INET, &net, net_s, sizeof(net_s));
+            inet_ntop(AF_INET, &gw, gw_s, sizeof(gw_s));
+            if (i == 0)
+            {
+                n += snprintf(rt->rtable + n, max - n,
+                              "0.0.0.0 %s 0.0.0.0 %s\n", gw_s,
+                              vl->ifs[i].name);
+            }
+            n += snprintf(rt->rtable + n, max - n, "%s %s 255.255.255.0 %s\n",
+                          net_s, gw_s, vl->ifs[i].name);
+        }
+        if (n > max)
+        { n = max; }
+    }
+
+    rt->mLen = htonl(sizeof(c_rtable) + n);
+    rt->mType = htonl(VNS_RTABLE);
+    memset(rt->mVirtualHostID, 0, IDSIZE);
+    strncpy(rt->mVirtualHostID, vl->vhost, IDSIZE - 1);
+    return vl_write_all(vl, buf, sizeof(c_rtable) + n);
+}
+
+static int vl_send_hwinfo(struct vl_state* vl)
+{
+    c_hwinfo hw;
+    int n = 0, i;
+
+    memset(&hw, 0, sizeof(hw));
+    for (i = 0; i < vl->nifs; i++)
+    {
+        hw.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strncpy(hw.mHWInfo[n++].value, vl->ifs[i].name, 32);
+        hw.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw.mHWInfo[n++].value, vl->ifs[i].addr, ETHER_ADDR_LEN);
+        hw.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw.mHWInfo[n++].value, &vl->ifs[i].ip, 4);
+    }
+
+    hw.mLen = htonl(2 * sizeof(uint32_t) + n * sizeof(c_hw_entry));
+    hw.mType = htonl(VNSHWINFO);
+    return vl_write_all(vl, &hw, 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry));
+}
+
+static int vl_handshake(struct vl_state* vl)
+{
+    uint8_t salt[VL_SALT_LEN];
+    uint8_t* msg = 0;
+    int ok;
+
+    if (vl_send_auth_request(vl, salt) != 0)
+    { return -1; }
+
+    if (vl_read_msg(vl->fd, &msg) != 1)
+    { return -1; }
+    ok = vl_check_auth_reply(vl, msg, salt);
+    free(msg);
+
+    if (vl_send_auth_status(vl, ok) != 0 || !ok)
+    {
+        fprintf(stderr, "router failed authentication\n");
+        return -1;
+    }
+
+    if (vl_read_msg(vl->fd, &msg) != 1)
+    { return -1; }
+
+    switch (((c_base*)msg)->mType)
+    {
+        case VNSOPEN:
+            printf("router opened topology %d as %.*s\n",
+                   ntohs(((c_open*)msg)->topoID), IDSIZE,
+                   ((c_open*)msg)->mVirtualHostID);
+            break;
+        case VNS_OPEN_TEMPLATE:
+            printf("router opened template %.30s\n",
+                   ((c_open_template*)msg)->templateName);
+            if (vl_send_rtable(vl) != 0)
+            {
+                free(msg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Error: expected open but got %u\n",
+                    ((c_base*)msg)->mType);
+            free(msg);
+            return -1;
+    }
+    free(msg);
+
+    return vl_send_hwinfo(vl);
+} /* -- vl_handshake -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_build_frame(..)
+ * Scope: local
+ *
+ * Build the synthetic frame that is sent (with a fresh tag) for every
+ * generated packet: a UDP datagram, or an ICMP echo request with -e.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void vl_build_frame(struct vl_state* vl, struct vl_frame* f)
+{
+    struct vl_if* vif = &vl->ifs[vl->inject];
+    sr_ethernet_hdr_t* eth;
+    sr_ip_hdr_t* ip;
+    uint8_t* l4;
+    unsigned int l4_len, i;
+
+    f->len = vl->size;
+    f->buf = calloc(1, f->len);
+    assert(f->buf);
+
+    eth = (sr_ethernet_hdr_t*)f->buf;
+    ip = (sr_ip_hdr_t*)(f->buf + sizeof(sr_ethernet_hdr_t));
+    l4 = (uint8_t*)ip + sizeof(sr_ip_hdr_t);
+    l4_len = f->len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t);
+
+    memcpy(eth->ether_dhost, vif->addr, ETHER_ADDR_LEN);
+    vl_host_mac(vl->src_ip, eth->ether_shost);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(f->len - sizeof(sr_ethernet_hdr_t));
+    ip->ip_off = htons(IP_DF);
+    ip->ip_ttl = 64;
+    ip->ip_src = vl->src_ip;
+    ip->ip_dst = vl->dst_ip;
+
+    for (i = 8; i < l4_len; i++)
+    { l4[i] = (uint8_t)i; }
+
+    if (vl->echo)
+    {
+        sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)l4;
+        ip->ip_p = ip_protocol_icmp;
+        icmp->icmp_type = 8;
+        icmp->icmp_code = 0;
+        l4[4] = 0x51; /* identifier */
+        l4[5] = 0x0c;
+        icmp->icmp_sum = 0;
+        icmp->icmp_sum = cksum(l4, l4_len);
+    }
+    else
+    {
+        ip->ip_p = 17; /* UDP, checksum left at zero */
+        l4[0] = VL_UDP_SPORT >> 8;
+        l4[1] = VL_UDP_SPORT & 0xff;
+        l4[2] = VL_UDP_DPORT >> 8;
+        l4[3] = VL_UDP_DPORT & 0xff;
+        l4[4] = l4_len >> 8;
+        l4[5] = l4_len & 0xff;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_load_pcap(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static uint32_t vl_swap32(uint32_t v)
+{
+    return ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+           ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+static int vl_load_pcap(struct vl_state* vl, const char* filename)
+{
+    struct pcap_file_header fh;
+    struct pcap_sf_pkthdr ph;
+    unsigned long cap = 0;
+    int swapped;
+    FILE* fp;
+
+    if ((fp = fopen(filename, "r")) == 0)
+    {
+        perror("fopen(..):vns_local.c::vl_load_pcap");
+        return -1;
+    }
+
+    if (fread(&fh, sizeof(fh), 1, fp) != 1 ||
+        (fh.magic != TCPDUMP_MAGIC && fh.magic != vl_swap32(TCPDUMP_MAGIC)))
+    {
+        fprintf(stderr, "%s is not a pcap file\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    swapped = (fh.magic != TCPDUMP_MAGIC);
+
+    while (fread(&ph, sizeof(ph), 1, fp) == 1)
+    {
+        uint32_t caplen = swapped ? vl_swap32(ph.caplen) : ph.caplen;
+        struct vl_frame* f;
+
+        if (caplen > VL_MAX_MSG)
+        {
+            fprintf(stderr, "%s: bad record length %u\n", filename, caplen);
+            break;
+        }
+        if (vl->nframes == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            vl->frames = realloc(vl->frames, cap * sizeof(struct vl_frame));
+            assert(vl->frames);
+        }
+        f = &vl->frames[vl->nframes];
+        f->len = caplen;
+        f->buf = malloc(caplen ? caplen : 1);
+        assert(f->buf);
+        if (fread(f->buf, caplen, 1, fp) != 1 && caplen)
+        {
+            free(f->buf);
+            break;
+        }
+        if (caplen < sizeof(sr_ethernet_hdr_t))
+        {
+            free(f->buf);
+            continue;
+        }
+        /* frames enter the router on the inject interface */
+        memcpy(((sr_ethernet_hdr_t*)f->buf)->ether_dhost,
+               vl->ifs[vl->inject].addr, ETHER_ADDR_LEN);
+        vl->nframes++;
+    }
+
+    fclose(fp);
+    printf("loaded %lu frames from %s\n", vl->nframes, filename);
+    return vl->nframes ? 0 : -1;
+} /* -- vl_load_pcap -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_send_frame(..)
+ * Scope: local
+ *
+ * Tag an IPv4 frame with the low 16 bits of seq through its IP id, stamp
+ * the send time for that tag and hand the frame to the router.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vl_send_frame(struct vl_state* vl, struct vl_frame* f,
+                         unsigned long seq)
+{
+    uint8_t buf[sizeof(c_packet_header) + VL_MAX_MSG];
+    c_packet_header* hdr = (c_packet_header*)buf;
+    uint8_t* frame = buf + sizeof(c_packet_header);
+    unsigned int total = sizeof(c_packet_header) + f->len;
+    uint64_t now;
+    int tagged = 0;
+
+    hdr->mLen = htonl(total);
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strncpy(hdr->mInterfaceName, vl->ifs[vl->inject].name,
+            sizeof(hdr->mInterfaceName));
+    memcpy(frame, f->buf, f->len);
+
+    if (f->len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) &&
+        ethertype(frame) == ethertype_ip)
+    {
+        sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        unsigned int hl = ip->ip_hl * 4;
+
+        if (hl >= sizeof(sr_ip_hdr_t) &&
+            f->len >= sizeof(sr_ethernet_hdr_t) + hl)
+        {
+            /* -- spread synthetic UDP over -F flows by source port -- */
+            if (!vl->frames && !vl->echo && vl->flows > 1)
+            {
+                uint16_t sport = htons(VL_UDP_SPORT + seq % vl->flows);
+                memcpy((uint8_t*)ip + hl, &sport, 2);
+            }
+            ip->ip_id = htons((uint16_t)seq);
+            tagged = 1;
+
+            /* -- exception load: not forwarded, so not counted as loss -- */
+            if (!vl->frames && vl->ttl_every)
+            {
+                tagged = seq % vl->ttl_every != 0;
+                ip->ip_ttl = tagged ? 64 : 1;
+            }
+            ip->ip_sum = 0;
+            ip->ip_sum = cksum(ip, hl);
+        }
+    }
+
+    now = vl_now_ns();
+    if (tagged)
+    { __atomic_store_n(&vl->tx_time[seq & (VL_NTAGS - 1)], now, __ATOMIC_RELAXED); }
+    else
+    { vl->untagged++; }
+
+    if (vl_output(vl, vl->inject, buf, total) != 0)
+    { return -1; }
+
+    if (vl->sent == 0)
+    { vl->t_first_tx = now; }
+    vl->t_last_tx = now;
+    vl->sent++;
+    vl->sent_bytes += f->len;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_sender(..)
+ * Scope: local
+ *
+ * Thread body: send vl->count frames paced at vl->rate.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* vl_sender(void* arg)
+{
+    struct vl_state* vl = arg;
+    struct vl_frame synth;
+    uint64_t start, due, now;
+    unsigned long i;
+
+    if (!vl->frames)
+    { vl_build_frame(vl, &synth); }
+
+    start = vl_now_ns();
+    for (i = 0; i < vl->count; i++)
+    {
+        struct vl_frame* f = vl->frames ? &vl->frames[i % vl->nframes]
+                                        : &synth;
+        if (vl->rate)
+        {
+            due = start + (uint64_t)i * 1000000000ULL / vl->rate;
+            now = vl_now_ns();
+            if (due > now + 50000)
+            {
+                struct timespec ts;
+                ts.tv_sec = (due - now) / 1000000000ULL;
+                ts.tv_nsec = (due - now) % 1000000000ULL;
+                nanosleep(&ts, 0);
+            }
+        }
+        if (vl_send_frame(vl, f, i) != 0)
+        { break; }
+    }
+
+    if (!vl->frames)
+    { free(synth.buf); }
+
+    __atomic_store_n(&vl->done_sending, 1, __ATOMIC_RELEASE);
+    return 0;
+} /* -- vl_sender -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_handle_packet(..)
+ * Scope: local
+ *
+ * A frame sent by the router.  ARP requests are answered on behalf of the
+ * simulated hosts; IPv4 frames carrying a live tag are matched to their
+ * send time.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void vl_answer_arp(struct vl_state* vl, const char* iface,
+                          sr_arp_hdr_t* req)
+{
+    uint8_t buf[sizeof(c_packet_header) + sizeof(sr_ethernet_hdr_t) +
+                sizeof(sr_arp_hdr_t)];
+    c_packet_header* hdr = (c_packet_header*)buf;
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)(buf + sizeof(c_packet_header));
+    sr_arp_hdr_t* arp = (sr_arp_hdr_t*)(eth + 1);
+
+    hdr->mLen = htonl(sizeof(buf));
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strncpy(hdr->mInterfaceName, iface, sizeof(hdr->mInterfaceName));
+
+    memcpy(eth->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+    vl_host_mac(req->ar_tip, eth->ether_shost);
+    eth->ether_type = htons(ethertype_arp);
+
+    arp->ar_hrd = htons(arp_hrd_ethernet);
+    arp->ar_pro = htons(ethertype_ip);
+    arp->ar_hln = ETHER_ADDR_LEN;
+    arp->ar_pln = 4;
+    arp->ar_op = htons(arp_op_reply);
+    vl_host_mac(req->ar_tip, arp->ar_sha);
+    arp->ar_sip = req->ar_tip;
+    memcpy(arp->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+    arp->ar_tip = req->ar_sip;
+
+    if (vl_output(vl, vl_find_if(vl, iface) - vl->ifs, buf, sizeof(buf)) == 0)
+    { vl->arp_replies++; }
+}
+
+static void vl_handle_frame(struct vl_state* vl, const char* iface,
+                            uint8_t* frame, unsigned int len, uint64_t now)
+{
+    if (len < sizeof(sr_ethernet_hdr_t))
+    { return; }
+
+    if (ethertype(frame) == ethertype_arp &&
+        len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        sr_arp_hdr_t* arp = (sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        if (ntohs(arp->ar_op) == arp_op_request && vl_find_if(vl, iface))
+        { vl_answer_arp(vl, iface, arp); }
+        return;
+    }
+
+    if (ethertype(frame) == ethertype_ip &&
+        len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    {
+        sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        uint64_t sent = __atomic_exchange_n(&vl->tx_time[ntohs(ip->ip_id)], 0,
+                                            __ATOMIC_RELAXED);
+        if (!sent)
+        { return; }
+
+        /* -- each flow's tags must come back in the order they were sent -- */
+        if (ip->ip_p == 17 && len >= sizeof(sr_ethernet_hdr_t) + ip->ip_hl * 4 + 2)
+        {
+            unsigned int flow = ((uint8_t*)ip)[ip->ip_hl * 4] << 8 |
+                                ((uint8_t*)ip)[ip->ip_hl * 4 + 1];
+            uint16_t tag = ntohs(ip->ip_id);
+
+            flow = (flow - VL_UDP_SPORT) & (VL_MAX_FLOWS - 1);
+            if (vl->seen[flow] && (int16_t)(tag - vl->last_tag[flow]) < 0)
+            { vl->reordered++; }
+            else
+            { vl->last_tag[flow] = tag; }
+            vl->seen[flow] = 1;
+        }
+
+        if (vl->received == 0)
+        { vl->t_first_rx = now; }
+        vl->t_last_rx = now;
+        vl->received++;
+        vl->recv_bytes += len;
+        if (vl->nlat < vl->count)
+        { vl->lat[vl->nlat++] = now - sent; }
+    }
+} /* -- vl_handle_frame -- */
+
+static void vl_handle_packet(struct vl_state* vl, uint8_t* msg, uint64_t now)
+{
+    c_packet_header* hdr = (c_packet_header*)msg;
+    char iface[sizeof(hdr->mInterfaceName) + 1];
+
+    if (hdr->mLen < sizeof(c_packet_header))
+    { return; }
+
+    memcpy(iface, hdr->mInterfaceName, sizeof(hdr->mInterfaceName));
+    iface[sizeof(hdr->mInterfaceName)] = '\0';
+
+    vl_handle_frame(vl, iface, msg + sizeof(c_packet_header),
+                    hdr->mLen - sizeof(c_packet_header), now);
+} /* -- vl_handle_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_drain_shm(..)
+ * Scope: local
+ *
+ * Handle every frame waiting on the rings from the router, returns the
+ * number handled.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned int vl_drain_shm(struct vl_state* vl)
+{
+    unsigned int got = 0;
+    int i;
+
+    for (i = 0; i < vl->nifs; i++)
+    {
+        unsigned int len;
+        uint8_t* frame;
+
+        while ((frame = sr_shm_peek(&vl->shm, i, &len)))
+        {
+            vl_handle_frame(vl, vl->ifs[i].name, frame, len, vl_now_ns());
+            sr_shm_consume(&vl->shm, i);
+            got++;
+        }
+    }
+    return got;
+} /* -- vl_drain_shm -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_report(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static int vl_cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double vl_rate(unsigned long n, uint64_t t0, uint64_t t1)
+{
+    return (n > 1 && t1 > t0) ? (n - 1) * 1e9 / (t1 - t0) : 0.0;
+}
+
+static void vl_report(struct vl_state* vl)
+{
+    double tx_pps = vl_rate(vl->sent, vl->t_first_tx, vl->t_last_tx);
+    double rx_pps = vl_rate(vl->received, vl->t_first_rx, vl->t_last_rx);
+    unsigned long tagged = vl->sent - vl->untagged;
+
+    printf("\n---------------------------------------------\n");
+    printf("sent      %lu frames (%lu untagged), %lu bytes\n",
+           vl->sent, vl->untagged, vl->sent_bytes);
+    printf("received  %lu frames, %lu bytes\n", vl->received, vl->recv_bytes);
+    printf("arp       %lu replies\n", vl->arp_replies);
+    printf("reordered %lu frames\n", vl->reordered);
+    printf("loss      %lu (%.3f%%)\n", tagged - vl->received,
+           tagged ? 100.0 * (tagged - vl->received) / tagged : 0.0);
+    printf("offered   %.0f pps, %.3f Mbps\n", tx_pps,
+           vl->sent ? tx_pps * 8.0 * vl->sent_bytes / vl->sent / 1e6 : 0.0);
+    printf("delivered %.0f pps, %.3f Mbps\n", rx_pps,
+           vl->received ? rx_pps * 8.0 * vl->recv_bytes / vl->received / 1e6
+                        : 0.0);
+
+    if (vl->nlat)
+    {
+        uint64_t sum = 0;
+        unsigned long i;
+
+        qsort(vl->lat, vl->nlat, sizeof(uint64_t), vl_cmp_u64);
+        for (i = 0; i < vl->nlat; i++)
+        { sum += vl->lat[i]; }
+        printf("latency   min %.1f avg %.1f p50 %.1f p99 %.1f p99.9 %.1f "
+               "max %.1f us\n",
+               vl->lat[0] / 1e3, (double)sum / vl->nlat / 1e3,
+               vl->lat[vl->nlat / 2] / 1e3,
+               vl->lat[(unsigned long)(vl->nlat * 0.99)] / 1e3,
+               vl->lat[(unsigned long)(vl->nlat * 0.999)] / 1e3,
+               vl->lat[vl->nlat - 1] / 1e3);
+    }
+    printf("---------------------------------------------\n");
+} /* -- vl_report -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: vl_listen(..)
+ * Scope: local
+ *
+ * Listen on TCP loopback, or on a Unix socket when unix_path is set, and
+ * accept a single router session.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int vl_listen(unsigned short port, const char* unix_path)
+{
+    int lfd, fd, one = 1;
+
+    if (unix_path)
+    {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        unlink(unix_path);
+
+        if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+            bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            perror("socket/bind(..):vns_local.c::vl_listen");
+            return -1;
+        }
+        printf("listening on %s\n", unix_path);
+    }
+    else
+    {
+        struct sockaddr_in sin;
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        {
+            perror("socket(..):vns_local.c::vl_listen");
+            return -1;
+        }
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(lfd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+        {
+            perror("bind(..):vns_local.c::vl_listen");
+            close(lfd);
+            return -1;
+        }
+        printf("listening on 127.0.0.1:%d\n", port);
+    }
+
+    if (listen(lfd, 1) < 0)
+    {
+        perror("listen(..):vns_local.c::vl_listen");
+        close(lfd);
+        return -1;
+    }
+
+    fd = accept(lfd, 0, 0);
+    if (fd < 0)
+    { perror("accept(..):vns_local.c::vl_listen"); }
+    close(lfd);
+    if (unix_path)
+    { unlink(unix_path); }
+
+    return fd;
+} /* -- vl_listen -- */
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char** argv)
+{
+    struct vl_state vl;
+    unsigned short port = VL_DEFAULT_PORT;
+    const char* unix_path = 0;
+    const char* if_file = 0;
+    const char* inject = 0;
+    const char* pcap_file = 0;
+    const char* shm_path = 0;
+    const char* src = 0;
+    const char* dst = 0;
+    struct in_addr addr;
+    pthread_t sender;
+    uint64_t drain_start = 0;
+    unsigned int spins = 0;
+    int shm_lfd = -1;
+    int c, ret = 0;
+
+    memset(&vl, 0, sizeof(vl));
+    vl.fd = -1;
+    vl.count = VL_DEFAULT_COUNT;
+    vl.size = VL_DEFAULT_SIZE;
+    strncpy(vl.vhost, VL_DEFAULT_VHOST, IDSIZE);
+    pthread_mutex_init(&vl.wlock, 0);
+
+    while ((c = getopt(argc, argv, "hp:U:v:i:r:k:I:a:d:ef:R:n:S:M:bF:X:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'U':
+                unix_path = optarg;
+                break;
+            case 'v':
+                strncpy(vl.vhost, optarg, IDSIZE - 1);
+                break;
+            case 'i':
+                if_file = optarg;
+                break;
+            case 'r':
+                vl.rtable_file = optarg;
+                break;
+            case 'k':
+                vl.key_file = optarg;
+                break;
+            case 'I':
+                inject = optarg;
+                break;
+            case 'a':
+                src = optarg;
+                break;
+            case 'd':
+                dst = optarg;
+                break;
+            case 'e':
+                vl.echo = 1;
+                break;
+            case 'f':
+                pcap_file = optarg;
+                break;
+            case 'R':
+                vl.rate = strtoul(optarg, 0, 10);
+                break;
+            case 'n':
+                vl.count = strtoul(optarg, 0, 10);
+                break;
+            case 'S':
+                vl.size = atoi(optarg);
+                break;
+            case 'M':
+                shm_path = optarg;
+                break;
+            case 'b':
+                vl.busy_poll = 1;
+                break;
+            case 'F':
+                vl.flows = atoi(optarg);
+                if (vl.flows > VL_MAX_FLOWS)
+                { vl.flows = VL_MAX_FLOWS; }
+                break;
+            case 'X':
+                vl.ttl_every = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    srand(time(0));
+    signal(SIGPIPE, SIG_IGN);
+
+    if (if_file)
+    {
+        if (vl_load_ifs(&vl, if_file) != 0 || vl.nifs == 0)
+        { exit(1); }
+    }
+    else
+    { vl_default_ifs(&vl); }
+
+    if (inject)
+    {
+        struct vl_if* vif = vl_find_if(&vl, inject);
+        if (!vif)
+        {
+            fprintf(stderr, "no interface named %s\n", inject);
+            exit(1);
+        }
+        vl.inject = vif - vl.ifs;
+    }
+
+    /* default source: host .100 on the inject interface's /24 */
+    vl.src_ip = (vl.ifs[vl.inject].ip & htonl(0xffffff00)) | htonl(100);
+    if (src && inet_aton(src, &addr))
+    { vl.src_ip = addr.s_addr; }
+
+    /* default destination: the inject interface itself with -e, otherwise
+       a host behind the last interface */
+    if (vl.echo)
+    { vl.dst_ip = vl.ifs[vl.inject].ip; }
+    else
+    { vl.dst_ip = (vl.ifs[vl.nifs - 1].ip & htonl(0xffffff00)) | htonl(100); }
+    if (dst && inet_aton(dst, &addr))
+    { vl.dst_ip = addr.s_addr; }
+
+    if (vl.size < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8)
+    { vl.size = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8; }
+    if (vl.size > 1514)
+    { vl.size = 1514; }
+
+    if (pcap_file && vl_load_pcap(&vl, pcap_file) != 0)
+    { exit(1); }
+
+    vl.tx_time = calloc(VL_NTAGS, sizeof(uint64_t));
+    vl.lat = malloc((vl.count ? vl.count : 1) * sizeof(uint64_t));
+    assert(vl.tx_time && vl.lat);
+
+    /* -- listen before the session so the router can attach right away -- */
+    if (shm_path && (shm_lfd = sr_shm_listen(shm_path)) < 0)
+    { exit(1); }
+
+    if ((vl.fd = vl_listen(port, unix_path)) < 0)
+    { exit(1); }
+
+    if (vl_handshake(&vl) != 0)
+    {
+        close(vl.fd);
+        exit(1);
+    }
+
+    if (shm_path)
+    {
+        char names[VL_MAX_IFS][sr_IFACE_NAMELEN];
+        int i;
+
+        for (i = 0; i < vl.nifs; i++)
+        { memcpy(names[i], vl.ifs[i].name, sr_IFACE_NAMELEN); }
+
+        printf("waiting for the router to attach on %s\n", shm_path);
+        if (sr_shm_create(&vl.shm, names, vl.nifs, SR_SHM_SLOTS) != 0 ||
+            sr_shm_offer(&vl.shm, shm_lfd) != 0)
+        {
+            close(vl.fd);
+            exit(1);
+        }
+        close(shm_lfd);
+        unlink(shm_path);
+        vl.use_shm = 1;
+    }
+    printf("session up, sending %lu frames on %s\n", vl.count,
+           vl.ifs[vl.inject].name);
+
+    pthread_create(&sender, 0, vl_sender, &vl);
+
+    /* -- receive until the sender is done and the drain time has passed -- */
+    while (1)
+    {
+        struct pollfd pfd;
+        uint8_t* msg = 0;
+        uint64_t now;
+
+        if (__atomic_load_n(&vl.done_sending, __ATOMIC_ACQUIRE))
+        {
+            now = vl_now_ns();
+            if (!drain_start)
+            { drain_start = now; }
+            if (now - drain_start > VL_DRAIN_MS * 1000000ULL ||
+                vl.received == vl.sent - vl.untagged)
+            { break; }
+        }
+
+        if (vl.use_shm)
+        {
+            /* -- with -b the session is only looked at now and then -- */
+            if (vl_drain_shm(&vl) || (vl.busy_poll && (++spins & 1023)))
+            { continue; }
+            if (!(sr_shm_wait(&vl.shm, vl.fd, vl.busy_poll ? 0 : 100) &
+                  SR_SHM_WAKE_FD))
+            { continue; }
+        }
+        else
+        {
+            pfd.fd = vl.fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 100) <= 0)
+            { continue; }
+        }
+
+        if ((c = vl_read_msg(vl.fd, &msg)) != 1)
+        {
+            fprintf(stderr, "router closed the session\n");
+            ret = 1;
+            break;
+        }
+
+        if (((c_base*)msg)->mType == VNSPACKET)
+        { vl_handle_packet(&vl, msg, vl_now_ns()); }
+        else
+        { fprintf(stderr, "ignoring command %u\n", ((c_base*)msg)->mType); }
+        free(msg);
+    }
+
+    if (ret == 0)
+    {
+        c_close cl;
+
+        memset(&cl, 0, sizeof(cl));
+        cl.mLen = htonl(sizeof(cl));
+        cl.mType = htonl(VNSCLOSE);
+        strncpy(cl.mErrorMessage, "vns_local run complete",
+                sizeof(cl.mErrorMessage) - 1);
+        vl_write_all(&vl, &cl, sizeof(cl));
+    }
+    else
+    { pthread_cancel(sender); }
+    pthread_join(sender, 0);
+
+    vl_report(&vl);
+
+    if (vl.use_shm)
+    {
+        int i;
+        for (i = 0; i < vl.nifs; i++)
+        {
+            printf("%s ring drops: to router %lu, from router %lu\n",
+                   vl.ifs[i].name, sr_shm_drops(&vl.shm, i, SR_SHM_ROUTER),
+                   sr_shm_drops(&vl.shm, i, SR_SHM_PEER));
+        }
+        sr_shm_close(&vl.shm);
+    }
+
+    close(vl.fd);
+    return ret;
+}/* -- main -- */